@@ -0,0 +1,323 @@
+// Benchmark driver (make bench): times add, sub, mul, det and eigen on every
+// backend over a sweep of sizes and shapes, with warmup runs and repetitions,
+// and writes one record per (op, shape, size, backend, workers) as CSV or
+// JSON, with the per-phase times of the pool runs. It links the project
+// objects, so it measures the code the menu runs.
+//
+//   matrix-bench [--config path] [--ops add,sub,mul,det,eigen] [--backends single,omp,pool]
+//                [--sizes 64,128,256] [--shapes square,tall,wide] [--workers 1,2,4]
+//                [--warmup 2] [--reps 10] [--format csv|json] [--out file]
+//
+// The config supplies the machine model, omp_threads, pool_chunk, gemm_block
+// and the default worker count; --workers runs the pool backend once per count.
+
+#include "common.h"
+#include "menu.h"
+#include "backend.h"
+#include "cost.h"
+#include "ops.h"
+#include "timer.h"
+#include "mat_alloc.h"
+
+#define BENCH_MAX_LIST 16
+#define BENCH_EIG_TOL  1e-6       // same tolerance and max iterations as the menu
+#define BENCH_EIG_MAX  1000
+
+// Operands per size N: A is (N*rows)x(N*cols); mul multiplies it by a
+// (cols*N)xN matrix, so every shape of a mul does the same 2N^3 flops.
+typedef struct {
+    const char *name;
+    double rows, cols;
+} Shape;
+
+static const Shape g_shapes[] = {
+    { "square", 1.0, 1.0 },
+    { "tall",   2.0, 0.5 },
+    { "wide",   0.5, 2.0 },
+};
+
+#define SHAPE_COUNT ((int)(sizeof(g_shapes) / sizeof(g_shapes[0])))
+
+typedef struct {
+    const char *config;
+    int ops[BOP_COUNT], nops;
+    int backends[BK_CONCRETE], nbackends;
+    int sizes[BENCH_MAX_LIST], nsizes;
+    int shapes[SHAPE_COUNT], nshapes;
+    int workers[BENCH_MAX_LIST], nworkers;
+    int warmup, reps;
+    int json;
+    const char *out;
+} BenchArgs;
+
+// One line of the report
+typedef struct {
+    int op, backend, workers, shape;
+    int m, k, n;                  // A is m x k, B is k x n (add/sub: n = k)
+    int iters;                    // eigen: iterations of the last run
+    double median, p95, mean, stddev, min;   // milliseconds
+    double gflops, gbs;           // at the median time (backend_rates)
+    double phase[PH_COUNT];       // pool: mean milliseconds per run in each phase (timer.h)
+} BenchResult;
+
+// Deterministic values in [0, 1): a positive matrix has one dominant eigenvalue,
+// so the power iteration converges in a few steps on every size
+static Matrix *bench_matrix(int rows, int cols, unsigned seed) {
+    Matrix *m = matrix_create("", rows, cols);
+    for (size_t i = 0; i < (size_t)rows * cols; i++)
+        m->data[i] = (double)((i * 2654435761u + seed) % 1000u) / 1000.0;
+    return m;
+}
+
+// Comma-separated list of names or numbers; -1 on an unknown entry or too many
+static int parse_list(const char *s, int *out, int max, int (*lookup)(const char *)) {
+    char buf[256];
+    snprintf(buf, sizeof(buf), "%s", s);
+    int n = 0;
+    for (char *tok = strtok(buf, ","); tok; tok = strtok(NULL, ",")) {
+        int v = lookup ? lookup(tok) : atoi(tok);
+        if (v < 0 || (!lookup && v == 0) || n == max) return -1;
+        out[n++] = v;
+    }
+    return n > 0 ? n : -1;
+}
+
+static int lookup_op(const char *s) {
+    for (int i = 0; i < BOP_COUNT; i++)
+        if (strcmp(s, backend_op_name(i)) == 0) return i;
+    return -1;
+}
+
+static int lookup_backend(const char *s) {
+    int b = backend_parse(s);
+    return b >= 0 && b < BK_CONCRETE ? b : -1;   // auto and compare aren't a single backend
+}
+
+static int lookup_shape(const char *s) {
+    for (int i = 0; i < SHAPE_COUNT; i++)
+        if (strcmp(s, g_shapes[i].name) == 0) return i;
+    return -1;
+}
+
+static void usage(const char *prog) {
+    printf("Usage: %s [--config path] [--ops add,sub,mul,det,eigen] [--backends single,omp,pool]\n"
+           "       [--sizes 64,128,256] [--shapes square,tall,wide] [--workers 1,2,4]\n"
+           "       [--warmup 2] [--reps 10] [--format csv|json] [--out file]\n", prog);
+}
+
+static int parse_args(int argc, char **argv, BenchArgs *a) {
+    memset(a, 0, sizeof(*a));
+    a->config = "config/default.conf";
+    for (int i = 0; i < BOP_COUNT; i++) a->ops[a->nops++] = i;
+    a->backends[a->nbackends++] = BK_SINGLE;
+#ifdef HAVE_OMP
+    a->backends[a->nbackends++] = BK_OMP;
+#endif
+    a->backends[a->nbackends++] = BK_POOL;
+    a->sizes[0] = 64;
+    a->sizes[1] = 128;
+    a->sizes[2] = 256;
+    a->nsizes = 3;
+    for (int i = 0; i < SHAPE_COUNT; i++) a->shapes[a->nshapes++] = i;
+    a->warmup = 2;
+    a->reps = 10;
+
+    for (int i = 1; i < argc; i++) {
+        const char *opt = argv[i], *val = i + 1 < argc ? argv[i + 1] : NULL;
+        int n = 0;
+        if (strcmp(opt, "--help") == 0) {
+            usage(argv[0]);
+            exit(0);
+        }
+        if (val == NULL) {
+            fprintf(stderr, "bench: %s needs a value\n", opt);
+            return -1;
+        }
+        i++;
+        if (strcmp(opt, "--config") == 0) a->config = val;
+        else if (strcmp(opt, "--out") == 0) a->out = val;
+        else if (strcmp(opt, "--ops") == 0) n = a->nops = parse_list(val, a->ops, BOP_COUNT, lookup_op);
+        else if (strcmp(opt, "--backends") == 0) n = a->nbackends = parse_list(val, a->backends, BK_CONCRETE, lookup_backend);
+        else if (strcmp(opt, "--sizes") == 0) n = a->nsizes = parse_list(val, a->sizes, BENCH_MAX_LIST, NULL);
+        else if (strcmp(opt, "--shapes") == 0) n = a->nshapes = parse_list(val, a->shapes, SHAPE_COUNT, lookup_shape);
+        else if (strcmp(opt, "--workers") == 0) n = a->nworkers = parse_list(val, a->workers, BENCH_MAX_LIST, NULL);
+        else if (strcmp(opt, "--warmup") == 0) n = (a->warmup = atoi(val)) >= 0 ? 1 : -1;
+        else if (strcmp(opt, "--reps") == 0) n = (a->reps = atoi(val)) > 0 ? 1 : -1;
+        else if (strcmp(opt, "--format") == 0) {
+            a->json = strcmp(val, "json") == 0;
+            n = a->json || strcmp(val, "csv") == 0 ? 1 : -1;
+        } else {
+            fprintf(stderr, "bench: unknown option %s\n", opt);
+            return -1;
+        }
+        if (n < 0) {
+            fprintf(stderr, "bench: bad value for %s: %s\n", opt, val);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// median, 95th percentile (nearest rank), mean and sample standard deviation of t[0..n)
+static void summarize(double *t, int n, BenchResult *r) {
+    qsort(t, (size_t)n, sizeof(double), cmp_double);
+    r->median = n % 2 ? t[n / 2] : 0.5 * (t[n / 2 - 1] + t[n / 2]);
+    r->p95 = t[(int)ceil(0.95 * n) - 1];
+    r->min = t[0];
+    double sum = 0.0, sq = 0.0;
+    for (int i = 0; i < n; i++) sum += t[i];
+    r->mean = sum / n;
+    for (int i = 0; i < n; i++) sq += (t[i] - r->mean) * (t[i] - r->mean);
+    r->stddev = n > 1 ? sqrt(sq / (n - 1)) : 0.0;
+}
+
+// One run of the op in milliseconds
+static double run_once(BenchResult *r, Pool *p, const Matrix *A, const Matrix *B) {
+    uint64_t t0 = now_nanos();
+    if (r->op == BOP_DET) {
+        volatile double d = backend_det(r->backend, p, A);
+        (void)d;
+    } else if (r->op == BOP_EIGEN) {
+        double lambda, *vec = NULL;
+        r->iters = backend_eigen(r->backend, p, A, BENCH_EIG_TOL, BENCH_EIG_MAX, NULL, &lambda, &vec);
+        mat_free(vec);
+    } else {
+        matrix_free(backend_binary(r->backend, r->op, p, A, B));
+    }
+    double ms = (double)(now_nanos() - t0) * 1e-6;
+    for (int i = 0; p && i < PH_COUNT; i++) r->phase[i] += (double)g_phase.ns[i] * 1e-6;
+    return ms;
+}
+
+static void write_header(FILE *f, const BenchArgs *a) {
+    if (!a->json) {
+        fprintf(f, "op,backend,workers,shape,m,k,n,reps,iters,median_ms,p95_ms,mean_ms,stddev_ms,min_ms,gflops,gbs,"
+                   "setup_ms,marshal_ms,dispatch_ms,compute_ms,collect_ms,assemble_ms\n");
+        return;
+    }
+    fprintf(f, "{\n  \"machine\": {\"cores\": %d, \"gflops\": %.3f, \"mem_gbs\": %.3f, "
+               "\"job_us\": %.2f, \"pipe_gbs\": %.3f, \"omp_threads\": %d, \"pool_chunk\": %d},\n"
+               "  \"warmup\": %d,\n  \"reps\": %d,\n  \"results\": [",
+            g_cost.cores, g_cost.flops * 1e-9, g_cost.bw * 1e-9, g_cost.ipc_job * 1e6,
+            g_cost.ipc_bw * 1e-9, g_cost_threads, g_cost_chunk, a->warmup, a->reps);
+}
+
+static void write_result(FILE *f, const BenchArgs *a, const BenchResult *r, int first) {
+    if (!a->json) {
+        fprintf(f, "%s,%s,%d,%s,%d,%d,%d,%d,%d,%.6f,%.6f,%.6f,%.6f,%.6f,%.4f,%.4f",
+                backend_op_name(r->op), backend_name(r->backend), r->workers, g_shapes[r->shape].name,
+                r->m, r->k, r->n, a->reps, r->iters, r->median, r->p95, r->mean, r->stddev, r->min,
+                r->gflops, r->gbs);
+        for (int i = 0; i < PH_COUNT; i++) fprintf(f, ",%.6f", r->phase[i]);
+        fprintf(f, "\n");
+        return;
+    }
+    fprintf(f, "%s\n    {\"op\": \"%s\", \"backend\": \"%s\", \"workers\": %d, \"shape\": \"%s\", "
+               "\"m\": %d, \"k\": %d, \"n\": %d, \"iters\": %d, \"median_ms\": %.6f, \"p95_ms\": %.6f, "
+               "\"mean_ms\": %.6f, \"stddev_ms\": %.6f, \"min_ms\": %.6f, \"gflops\": %.4f, \"gbs\": %.4f",
+            first ? "" : ",", backend_op_name(r->op), backend_name(r->backend), r->workers,
+            g_shapes[r->shape].name, r->m, r->k, r->n, r->iters, r->median, r->p95, r->mean,
+            r->stddev, r->min, r->gflops, r->gbs);
+    for (int i = 0; i < PH_COUNT; i++) fprintf(f, ", \"%s_ms\": %.6f", phase_name(i), r->phase[i]);
+    fprintf(f, "}");
+}
+
+// Times one op on every backend (and pool size) for one set of operands
+static int bench_operands(const BenchArgs *a, FILE *f, Pool **pools, BenchResult *r,
+                          const Matrix *A, const Matrix *B, double *t, int count) {
+    for (int bi = 0; bi < a->nbackends; bi++) {
+        r->backend = a->backends[bi];
+        int runs = r->backend == BK_POOL ? a->nworkers : 1;
+        for (int w = 0; w < runs; w++) {
+            Pool *p = r->backend == BK_POOL ? pools[w] : NULL;
+            r->workers = p ? p->n : 0;
+            for (int i = 0; i < a->warmup; i++) run_once(r, p, A, B);
+            memset(r->phase, 0, sizeof(r->phase));
+            for (int i = 0; i < a->reps; i++) t[i] = run_once(r, p, A, B);
+            for (int i = 0; i < PH_COUNT; i++) r->phase[i] /= a->reps;
+            summarize(t, a->reps, r);
+            backend_rates(r->op, A, B, r->iters, (uint64_t)(r->median * 1e6), &r->gflops, &r->gbs);
+            write_result(f, a, r, count == 0);
+            fflush(f);
+            fprintf(stderr, "bench: %-5s %-6s %4dx%-4d %-6s", backend_op_name(r->op), g_shapes[r->shape].name,
+                    r->m, r->k, backend_name(r->backend));
+            if (p) fprintf(stderr, " (%d workers)", p->n);
+            fprintf(stderr, "  median %.3fms  p95 %.3fms  stddev %.3fms\n", r->median, r->p95, r->stddev);
+            count++;
+        }
+    }
+    return count;
+}
+
+int main(int argc, char **argv) {
+    BenchArgs a;
+    if (parse_args(argc, argv, &a) != 0) {
+        usage(argv[0]);
+        return 2;
+    }
+    AppConfig cfg;
+    load_config(a.config, &cfg);
+    if (a.nworkers == 0) {
+        a.workers[0] = cfg.workers > 0 ? cfg.workers : 1;
+        a.nworkers = 1;
+    }
+#ifndef __OPTIMIZE__
+    fprintf(stderr, "bench: built without optimization, rebuild with `make clean && make bench DBG=0`\n");
+#endif
+
+    // same setup as the menu; the pools are forked before anything starts OpenMP threads (see cost.h)
+    mat_alloc_config(cfg.hugepages, (size_t)cfg.alloc_cache_mb * 1024 * 1024);
+    if (cfg.gemm_block > 0) g_gemm_block = cfg.gemm_block;
+    g_cost_threads = cfg.omp_threads;
+    g_cost_chunk = cfg.pool_chunk;
+    cost_calibrate(&cfg.model);
+    int use_pool = 0;
+    for (int i = 0; i < a.nbackends; i++) use_pool |= a.backends[i] == BK_POOL;
+    Pool *pools[BENCH_MAX_LIST] = { NULL };
+    for (int i = 0; use_pool && i < a.nworkers; i++) pools[i] = pool_create(a.workers[i]);
+    if (use_pool) cost_calibrate_pool(pools[0]);
+
+    FILE *f = a.out ? fopen(a.out, "w") : stdout;
+    if (f == NULL) {
+        perror(a.out);
+        return 1;
+    }
+    write_header(f, &a);
+    double *t = (double *)xmalloc(sizeof(double) * (size_t)a.reps);
+    int count = 0;
+    for (int oi = 0; oi < a.nops; oi++) {
+        int op = a.ops[oi];
+        for (int si = 0; si < a.nshapes; si++) {
+            const Shape *sh = &g_shapes[a.shapes[si]];
+            if ((op == BOP_DET || op == BOP_EIGEN) && sh->rows != sh->cols) continue;   // square only
+            for (int zi = 0; zi < a.nsizes; zi++) {
+                BenchResult r;
+                memset(&r, 0, sizeof(r));
+                r.op = op;
+                r.shape = a.shapes[si];
+                r.m = (int)(a.sizes[zi] * sh->rows);
+                r.k = (int)(a.sizes[zi] * sh->cols);
+                r.n = op == BOP_MUL ? a.sizes[zi] : (op == BOP_ADD || op == BOP_SUB ? r.k : 1);
+                if (r.m < 1 || r.k < 1) continue;
+                Matrix *A = bench_matrix(r.m, r.k, 1);
+                Matrix *B = op == BOP_MUL ? bench_matrix(r.k, r.n, 2)
+                          : op == BOP_ADD || op == BOP_SUB ? bench_matrix(r.m, r.k, 2) : NULL;
+                count = bench_operands(&a, f, pools, &r, A, B, t, count);
+                matrix_free(A);
+                if (B) matrix_free(B);
+            }
+        }
+    }
+    if (a.json) fprintf(f, "\n  ]\n}\n");
+    free(t);
+    if (f != stdout) fclose(f);
+    for (int i = 0; i < a.nworkers; i++)
+        if (pools[i]) pool_destroy(pools[i]);
+    fprintf(stderr, "bench: %d results%s%s\n", count, a.out ? " written to " : "", a.out ? a.out : "");
+    return 0;
+}
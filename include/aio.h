@@ -0,0 +1,34 @@
+#ifndef AIO_H
+#define AIO_H
+
+#include "common.h"
+
+// Asynchronous file I/O with many requests in flight: io_uring (raw syscalls)
+// when the kernel allows it, otherwise a few threads doing pread/pwrite (or
+// the submitting thread itself if none can be started).
+// Requests carry a caller tag that comes back with their completion.
+// Short transfers are finished synchronously, so a completion is either
+// the full length or an error.
+
+#define AIO_DEPTH 64              // default number of requests in flight
+
+typedef struct AioCtx AioCtx;
+
+AioCtx *aio_create(int depth, int allow_uring);  // NULL only if out of memory
+void    aio_destroy(AioCtx *io);
+const char *aio_backend(const AioCtx *io);       // "io_uring" or "threads"
+int     aio_inflight(const AioCtx *io);
+int     aio_depth(const AioCtx *io);
+
+// Queue a read/write of len bytes at offset off. Returns 0, or -1 when
+// aio_depth requests are already in flight (aio_wait for one first).
+int aio_read(AioCtx *io, int fd, void *buf, size_t len, off_t off, uint64_t tag);
+int aio_write(AioCtx *io, int fd, const void *buf, size_t len, off_t off, uint64_t tag);
+
+// Waits for one completion. *res is the byte count or -errno.
+// Returns 0, or -1 if nothing is in flight.
+int aio_wait(AioCtx *io, uint64_t *tag, ssize_t *res);
+
+extern int g_aio_uring;           // 0 forces the thread fallback (config aio_uring)
+
+#endif
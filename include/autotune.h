@@ -0,0 +1,14 @@
+#ifndef AUTOTUNE_H
+#define AUTOTUNE_H
+
+#include "menu.h"
+
+// --autotune: measures the machine model from scratch and sweeps the knobs
+// the model can't derive (worker count, usable cores, GEMM tile, pool job
+// size), then writes the winners into the config file at `path`: existing
+// key=value lines are updated in place, missing keys are appended. Later runs
+// with that config skip the startup probes. Returns 0, or -1 if the file
+// could not be written.
+int run_autotune(const AppConfig *cfg, const char *path);
+
+#endif
@@ -0,0 +1,82 @@
+#ifndef BACKEND_H
+#define BACKEND_H
+
+#include "matrix.h"
+#include "pool.h"
+
+// Which implementation runs an op. The session has one backend per op
+// (config key backend, overridden per op by backend_add, backend_mul, ...):
+//   single   one process, OpenMP off
+//   omp      one process, OpenMP on (single when OpenMP isn't compiled in)
+//   pool     the worker processes (pipes), OpenMP as set in the menu (sent with each job)
+//   auto     one of the above, whichever the machine model (cost.h) prices lowest
+//   compare  every available backend, timed, results diffed against the first
+
+typedef enum {
+    BK_SINGLE = 0,
+    BK_OMP,
+    BK_POOL,
+    BK_AUTO,
+    BK_COMPARE
+} Backend;
+
+#define BK_CONCRETE 3            // single, omp, pool
+
+typedef enum {
+    BOP_ADD = 0,
+    BOP_SUB,
+    BOP_MUL,
+    BOP_DET,
+    BOP_EIGEN,
+    BOP_COUNT
+} BackendOp;
+
+int  backend_parse(const char *s);              // -1 if unknown
+const char *backend_name(int b);
+const char *backend_title(int b);               // "SINGLE-PROCESS", "OPENMP", "MULTI-PROCESS"
+const char *backend_op_name(int op);            // "add", "sub", ... (config key suffix)
+void backend_set(int op, int b);                // op < 0 sets every op
+int  backend_get(int op);
+
+// Resolves auto (and omp without OpenMP) to the backend that actually runs;
+// with auto_log set the estimates behind an auto pick are printed.
+int  backend_resolve(int b, int op, Pool *p, const Matrix *A, const Matrix *B);
+
+// Run an op on a concrete backend. Results come unnamed (name "").
+Matrix *backend_binary(int b, int op, Pool *p, const Matrix *A, const Matrix *B);
+double  backend_det(int b, Pool *p, const Matrix *A);
+// backend_det that also seeds A's determinant state (det_update.h) with the
+// result, so later edits update it; the inverse is built by the first edit.
+double  backend_det_factor(int b, Pool *p, Matrix *A);
+int     backend_eigen(int b, Pool *p, const Matrix *A, double tol, int maxit, const double *x0,
+                      double *lambda_out, double **vec_out);
+
+// Throughput of an op that took `ns`: GFLOP/s of its arithmetic and GB/s of the
+// memory it streams (priced like the cost model does; eigen: `iters` power steps)
+void backend_rates(int op, const Matrix *A, const Matrix *B, int iters, uint64_t ns,
+                   double *gflops, double *gbs);
+// Prints the rates and, when b is the pool, where its time went (g_phase in
+// timer.h). script = 1 appends them as " key=value" pairs to the current line.
+void backend_report(int b, int op, const Matrix *A, const Matrix *B, int iters, uint64_t ns, int script);
+
+// One backend of a compare run: time and max |difference| to the first backend's result
+typedef struct {
+    int backend;
+    int ok;
+    double ms;                   // wall time, nanosecond clock
+    double diff;
+    double value;                // det or lambda
+    int iters;                   // eigen
+    int has_vec;                 // eigen: vec_diff is set
+    double vec_diff;             // eigen: max |difference| of the eigenvector, up to its sign
+} BackendRun;
+
+// Compare mode: run every available backend. The first result is returned
+// (the others are dropped), runs[0..*n) tell how each one did.
+Matrix *backend_compare_binary(int op, Pool *p, const Matrix *A, const Matrix *B,
+                               BackendRun runs[BK_CONCRETE], int *n);
+double  backend_compare_det(Pool *p, const Matrix *A, BackendRun runs[BK_CONCRETE], int *n);
+int     backend_compare_eigen(Pool *p, const Matrix *A, double tol, int maxit, const double *x0,
+                              double *lambda_out, double **vec_out, BackendRun runs[BK_CONCRETE], int *n);
+
+#endif
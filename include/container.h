@@ -0,0 +1,58 @@
+#ifndef CONTAINER_H
+#define CONTAINER_H
+
+#include "matrix.h"
+
+// Multi-matrix container file (.mpak): many matrices in one file with an index,
+// so a data set of thousands of small matrices is one open and one sequential write.
+//
+//   [PakHeader 64B][payload 0][payload 1]...[index: PakEntry * count]
+//
+// Payloads are float64 row-major, 64-byte aligned. The index sits after the last
+// payload; appending writes the new payload and a new index after the old one and
+// then updates the header, so the file is consistent at every step. Replaced
+// entries are marked dead and their space is reclaimed by pak_compact.
+
+#define PAK_MAGIC   "MATRXPAK"
+#define PAK_VERSION 1
+#define PAK_EXT     ".mpak"
+#define PAK_LIVE    1
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t count;          // index entries (live and dead)
+    uint64_t index_off;      // file offset of the index
+    uint64_t data_end;       // end of the payload area (= index_off)
+    uint64_t aux;            // free for the writer (registry snapshot stores the next ID)
+    uint8_t reserved[24];
+} PakHeader;
+
+typedef struct {
+    char name[MAX_NAME];
+    uint32_t rows, cols;
+    uint64_t offset;         // payload offset in the file
+    uint64_t checksum;       // matrix_checksum of the payload
+    uint32_t flags;          // PAK_LIVE
+    uint32_t reserved;
+} PakEntry;
+
+typedef struct {
+    int fd;
+    PakHeader hdr;
+    PakEntry *idx;
+} Pak;
+
+int  is_container_path(const char *path);
+Pak *pak_open(const char *path);
+void pak_close(Pak *p);
+int  pak_find(const Pak *p, const char *name);          // index of the live entry or -1
+int  pak_find_data(const Pak *p, int hint, int rows, int cols, uint64_t checksum);
+int  pak_load(Pak *p, int i, const char *name_override, Matrix **out);  // lazy, one entry
+int  pak_load_all(const char *path, MatrixRegistry *reg, uint64_t *aux); // returns number loaded or -1
+int  pak_index_lazy(const char *path, MatrixRegistry *reg);             // lazy matrices, data read on use
+int  pak_write_registry(const char *path, MatrixRegistry *reg, uint64_t aux);
+int  pak_append(const char *path, const Matrix *m);
+int  pak_compact(const char *path);
+
+#endif
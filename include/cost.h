@@ -0,0 +1,75 @@
+#ifndef COST_H
+#define COST_H
+
+#include "pool.h"
+
+// Machine model that prices an op on each backend. cost_calibrate() measures
+// whatever the config left at 0 (model_* keys) with a few short probes at
+// startup; the fields below are in SI units. Every parallel loop asks
+// cost_threads() how many OpenMP threads it is worth, the pool ops ask
+// cost_chunk() how many elements go into one job, and the fork-per-step paths
+// ask cost_procs() how many children to fork. All data is float64, so sizes
+// are counted as 8-byte values.
+
+typedef struct {
+    int    cores;           // CPUs this process may run on
+    double flops;           // flop/s of one core in a dot-product loop
+    double bw;              // bytes/s one core streams through memory
+    double bw_all;          // bytes/s all cores stream together
+    double omp_fork;        // seconds to open and join an OpenMP region on every core
+    double ipc_job;         // seconds of one round trip to a pool worker (send, compute nothing, reply)
+    double ipc_bw;          // bytes/s through the worker pipes
+    double proc_fork;       // seconds to fork, exit and reap a child
+} CostModel;
+
+extern CostModel g_cost;
+extern int g_cost_threads;  // config omp_threads: fixed OpenMP team size, 0 = from the model
+extern int g_cost_max_threads; // config omp_max_threads: largest team the model picks, 0 = cores
+extern int g_cost_chunk;    // config pool_chunk: elements per pool job, 0 = from the model
+extern int g_cost_log;      // config auto_log: print each auto decision and the measured model
+
+// Fills in the fields of `preset` that are 0 by measuring them and installs
+// the result as g_cost. cost_calibrate runs before the pool is forked, so the
+// workers get cores/flops/bw, and starts no OpenMP threads (a child forked
+// from a process with live OpenMP threads hangs in its first team).
+// cost_calibrate_pool then measures the OpenMP and pipe costs.
+void cost_calibrate(const CostModel *preset);
+void cost_calibrate_pool(Pool *p);
+void cost_print(void);
+
+// Work of one op in the terms the model prices
+typedef struct {
+    double flops;           // arithmetic
+    double bytes;           // memory traffic of the in-process loops
+    int    regions;         // OpenMP regions opened (one per loop per step/iteration)
+    double items;           // pool: independent results (elements, cells)
+    double item_ipc;        // pool: pipe bytes per result
+    double job_ipc;         // pool: pipe bytes per job on top of its results
+    int    steps;           // fork-per-step pool paths (det, eigen): forks happen this many times
+} OpCost;
+
+// Estimated seconds on each backend. threads/chunk/procs (may be NULL) get
+// the team size, job size or child count the estimate assumes.
+double cost_single(const OpCost *c);
+double cost_omp(const OpCost *c, int *threads);
+double cost_pool(const OpCost *c, int workers, int *chunk);
+
+// OpenMP team size for one loop: 1 (run it serially) when OpenMP is off or a
+// team costs more than it saves.
+int cost_threads(double flops, double bytes);
+
+// Elements per job when `items` results go through `workers` pool workers,
+// each costing item_flops and item_ipc pipe bytes.
+int cost_chunk(double items, double item_flops, double item_ipc, int workers);
+
+// The job round trip (ipc_job) for which cost_chunk picks `chunk` for items
+// of this size: how --autotune turns a measured best job size into the model.
+double cost_fit_job(double chunk, double item_flops, double item_ipc);
+
+// Children worth forking for one step of flops that moves ipc bytes through
+// pipes; 1 means do the step in this process. Between `min` and `max`: the
+// pool ops pass min = 2, choosing the pool backend means forking, the model
+// only sizes it (auto compares the pool's price with the in-process ones).
+int cost_procs(double flops, double ipc, int min, int max);
+
+#endif
@@ -0,0 +1,40 @@
+#ifndef DET_UPDATE_H
+#define DET_UPDATE_H
+
+#include "matrix.h"
+
+// Determinant kept per matrix together with the inverse, so edits made by
+// modify_matrix (one value, one row, one column = rank-1 changes) update both in
+// O(n^2) with the matrix determinant lemma and Sherman-Morrison instead of a new
+// O(n^3) elimination. A full refactorization happens when the update would be
+// unstable (1 + v^T A^-1 u close to 0), after too many updates, or when the
+// matrix changed in a way the state didn't see. A singular matrix keeps its
+// state too: edits that can't restore full rank leave the determinant at 0.
+// A determinant computed by an op only seeds the state; the inverse (a
+// Gauss-Jordan pass, several times the LU work) is built by the first edit.
+
+typedef struct DetState {
+    int n;
+    double *inv;       // A^-1 row-major, NULL if A was singular at factorization
+    double det;
+    uint64_t version;  // matrix version the state matches
+    int updates;       // rank-1 updates since the last factorization
+    int nullity;       // lower bound of n - rank while inv is NULL (singular), 0 otherwise
+    int pending;       // seeded: det is known, the first edit factors the matrix
+} DetState;
+
+// Builds the state from scratch (Gauss-Jordan with partial pivoting).
+// Returns 1 with the determinant in m->det_state->det, 0 if m gets no state
+// (not square or too big).
+int  det_state_factor(Matrix *m);
+// Records a determinant computed elsewhere for the current version, no inverse yet.
+void det_state_seed(Matrix *m, double det);
+// Returns 1 and the determinant if the state matches the current matrix version.
+int  det_state_lookup(const Matrix *m, double *det, int *updates);
+// Edit hooks: the matrix already holds the new values and its new version,
+// from_version is the version before the edit, old_* the overwritten values.
+void det_state_row_changed(Matrix *m, uint64_t from_version, int i, const double *old_row);
+void det_state_col_changed(Matrix *m, uint64_t from_version, int j, const double *old_col);
+void det_state_free(DetState *s);
+
+#endif
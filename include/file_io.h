@@ -4,7 +4,34 @@
 // functions in file_io.c , so when we include it in any , yhe file will have acess to call it
 int read_matrix_file(const char *path, const char *name_override, Matrix **out); 
 int write_matrix_file(const char *path, const Matrix *m);
+int write_matrix_data(const char *path, const char *name, int rows, int cols, const double *data);
 int load_directory(const char *dir, MatrixRegistry *reg);
-int save_all_to_dir(const char *dir, MatrixRegistry *reg);
+int load_directory_lazy(const char *dir, MatrixRegistry *reg);
+int save_all_to_dir(const char *dir, MatrixRegistry *reg, int background);
+int save_all_wait(MatrixRegistry *reg);
+int save_snapshot(const char *path, MatrixRegistry *reg, uint64_t next_id);
+int load_snapshot(const char *path, MatrixRegistry *reg, int lazy, uint64_t *next_id);
+
+// Native binary format (.mbin): a 64-byte header followed by the row-major
+// float64 payload (64-byte aligned). read_matrix_file recognizes it by the magic
+// and maps it instead of parsing, write_matrix_file emits it for .mbin paths.
+#define MATBIN_MAGIC   "MATRXBIN"
+#define MATBIN_VERSION 1
+#define MATBIN_F64     1
+#define MATBIN_EXT     ".mbin"
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t dtype;           // MATBIN_F64
+    uint64_t rows, cols;
+    uint64_t ld;              // row stride in elements, >= cols
+    uint64_t checksum;        // matrix_checksum of the rows*ld payload
+    uint8_t reserved[16];
+} MatBinHeader;
+
+uint64_t matrix_checksum(const double *d, size_t n);
+uint64_t matrix_checksum_continue(uint64_t h, const double *d, size_t n);
+extern int g_bin_verify;      // 1: verify checksums of mapped files too (touches every page)
+extern int g_io_threads;      // threads parsing files in load_directory (0 = OpenMP default)
 
 #endif
@@ -0,0 +1,23 @@
+#ifndef MAINTAINED_H
+#define MAINTAINED_H
+
+#include "matrix.h"
+
+// Maintained products C = A*B: the result stays registered under its ID and is
+// patched when modify_matrix edits an operand, instead of a new O(n^3) multiply.
+//   row i of A changed     -> recompute row i of C            O(K*N)
+//   column k of A changed  -> C += dA[:,k] * B[k,:]            O(M*N)
+//   row k of B changed     -> C += A[:,k] * dB[k,:]            O(M*N)
+//   column j of B changed  -> recompute column j of C         O(M*K)
+// Versions of A, B and C are recorded; if any of them changed behind our back
+// (or A and B are the same matrix) the product is recomputed in full.
+// A patched C is passed on like an edit to the products that use it (D = C*E).
+
+void maint_add(const Matrix *C, const Matrix *A, const Matrix *B);
+void maint_row_changed(MatrixRegistry *reg, Matrix *m, uint64_t from_version, int i, const double *old_row);
+void maint_col_changed(MatrixRegistry *reg, Matrix *m, uint64_t from_version, int j, const double *old_col);
+void maint_forget(const char *name);   // matrix deleted: drop every product that uses it
+int  maint_count(void);
+void maint_free(void);
+
+#endif
@@ -0,0 +1,21 @@
+#ifndef MAT_ALLOC_H
+#define MAT_ALLOC_H
+
+#include <stddef.h>
+
+// Size-class buffer cache for matrix data and big temporaries.
+// Freed buffers are kept in per-class free lists and handed out again to the next
+// request of the same class, so repeated ops don't pay mmap + first-touch page faults.
+// Large buffers come from mmap and can be backed by huge pages.
+
+#define MAT_HUGEPAGES_OFF      0   // normal 4K pages
+#define MAT_HUGEPAGES_THP      1   // madvise(MADV_HUGEPAGE) on large buffers
+#define MAT_HUGEPAGES_EXPLICIT 2   // MAP_HUGETLB (falls back to THP if no huge pages are reserved)
+
+void    mat_alloc_config(int hugepages, size_t cache_bytes);
+double *mat_alloc(size_t count);          // count doubles, contents undefined
+double *mat_alloc_zeroed(size_t count);   // count doubles, all 0.0
+void    mat_free(void *p);                // only for pointers from mat_alloc*
+void    mat_alloc_print_stats(void);
+
+#endif
@@ -2,26 +2,88 @@
 #define MATRIX_H
 
 #include "common.h"
+#include <pthread.h>
+struct DetState;   // incremental determinant state, see det_update.h
 // struct of the matrix content
 typedef struct {
     char name[MAX_NAME];
     int rows, cols;
-    double *data; // row-major
+    double *data; // row-major, NULL while the matrix is spilled to disk
+    uint64_t last_use; // registry clock of the last access, used to pick the LRU victim
+    long spill_off;    // offset of the matrix data inside the spill file, -1 if never spilled
+    int spilled;       // 1 when the data lives only in the spill file
+    uint64_t version;  // changes on every modification, unique across all matrices
+    struct DetState *det_state; // determinant + inverse kept up to date across edits, NULL if none
+    double *eig_vec;   // last converged dominant eigenvector (warm start), NULL if none
+    double eig_norm;   // Frobenius norm of the matrix when eig_vec was stored
+    double eig_drift;  // Frobenius norm of the edits made since then
+    void *map_base;    // file mapping that holds data (zero-copy load), NULL if data is a buffer
+    size_t map_len;
+    char *src_path;    // file still holding the data (lazy load), NULL once the data is in RAM
+    int src_entry;     // entry index when src_path is a .mpak container, -1 for a plain file
+    uint64_t src_sum;  // checksum of that entry, finds it again after the container is compacted
+    int dirty;         // changed (new, modified, renamed) since the last save_all_to_dir
+    int pins;          // registry_acquire/registry_pin holds, never spilled while > 0
+    int removed;       // left the registry while pinned, freed by the last registry_release
 } Matrix;
+// reads the data of a lazy matrix (src_path) into a new matrix, 0 on success
+typedef int (*MatrixLoader)(const Matrix *m, Matrix **out);
+// free range of the spill file left by a removed matrix
+typedef struct {
+    long off;
+    size_t bytes;
+} SpillHole;
 // struct of the matrix ino in regestry
 typedef struct {
     Matrix **items;
     int count, cap;
+    size_t mem_budget;   // max bytes of matrix data kept in RAM, 0 = no limit
+    size_t mem_used;     // bytes of matrix data currently in RAM
+    uint64_t clock;      // access counter, incremented on every get/add
+    uint64_t hits, misses, spills; // get found data in RAM / had to read it back / evictions
+    FILE *spill;         // spill file, opened on the first eviction
+    long spill_end;      // first free byte in the spill file
+    char spill_path[256];// spill file path, empty = anonymous tmpfile()
+    int spill_created;   // spill_path didn't exist before, so it is removed at exit
+    SpillHole *holes;    // reusable slots of removed matrices
+    int nholes, capholes;
+    MatrixLoader loader; // reads lazy matrices on first use (set by load_directory_lazy)
+    uint64_t loads;      // lazy matrices read so far
+    pthread_mutex_t lock;// guards the registry while the prefetch thread runs: matrices in it
+                         // change version, name and data only under it (registry_changed, ...)
+    pthread_t prefetch;
+    int prefetching;     // prefetch thread started
+    volatile int stop;   // asks the prefetch thread to finish
+    char save_dir[256];  // folder of the last save_all_to_dir, dirty flags refer to it
 } MatrixRegistry;
 // helper function to make op on matrices
 void registry_init(MatrixRegistry *r);
 void registry_free(MatrixRegistry *r);
+void registry_set_budget(MatrixRegistry *r, size_t bytes, const char *spill_path);
 Matrix *registry_get(MatrixRegistry *r, const char *name);
+Matrix *registry_at(MatrixRegistry *r, int i);
+Matrix *registry_acquire(MatrixRegistry *r, const char *name);   // registry_get + pin
+void    registry_pin(MatrixRegistry *r, Matrix *m);
+void    registry_release(MatrixRegistry *r, Matrix *m);           // unpin, NULL is fine
+Matrix *registry_peek(MatrixRegistry *r, int i);   // no fault-in, no LRU update
+Matrix *registry_find(MatrixRegistry *r, const char *name);   // same, by name
+void    registry_changed(MatrixRegistry *r, Matrix *m);
+void    registry_rename(MatrixRegistry *r, Matrix *m, const char *name);
 int     registry_add(MatrixRegistry *r, Matrix *m);
 int     registry_remove(MatrixRegistry *r, const char *name);
+void    registry_print_stats(const MatrixRegistry *r);
+void    registry_prefetch_start(MatrixRegistry *r);
+void    registry_prefetch_stop(MatrixRegistry *r);
 
 Matrix *matrix_create(const char *name, int rows, int cols);
+Matrix *matrix_create_mapped(const char *name, int rows, int cols, double *data, void *map_base, size_t map_len);
+Matrix *matrix_create_lazy(const char *name, int rows, int cols, const char *src_path, int src_entry);
+void    matrix_release_data(Matrix *m);
 void    matrix_free(Matrix *m);
+void    matrix_bump_version(Matrix *m);
+static inline size_t matrix_bytes(const Matrix *m) {
+    return (size_t)m->rows * m->cols * sizeof(double);
+}
 static inline double matrix_get(const Matrix *m, int i, int j) {
     return m->data[(size_t)i * m->cols + j];
 }
@@ -2,15 +2,44 @@
 #define MENU_H
 #include "matrix.h"
 #include "pool.h"
+#include "backend.h"
+#include "cost.h"
 // menu need to work, dir: to load files from,menu order: from config to customize the order as user want, menu count to to use it between what user use and what acully it code for , workers number from config to send it to pool
+// mem budget and spill file: limit how much matrix data the registry keeps in RAM
 typedef struct {
     char matrix_dir[256];
     int  menu_order[32];
     int  menu_count;
     int  workers;
+    long mem_budget_mb;     // registry memory budget in MB, 0 = keep everything in RAM
+    char spill_file[256];   // where evicted matrices go, empty = anonymous temp file
+    int  hugepages;         // 0 off, 1 transparent huge pages, 2 explicit MAP_HUGETLB
+    long alloc_cache_mb;    // MB of freed matrix buffers kept for reuse
+    int  cache_entries;     // memoized op results (det, eigen, mul), 0 = off
+    long cache_mb;          // MB of cached eigenvectors/products
+    int  bin_verify;        // verify checksums of mapped .mbin files at load
+    int  io_threads;        // threads parsing files of a folder (0 = OpenMP default)
+    int  lazy_load;         // startup reads only shapes, data is parsed on first use
+    int  prefetch;          // with lazy_load: parse the rest on a background thread
+    int  save_async;        // save all copies the changed matrices and writes them on a thread
+    char restore[256];      // snapshot image to start from (--restore), empty = matrix_dir
+    long ooc_mem_mb;        // RAM for panels and tiles of the out-of-core multiply
+    int  npy_f32;           // save .npy as float32 instead of float64
+    int  output_mode;       // OutputMode for op results (output=none|summary|head|full|file)
+    int  output_head;       // rows/cols shown at each end with output=head
+    char output_dir[256];   // folder for output=file
+    int  backend[BOP_COUNT]; // Backend per BackendOp (backend=, backend_<op>=)
+    int  aio_uring;         // folder loads/saves queue their reads and writes on io_uring (0 = threads)
+    CostModel model;        // machine model for auto (cores=, model_*=), 0 fields are measured
+    int  omp_threads;       // fixed OpenMP team size, 0 = sized by the model
+    int  omp_max_threads;   // largest team the model may pick, 0 = cores
+    int  pool_chunk;        // elements per pool job, 0 = sized by the model
+    int  auto_log;          // print the model and the estimates behind every auto pick
+    int  gemm_block;        // tile edge of the blocked multiply, 0 = GEMM_BLOCK
 } AppConfig;
 
 int load_config(const char *path, AppConfig *cfg);
 void run_menu(AppConfig *cfg);
+int run_script(AppConfig *cfg, const char *path);   // --script: commands from a file or "-" (stdin)
 
 #endif
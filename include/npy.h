@@ -0,0 +1,30 @@
+#ifndef NPY_H
+#define NPY_H
+
+#include "matrix.h"
+
+// NumPy .npy files (format versions 1-3): a magic, a small Python-dict header
+// ('descr', 'fortran_order', 'shape') padded with spaces, then the raw array.
+// float64 and float32 are read in either byte order and in C or Fortran order;
+// 1-D arrays become a single row. Native-order C float64 payloads are mapped
+// zero-copy like .mbin files, everything else is converted into a new buffer.
+
+#define NPY_MAGIC     "\x93NUMPY"
+#define NPY_MAGIC_LEN 6
+#define NPY_EXT       ".npy"
+
+int is_npy_path(const char *path);
+int is_npy_data(const void *buf, size_t len);
+
+// Reads the shape from the header of an open file, however long the header is.
+int npy_shape(int fd, const char *path, int *rows, int *cols);
+
+// Reads an open .npy file. Returns 0, or -1 with a message on stderr.
+int npy_read(int fd, const char *path, const char *name, Matrix **out);
+
+// Writes m as a C-order .npy array, float32 when g_npy_f32 is set.
+int npy_write(const char *path, const Matrix *m);
+
+extern int g_npy_f32;         // write float32 .npy files (config npy_f32)
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef OOC_MUL_H
+#define OOC_MUL_H
+
+#include "common.h"
+
+// Out-of-core multiplication of .mbin files: C = A * B with A, B and C on disk.
+// Only a bounded working set is in RAM: two buffers for the current and the next
+// A and B panels (the next pair is read by a helper thread while the current one
+// is multiplied) and one C tile, which is written back when its sum is complete.
+
+typedef struct {
+    int tile_m, tile_n, tile_k;  // tile sizes used
+    size_t buffer_bytes;         // RAM used by panels and the C tile
+    double read_mb, write_mb;    // file traffic
+    uint64_t total_ms;
+    uint64_t wait_ms;            // time the multiply waited for reads (I/O not hidden)
+} OocStats;
+
+// mem_bytes bounds the panel and tile buffers. Returns 0 on success, -1 on error.
+int ooc_mul_files(const char *a_path, const char *b_path, const char *c_path,
+                  size_t mem_bytes, OocStats *st);
+
+#endif
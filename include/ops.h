@@ -12,10 +12,17 @@ Matrix *op_add_single(const Matrix *A, const Matrix *B, const char *outname);
 Matrix *op_sub_single(const Matrix *A, const Matrix *B, const char *outname);
 // Matrix multiplication (single-process or with OpenMP)
 Matrix *op_mul_single(const Matrix *A, const Matrix *B, const char *outname);
+// Cache-blocked kernel on raw row-major buffers: C (m x n) += A (m x k) * B (k x n),
+// lda/ldb/ldc are the row strides. Rows of C are split over OpenMP threads.
+#define GEMM_BLOCK 64
+extern int g_gemm_block;      // tile edge, GEMM_BLOCK unless the config (gemm_block, --autotune) says otherwise
+void    gemm_block_acc(int m, int n, int k, const double *A, size_t lda,
+                       const double *B, size_t ldb, double *C, size_t ldc);
 // Determinant computation (single-process)
 double  op_det_single(const Matrix *A);
 // Power iteration to find dominant eigenvalue and eigenvector, returns number of iterations and outputs lambda and vector
-int op_eigen_power(const Matrix *A, double tol, int maxit, double *lambda_out, double **vec_out);
+// x0 is the start vector (NULL = all ones), the vector comes from mat_alloc, release it with mat_free
+int op_eigen_power(const Matrix *A, double tol, int maxit, const double *x0, double *lambda_out, double **vec_out);
 
 
 
@@ -30,6 +37,14 @@ Matrix *op_mul_processes(Pool *p, const Matrix *A, const Matrix *B, const char *
 // Determinant computation using multiple processes
 double  op_det_processes(Pool *p, const Matrix *A);
 // Power iteration to find dominant eigenvalue and eigenvector, returns number of iterations and outputs lambda and vector
-int op_eigen_processes(Pool *p, const Matrix *A, double tol, int maxit, double *lambda_out, double **vec_out);
+int op_eigen_processes(Pool *p, const Matrix *A, double tol, int maxit, const double *x0, double *lambda_out, double **vec_out);
+
+// Warm start for the power iteration: the converged eigenvector is kept on the matrix
+// and reused as start vector after edits, until the edits add up to more than
+// EIG_WARM_MAX_DRIFT of the matrix norm.
+#define EIG_WARM_MAX_DRIFT 0.1
+void eig_warm_store(Matrix *A, const double *vec);     // copy vec as the start vector of A
+const double *eig_warm_get(const Matrix *A);           // start vector or NULL
+void eig_warm_note_edit(Matrix *A, double delta_norm); // Frobenius norm of an edit
 
 #endif
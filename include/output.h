@@ -0,0 +1,32 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include "matrix.h"
+
+// Where op results (add/sub/mul products, eigenvectors) go. Printing a big
+// product takes longer than computing it, so the session picks one policy:
+//   none     nothing but the result line of the op
+//   summary  shape, Frobenius norm, max |x|, sum and checksum
+//   head     the first and last `head` rows/columns
+//   full     every value (the old behavior)
+//   file     every value, written to <output_dir>/<label>.txt
+// Values are formatted into a buffer and written in large chunks, after the
+// timed part of the op.
+
+typedef enum {
+    OUT_NONE = 0,
+    OUT_SUMMARY,
+    OUT_HEAD,
+    OUT_FULL,
+    OUT_FILE
+} OutputMode;
+
+int  output_parse_mode(const char *s);           // -1 if unknown
+const char *output_mode_name(int mode);
+void output_set(int mode, int head, const char *dir);
+int  output_mode(void);
+
+void output_matrix(const Matrix *m, const char *label);
+void output_vector(const double *v, int n, const char *label);
+
+#endif
@@ -5,9 +5,9 @@
 
 typedef enum
  {                      // the enum is the option of the parent that will send it to the worker
-    CMD_ADD_ELEM=1,     // so the add will get 1 sub 2 mul 3 and so on 
+    CMD_ADD_ELEM=1,     // so the add will get 1 sub 2 mul 3 and so on, add/sub do n elements: payload n of A then n of B
     CMD_SUB_ELEM=2,
-    CMD_MUL_CELL=3,
+    CMD_MUL_CELL=3,     // cells (i, j..j+cols-1): payload row i of A (n values) then cols columns of B
     CMD_DET_ROW_ELIM=4,
     CMD_EIG_ROW_DOT=5,
     CMD_QUIT=99         // is an oeder to get the child out of the worker loop
@@ -16,12 +16,14 @@ typedef enum
 typedef struct 
 {                       // the massege struct that will send to the child , that include the jop header that will send via parent to the child by the pipe
        int cmd, job_id, i, j, n, rows, cols, payload_bytes;
+       int omp;         // the parent's g_omp_enabled when the job was sent (pool_send fills it in), the workers were forked with an old copy
 } JobHeader;            // so that he will send for him the the enum of the the type of the mission, the jop id , i , j for the matrix , payload (is the size of the information after the header) and so on 
                         // so that when the parnet send the jop to the child he wil send for him the jop header and then the payload that will have the real number
 
 typedef struct          // the same but forom the child to the parent and the row and the cols is the result
 {
     int cmd, job_id, i, j, rows, cols, payload_bytes;
+    int64_t compute_ns; // time the worker spent on the arithmetic of this job (phase report, timer.h)
 } ResultHeader;        
 
 
@@ -0,0 +1,42 @@
+#ifndef RESULT_CACHE_H
+#define RESULT_CACHE_H
+
+#include "matrix.h"
+
+// Memoized results of expensive ops. An entry is keyed by the op, the operand IDs,
+// their version counters and the op parameters, so any change to an operand
+// (new version) makes the old entries unreachable. LRU eviction, bounded by
+// number of entries and bytes of cached vectors/matrices.
+
+typedef enum {
+    RC_DET   = 1,   // scalar: determinant
+    RC_EIGEN = 2,   // scalar + vector: dominant eigenvalue/eigenvector
+    RC_MUL   = 3    // matrix: A*B
+} ResultOp;
+
+typedef struct {
+    int op;
+    char a[MAX_NAME], b[MAX_NAME];  // operand IDs (b empty for unary ops)
+    uint64_t va, vb;                // operand versions
+    double param;                   // op parameter (eigen tolerance)
+    int iparam;                     // op parameter (eigen max iterations)
+} RCacheKey;
+
+typedef struct {
+    double scalar;   // det or lambda
+    int iters;       // eigen iterations
+    double *vec;     // eigenvector (owned by the cache)
+    int vec_len;
+    Matrix *mat;     // product (owned by the cache)
+} RCacheValue;
+
+void rcache_init(int max_entries, size_t max_bytes);
+void rcache_free(void);
+void rcache_key(RCacheKey *k, int op, const Matrix *A, const Matrix *B, double param, int iparam);
+const RCacheValue *rcache_lookup(const RCacheKey *k);
+// stores copies of vec/mat, the caller keeps ownership of its own buffers
+void rcache_put(const RCacheKey *k, double scalar, int iters, const double *vec, int vec_len, const Matrix *mat);
+unsigned long long rcache_hits(void);
+void rcache_print_stats(void);   // nothing when the cache is off
+
+#endif
@@ -2,4 +2,39 @@
 #define TIMER_H
 #include <stdint.h>
 uint64_t now_millis(void);
+uint64_t now_nanos(void);   // same clock in nanoseconds, for ops shorter than a millisecond
+
+// Where the time of the last multi-process op went. The pool paths (add, sub,
+// mul) and the forking paths (det, eigen) clear it when they start and add
+// to one phase at a time, so the phases of one op add up to its wall time,
+// except compute: that is measured inside the workers and summed over them,
+// so it overlaps collect (the parent waiting) and can exceed the wall time.
+typedef enum {
+    PH_SETUP = 0,    // result and buffer allocation, pipes and forks
+    PH_MARSHAL,      // copying operands into job payloads
+    PH_DISPATCH,     // writing jobs to the pipes
+    PH_COMPUTE,      // the arithmetic, in the workers (or in the parent when it does a step itself)
+    PH_COLLECT,      // waiting for and reading results
+    PH_ASSEMBLE,     // copying results into place
+    PH_COUNT
+} Phase;
+
+typedef struct {
+    uint64_t ns[PH_COUNT];
+    uint64_t ipc_bytes;      // job and result payloads through the pipes
+    int      jobs;           // jobs sent, or children forked
+} PhaseTimes;
+
+extern PhaseTimes g_phase;
+
+void phase_begin(void);               // clears g_phase
+const char *phase_name(int ph);       // "setup", "marshal", ...
+
+// Adds the time since t0 to phase ph and returns now, so calls chain:
+// t = phase_lap(PH_MARSHAL, t); ... t = phase_lap(PH_DISPATCH, t);
+static inline uint64_t phase_lap(int ph, uint64_t t0) {
+    uint64_t t = now_nanos();
+    g_phase.ns[ph] += t - t0;
+    return t;
+}
 #endif
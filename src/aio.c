@@ -0,0 +1,311 @@
+#define _GNU_SOURCE  // syscall, pread/pwrite
+
+#include "common.h"
+#include "aio.h"
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#define AIO_THREADS 4   // workers of the fallback backend
+
+int g_aio_uring = 1;
+
+// One request; user_data of the io_uring entry is the slot index
+typedef struct {
+    int fd;
+    char *buf;
+    size_t len;
+    off_t off;
+    int write;
+    uint64_t tag;
+    ssize_t res;
+    int next;           // free list / fallback queues
+} AioReq;
+
+struct AioCtx {
+    int uring;          // 1 io_uring, 0 threads
+    int depth, inflight;
+    AioReq *req;
+    int free_head;
+
+    // io_uring rings
+    int ring_fd;
+    void *sq_ptr, *cq_ptr;
+    size_t sq_len, cq_len, sqes_len;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+
+    // thread fallback: FIFO of queued slots and FIFO of finished slots
+    pthread_t th[AIO_THREADS];
+    int nth;
+    pthread_mutex_t lock;
+    pthread_cond_t work, done;
+    int q_head, q_tail, d_head, d_tail;
+    int stop;
+};
+
+// Finishes a transfer with plain pread/pwrite from byte `done` on.
+// Returns the total byte count or -errno.
+static ssize_t finish_sync(AioReq *r, size_t done) {
+    while (done < r->len) {
+        ssize_t n = r->write ? pwrite(r->fd, r->buf + done, r->len - done, r->off + (off_t)done)
+                             : pread(r->fd, r->buf + done, r->len - done, r->off + (off_t)done);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -errno;
+        }
+        if (n == 0) break;   // end of file on a read
+        done += (size_t)n;
+    }
+    return (ssize_t)done;
+}
+
+static int uring_setup(AioCtx *io) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    io->ring_fd = (int)syscall(__NR_io_uring_setup, (unsigned)io->depth, &p);
+    if (io->ring_fd < 0) {
+        return -1;   // no io_uring (old kernel, seccomp, sysctl): use threads
+    }
+    io->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    io->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (io->cq_len > io->sq_len) io->sq_len = io->cq_len;
+        io->cq_len = io->sq_len;
+    }
+    io->sq_ptr = mmap(NULL, io->sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      io->ring_fd, IORING_OFF_SQ_RING);
+    if (io->sq_ptr == MAP_FAILED) {
+        close(io->ring_fd);
+        return -1;
+    }
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        io->cq_ptr = io->sq_ptr;
+    } else {
+        io->cq_ptr = mmap(NULL, io->cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                          io->ring_fd, IORING_OFF_CQ_RING);
+        if (io->cq_ptr == MAP_FAILED) {
+            munmap(io->sq_ptr, io->sq_len);
+            close(io->ring_fd);
+            return -1;
+        }
+    }
+    io->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    io->sqes = (struct io_uring_sqe*)mmap(NULL, io->sqes_len, PROT_READ | PROT_WRITE,
+                                          MAP_SHARED | MAP_POPULATE, io->ring_fd, IORING_OFF_SQES);
+    if (io->sqes == MAP_FAILED) {
+        if (io->cq_ptr != io->sq_ptr) munmap(io->cq_ptr, io->cq_len);
+        munmap(io->sq_ptr, io->sq_len);
+        close(io->ring_fd);
+        return -1;
+    }
+    char *sq = (char*)io->sq_ptr, *cq = (char*)io->cq_ptr;
+    io->sq_head = (unsigned*)(sq + p.sq_off.head);
+    io->sq_tail = (unsigned*)(sq + p.sq_off.tail);
+    io->sq_mask = (unsigned*)(sq + p.sq_off.ring_mask);
+    io->sq_array = (unsigned*)(sq + p.sq_off.array);
+    io->cq_head = (unsigned*)(cq + p.cq_off.head);
+    io->cq_tail = (unsigned*)(cq + p.cq_off.tail);
+    io->cq_mask = (unsigned*)(cq + p.cq_off.ring_mask);
+    io->cqes = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+    return 0;
+}
+
+static void *worker_main(void *arg) {
+    AioCtx *io = (AioCtx*)arg;
+    pthread_mutex_lock(&io->lock);
+    for (;;) {
+        while (io->q_head < 0 && !io->stop) pthread_cond_wait(&io->work, &io->lock);
+        if (io->q_head < 0) break;
+        int s = io->q_head;
+        io->q_head = io->req[s].next;
+        if (io->q_head < 0) io->q_tail = -1;
+        pthread_mutex_unlock(&io->lock);
+
+        io->req[s].res = finish_sync(&io->req[s], 0);
+
+        pthread_mutex_lock(&io->lock);
+        io->req[s].next = -1;
+        if (io->d_tail >= 0) io->req[io->d_tail].next = s;
+        else io->d_head = s;
+        io->d_tail = s;
+        pthread_cond_signal(&io->done);
+    }
+    pthread_mutex_unlock(&io->lock);
+    return NULL;
+}
+
+AioCtx *aio_create(int depth, int allow_uring) {
+    AioCtx *io = (AioCtx*)calloc(1, sizeof(AioCtx));
+    if (io == NULL) return NULL;
+    if (depth < 1) depth = AIO_DEPTH;
+    io->depth = depth;
+    io->req = (AioReq*)xmalloc((size_t)depth * sizeof(AioReq));
+    for (int i = 0; i < depth; i++) io->req[i].next = i + 1 < depth ? i + 1 : -1;
+    io->free_head = 0;
+
+    if (allow_uring && uring_setup(io) == 0) {
+        io->uring = 1;
+        return io;
+    }
+    pthread_mutex_init(&io->lock, NULL);
+    pthread_cond_init(&io->work, NULL);
+    pthread_cond_init(&io->done, NULL);
+    io->q_head = io->q_tail = io->d_head = io->d_tail = -1;
+    io->nth = depth < AIO_THREADS ? depth : AIO_THREADS;
+    for (int t = 0; t < io->nth; t++) {
+        if (pthread_create(&io->th[t], NULL, worker_main, io) != 0) {
+            io->nth = t;
+            break;
+        }
+    }
+    return io;
+}
+
+// Takes one finished slot off the ring or the fallback queue (blocking).
+static int reap_one(AioCtx *io) {
+    int s;
+    if (io->uring) {
+        for (;;) {
+            unsigned head = *io->cq_head;
+            if (head != __atomic_load_n(io->cq_tail, __ATOMIC_ACQUIRE)) {
+                struct io_uring_cqe *cqe = &io->cqes[head & *io->cq_mask];
+                s = (int)cqe->user_data;
+                io->req[s].res = cqe->res;
+                __atomic_store_n(io->cq_head, head + 1, __ATOMIC_RELEASE);
+                break;
+            }
+            if (syscall(__NR_io_uring_enter, io->ring_fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0 &&
+                errno != EINTR) {
+                die("io_uring_enter");
+            }
+        }
+        AioReq *r = &io->req[s];
+        if (r->res >= 0 && (size_t)r->res < r->len) {
+            r->res = finish_sync(r, (size_t)r->res);   // short transfer
+        } else if (r->res == -EINVAL || r->res == -EOPNOTSUPP || r->res == -EAGAIN || r->res == -EINTR) {
+            r->res = finish_sync(r, 0);                // op not supported on this file/kernel
+        }
+    } else {
+        pthread_mutex_lock(&io->lock);
+        while (io->d_head < 0) pthread_cond_wait(&io->done, &io->lock);
+        s = io->d_head;
+        io->d_head = io->req[s].next;
+        if (io->d_head < 0) io->d_tail = -1;
+        pthread_mutex_unlock(&io->lock);
+    }
+    return s;
+}
+
+static int submit(AioCtx *io, int fd, void *buf, size_t len, off_t off, int write, uint64_t tag) {
+    if (io->free_head < 0) {
+        return -1;   // queue full, the caller has to aio_wait first
+    }
+    int s = io->free_head;
+    AioReq *r = &io->req[s];
+    io->free_head = r->next;
+    r->fd = fd;
+    r->buf = (char*)buf;
+    r->len = len;
+    r->off = off;
+    r->write = write;
+    r->tag = tag;
+    r->res = 0;
+    r->next = -1;
+    io->inflight++;
+
+    if (io->uring) {
+        unsigned tail = *io->sq_tail;
+        unsigned idx = tail & *io->sq_mask;
+        struct io_uring_sqe *sqe = &io->sqes[idx];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = write ? IORING_OP_WRITE : IORING_OP_READ;
+        sqe->fd = fd;
+        sqe->addr = (uint64_t)(uintptr_t)buf;
+        sqe->len = len > (1u << 30) ? (1u << 30) : (unsigned)len;   // rest is finished as a short transfer
+        sqe->off = (uint64_t)off;
+        sqe->user_data = (uint64_t)s;
+        io->sq_array[idx] = idx;
+        __atomic_store_n(io->sq_tail, tail + 1, __ATOMIC_RELEASE);
+        while (syscall(__NR_io_uring_enter, io->ring_fd, 1, 0, 0, NULL, 0) < 0) {
+            if (errno != EINTR && errno != EAGAIN && errno != EBUSY) die("io_uring_enter");
+        }
+    } else if (io->nth == 0) {   // no worker thread could be started: do it now
+        r->res = finish_sync(r, 0);
+        pthread_mutex_lock(&io->lock);
+        if (io->d_tail >= 0) io->req[io->d_tail].next = s;
+        else io->d_head = s;
+        io->d_tail = s;
+        pthread_mutex_unlock(&io->lock);
+    } else {
+        pthread_mutex_lock(&io->lock);
+        if (io->q_tail >= 0) io->req[io->q_tail].next = s;
+        else io->q_head = s;
+        io->q_tail = s;
+        pthread_cond_signal(&io->work);
+        pthread_mutex_unlock(&io->lock);
+    }
+    return 0;
+}
+
+int aio_read(AioCtx *io, int fd, void *buf, size_t len, off_t off, uint64_t tag) {
+    return submit(io, fd, buf, len, off, 0, tag);
+}
+
+int aio_write(AioCtx *io, int fd, const void *buf, size_t len, off_t off, uint64_t tag) {
+    return submit(io, fd, (void*)buf, len, off, 1, tag);
+}
+
+int aio_wait(AioCtx *io, uint64_t *tag, ssize_t *res) {
+    if (io->inflight == 0) {
+        return -1;
+    }
+    int s = reap_one(io);
+    io->inflight--;
+    *tag = io->req[s].tag;
+    *res = io->req[s].res;
+    io->req[s].next = io->free_head;
+    io->free_head = s;
+    return 0;
+}
+
+int aio_inflight(const AioCtx *io) {
+    return io->inflight;
+}
+
+int aio_depth(const AioCtx *io) {
+    return io->depth;
+}
+
+const char *aio_backend(const AioCtx *io) {
+    return io->uring ? "io_uring" : "threads";
+}
+
+// Waits for everything in flight and releases the context.
+void aio_destroy(AioCtx *io) {
+    if (io == NULL) return;
+    uint64_t tag;
+    ssize_t res;
+    while (aio_wait(io, &tag, &res) == 0) {
+    }
+    if (io->uring) {
+        munmap(io->sqes, io->sqes_len);
+        if (io->cq_ptr != io->sq_ptr) munmap(io->cq_ptr, io->cq_len);
+        munmap(io->sq_ptr, io->sq_len);
+        close(io->ring_fd);
+    } else {
+        pthread_mutex_lock(&io->lock);
+        io->stop = 1;
+        pthread_cond_broadcast(&io->work);
+        pthread_mutex_unlock(&io->lock);
+        for (int t = 0; t < io->nth; t++) pthread_join(io->th[t], NULL);
+        pthread_mutex_destroy(&io->lock);
+        pthread_cond_destroy(&io->work);
+        pthread_cond_destroy(&io->done);
+    }
+    free(io->req);
+    free(io);
+}
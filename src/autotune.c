@@ -0,0 +1,272 @@
+#include "common.h"
+#include "autotune.h"
+#include "cost.h"
+#include "timer.h"
+#include "ops.h"
+
+#define TUNE_TRIES       3      // each setting keeps its best of this many runs
+#define TUNE_GEMM_N      256    // square operands of the tile and team size sweeps
+#define TUNE_MUL_N       128    // square operands of the pool multiply sweeps
+#define TUNE_ADD_N       256    // square operands of the pool add sweep
+#define TUNE_MAX_WORKERS 64
+#define TUNE_KEYS        16
+
+static const int g_blocks[] = { 16, 32, 48, 64, 96, 128, 192, 256 };
+static const int g_add_chunks[] = { 16, 64, 256, 1024, 4096, 16384 };
+static const int g_mul_chunks[] = { 1, 2, 4, 8, 16, 32, 64, 128 };
+
+#define COUNT(a) ((int)(sizeof(a) / sizeof((a)[0])))
+
+typedef Matrix *(*PoolOp)(Pool *p, const Matrix *A, const Matrix *B, const char *name);
+
+typedef struct {
+    const char *key;
+    char val[32];
+} TunedKey;
+
+static double now_sec(void) {
+    return (double)now_nanos() * 1e-9;
+}
+
+// Deterministic values in [-1, 1), so every sweep point does the same work
+static Matrix *tune_matrix(int n, unsigned seed) {
+    Matrix *m = matrix_create("", n, n);
+    for (size_t i = 0; i < (size_t)n * n; i++)
+        m->data[i] = (double)((i * 2654435761u + seed) % 2000u) / 1000.0 - 1.0;
+    return m;
+}
+
+static double time_pool_op(PoolOp op, Pool *p, const Matrix *A, const Matrix *B) {
+    double best = INFINITY;
+    for (int t = 0; t < TUNE_TRIES; t++) {
+        double t0 = now_sec();
+        Matrix *C = op(p, A, B, "");
+        double dt = now_sec() - t0;
+        matrix_free(C);
+        if (dt < best) best = dt;
+    }
+    return best;
+}
+
+static double time_mul_single(const Matrix *A, const Matrix *B) {
+    double best = INFINITY;
+    for (int t = 0; t < TUNE_TRIES; t++) {
+        double t0 = now_sec();
+        Matrix *C = op_mul_single(A, B, "");
+        double dt = now_sec() - t0;
+        matrix_free(C);
+        if (dt < best) best = dt;
+    }
+    return best;
+}
+
+static double time_gemm(const Matrix *A, const Matrix *B, Matrix *C) {
+    int n = A->rows;
+    double best = INFINITY;
+    for (int t = 0; t < TUNE_TRIES; t++) {
+        memset(C->data, 0, matrix_bytes(C));
+        double t0 = now_sec();
+        gemm_block_acc(n, n, n, A->data, (size_t)n, B->data, (size_t)n, C->data, (size_t)n);
+        double dt = now_sec() - t0;
+        if (dt < best) best = dt;
+    }
+    return best;
+}
+
+// Worker counts worth trying: powers of two up to twice the cores, the cores and the configured count
+static int worker_candidates(int cores, int configured, int *out) {
+    int n = 0, lim = 2 * cores > configured ? 2 * cores : configured;
+    if (lim > TUNE_MAX_WORKERS) lim = TUNE_MAX_WORKERS;
+    for (int w = 1; w <= lim; w++) {
+        if ((w & (w - 1)) == 0 || w == cores || w == configured) out[n++] = w;
+    }
+    return n;
+}
+
+// Pool job size with the shortest time; 0 when the best is an end of the sweep
+// (the real optimum may lie outside it, so it says nothing about the model)
+static int sweep_chunks(const char *what, PoolOp op, Pool *p, const Matrix *A, const Matrix *B,
+                        const int *chunks, int n) {
+    int best_i = 0;
+    double best = INFINITY;
+    printf("autotune: pool %s job size", what);
+    for (int i = 0; i < n; i++) {
+        g_cost_chunk = chunks[i];
+        double t = time_pool_op(op, p, A, B);
+        printf(" %d=%.2fms", chunks[i], t * 1e3);
+        if (t < best) {
+            best = t;
+            best_i = i;
+        }
+    }
+    g_cost_chunk = 0;
+    printf(" -> %d\n", chunks[best_i]);
+    return best_i > 0 && best_i < n - 1 ? chunks[best_i] : 0;
+}
+
+// Rewrites `path` with the tuned values: key=value lines of a tuned key get the
+// new value, the other lines stay as they are, missing keys go at the end.
+static int write_keys(const char *path, TunedKey *keys, int n) {
+    char tmp[512];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    FILE *in = fopen(path, "r");   // may not exist yet
+    FILE *out = fopen(tmp, "w");
+    if (out == NULL) {
+        perror(tmp);
+        if (in) fclose(in);
+        return -1;
+    }
+    int done[TUNE_KEYS] = { 0 };
+    char line[512];
+    while (in && fgets(line, sizeof(line), in)) {
+        int k = -1;
+        for (int i = 0; i < n && k < 0; i++) {
+            size_t kl = strlen(keys[i].key);
+            if (strncmp(line, keys[i].key, kl) == 0 && line[kl] == '=') k = i;
+        }
+        if (k >= 0 && !done[k]) {
+            fprintf(out, "%s=%s\n", keys[k].key, keys[k].val);
+            done[k] = 1;
+        } else if (k < 0) {
+            fputs(line, out);
+        }
+    }
+    if (in) fclose(in);
+    int header = 0;
+    for (int i = 0; i < n; i++) {
+        if (done[i]) continue;
+        if (!header) fputs("# measured by --autotune\n", out);
+        header = 1;
+        fprintf(out, "%s=%s\n", keys[i].key, keys[i].val);
+    }
+    if (fclose(out) != 0 || rename(tmp, path) != 0) {
+        perror(path);
+        remove(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+static void set_key(TunedKey *keys, int *n, const char *key, const char *fmt, double v) {
+    keys[*n].key = key;
+    if (strchr(fmt, 'd'))
+        snprintf(keys[*n].val, sizeof(keys[*n].val), fmt, (int)v);
+    else
+        snprintf(keys[*n].val, sizeof(keys[*n].val), fmt, v);
+    (*n)++;
+}
+
+int run_autotune(const AppConfig *cfg, const char *path) {
+    printf("autotune: probing the machine\n");
+    CostModel none;
+    memset(&none, 0, sizeof(none));
+    cost_calibrate(&none);   // everything measured, whatever the config says
+
+    // pools are forked before anything here starts OpenMP threads (see cost.h)
+    Matrix *A = tune_matrix(TUNE_MUL_N, 1), *B = tune_matrix(TUNE_MUL_N, 2);
+    int cand[TUNE_MAX_WORKERS], nc = worker_candidates(g_cost.cores, cfg->workers, cand);
+    int workers = cfg->workers > 0 ? cfg->workers : 1;
+    double best = INFINITY;
+    printf("autotune: workers");
+    for (int i = 0; i < nc; i++) {
+        Pool *p = pool_create(cand[i]);
+        double t = time_pool_op(op_mul_processes, p, A, B);
+        pool_destroy(p);
+        printf(" %d=%.2fms", cand[i], t * 1e3);
+        if (t < best) {
+            best = t;
+            workers = cand[i];
+        }
+    }
+    printf(" -> %d\n", workers);
+
+    Pool *p = pool_create(workers);
+    Matrix *X = tune_matrix(TUNE_ADD_N, 3), *Y = tune_matrix(TUNE_ADD_N, 4);
+    int add_chunk = sweep_chunks("add", op_add_processes, p, X, Y, g_add_chunks, COUNT(g_add_chunks));
+    int mul_chunk = sweep_chunks("mul", op_mul_processes, p, A, B, g_mul_chunks, COUNT(g_mul_chunks));
+    cost_calibrate_pool(p);   // pipes, then OpenMP
+    pool_destroy(p);
+    matrix_free(X);
+    matrix_free(Y);
+
+    // job round trip that makes the model pick the measured job sizes (geometric mean of both)
+    double fit = 1.0;
+    int nfit = 0;
+    if (add_chunk > 0) {
+        fit *= cost_fit_job(add_chunk, 1.0, 24.0);
+        nfit++;
+    }
+    if (mul_chunk > 0) {
+        fit *= cost_fit_job(mul_chunk, 2.0 * TUNE_MUL_N, 8.0 * (TUNE_MUL_N + 1));
+        nfit++;
+    }
+    if (nfit > 0) {
+        g_cost.ipc_job = pow(fit, 1.0 / nfit);
+        printf("autotune: pool job round trip fitted to the sweeps: %.1f us\n", g_cost.ipc_job * 1e6);
+    }
+    matrix_free(A);
+    matrix_free(B);
+
+    // team size for a compute-bound loop: fewer than the CPUs wins when they share cores.
+    // Written as omp_max_threads, cores stays the CPU count the model was measured with
+    A = tune_matrix(TUNE_GEMM_N, 5);
+    B = tune_matrix(TUNE_GEMM_N, 6);
+    Matrix *C = tune_matrix(TUNE_GEMM_N, 7);
+    int omp_was = g_omp_enabled;
+    g_omp_enabled = 1;
+    int team = g_cost.cores;
+    best = INFINITY;
+    printf("autotune: OpenMP team");
+    for (int t = 1; t <= g_cost.cores; t = t < g_cost.cores && t * 2 > g_cost.cores ? g_cost.cores : t * 2) {
+        g_cost_threads = t;   // 1, 2, 4, ... and the CPU count itself
+        double e = time_mul_single(A, B);
+        printf(" %d=%.2fms", t, e * 1e3);
+        if (e < best) {
+            best = e;
+            team = t;
+        }
+    }
+    g_cost_threads = 0;
+    printf(" -> %d\n", team);
+
+    // tiles on one thread: they are sized for one core's caches, and a team
+    // would have fewer row blocks than threads once the tile nears TUNE_GEMM_N
+    g_omp_enabled = 0;
+    int block = g_blocks[0];
+    best = INFINITY;
+    printf("autotune: gemm tile");
+    for (int i = 0; i < COUNT(g_blocks); i++) {
+        g_gemm_block = g_blocks[i];
+        double e = time_gemm(A, B, C);
+        printf(" %d=%.2fms", g_blocks[i], e * 1e3);
+        if (e < best) {
+            best = e;
+            block = g_blocks[i];
+        }
+    }
+    printf(" -> %d\n", block);
+    g_omp_enabled = omp_was;
+    matrix_free(A);
+    matrix_free(B);
+    matrix_free(C);
+
+    TunedKey keys[TUNE_KEYS];
+    int n = 0;
+    set_key(keys, &n, "workers", "%d", workers);
+    set_key(keys, &n, "gemm_block", "%d", block);
+    set_key(keys, &n, "omp_max_threads", "%d", team);
+    set_key(keys, &n, "cores", "%d", g_cost.cores);
+    set_key(keys, &n, "model_gflops", "%.3f", g_cost.flops * 1e-9);
+    set_key(keys, &n, "model_mem_gbs", "%.3f", g_cost.bw * 1e-9);
+    set_key(keys, &n, "model_mem_all_gbs", "%.3f", g_cost.bw_all * 1e-9);
+    set_key(keys, &n, "model_omp_us", "%.2f", g_cost.omp_fork * 1e6);
+    set_key(keys, &n, "model_job_us", "%.2f", g_cost.ipc_job * 1e6);
+    set_key(keys, &n, "model_pipe_gbs", "%.3f", g_cost.ipc_bw * 1e-9);
+    set_key(keys, &n, "model_fork_us", "%.1f", g_cost.proc_fork * 1e6);
+    if (write_keys(path, keys, n) != 0) {
+        return -1;
+    }
+    printf("autotune: wrote %d keys to %s\n", n, path);
+    for (int i = 0; i < n; i++) printf("  %s=%s\n", keys[i].key, keys[i].val);
+    return 0;
+}
@@ -0,0 +1,311 @@
+#include "common.h"
+#include "backend.h"
+#include "ops.h"
+#include "timer.h"
+#include "mat_alloc.h"
+#include "cost.h"
+#include "det_update.h"
+
+#define EIG_EST_ITERS  50          // iterations assumed when pricing a power iteration
+
+static int g_backend[BOP_COUNT] = { BK_AUTO, BK_AUTO, BK_AUTO, BK_AUTO, BK_AUTO };
+
+static const char *g_names[] = { "single", "omp", "pool", "auto", "compare" };
+static const char *g_titles[] = { "SINGLE-PROCESS", "OPENMP", "MULTI-PROCESS", "AUTO", "COMPARE" };
+static const char *g_ops[] = { "add", "sub", "mul", "det", "eigen" };
+
+int backend_parse(const char *s) {
+    for (int i = 0; i <= BK_COMPARE; i++) {
+        if (strcmp(s, g_names[i]) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+const char *backend_name(int b) {
+    return b >= 0 && b <= BK_COMPARE ? g_names[b] : "?";
+}
+
+const char *backend_title(int b) {
+    return b >= 0 && b <= BK_COMPARE ? g_titles[b] : "?";
+}
+
+const char *backend_op_name(int op) {
+    return op >= 0 && op < BOP_COUNT ? g_ops[op] : "?";
+}
+
+void backend_set(int op, int b) {
+    if (b < 0 || b > BK_COMPARE) return;
+    for (int i = 0; i < BOP_COUNT; i++) {
+        if (op < 0 || op == i) g_backend[i] = b;
+    }
+}
+
+int backend_get(int op) {
+    return op >= 0 && op < BOP_COUNT ? g_backend[op] : BK_AUTO;
+}
+
+// What an op costs in the terms of the machine model
+static void op_cost(int op, const Matrix *A, const Matrix *B, OpCost *c) {
+    double m = A->rows, k = A->cols, n = B ? B->cols : 1;
+    memset(c, 0, sizeof(*c));
+    c->regions = 1;
+    switch (op) {
+        case BOP_MUL:      // a dot product of length k per cell; a pool job is a row of A plus columns of B
+            c->flops = 2.0 * m * k * n;
+            c->bytes = 8.0 * (m * k + k * n + m * n);
+            c->items = m * n;
+            c->item_ipc = 8.0 * (k + 1);
+            c->job_ipc = 8.0 * k;
+            break;
+        case BOP_DET:      // elimination: n steps over the rows below the pivot, forked per step
+            c->flops = 2.0 * m * m * m / 3.0;
+            c->bytes = 16.0 * m * m * m / 3.0;
+            c->regions = A->rows;
+            c->items = m * m * m / 3.0;
+            c->item_ipc = 16.0;
+            c->steps = A->rows;
+            break;
+        case BOP_EIGEN:    // A*x and two sums per iteration, children forked per iteration send y back
+            c->flops = 2.0 * m * m * EIG_EST_ITERS;
+            c->bytes = 8.0 * m * m * EIG_EST_ITERS;
+            c->regions = 3 * EIG_EST_ITERS;
+            c->items = m * EIG_EST_ITERS;
+            c->item_ipc = 8.0;
+            c->steps = EIG_EST_ITERS;
+            break;
+        default:           // add, sub: one flop and three doubles per element
+            c->flops = m * k;
+            c->bytes = 24.0 * m * k;
+            c->items = m * k;
+            c->item_ipc = 24.0;
+            break;
+    }
+}
+
+int backend_resolve(int b, int op, Pool *p, const Matrix *A, const Matrix *B) {
+    if (b == BK_AUTO) {
+        OpCost c;
+        op_cost(op, A, B, &c);
+        int threads = 1, chunk = 0;
+        double est[BK_CONCRETE];
+        est[BK_SINGLE] = cost_single(&c);
+        est[BK_OMP] = g_omp_enabled ? cost_omp(&c, &threads) : INFINITY;   // OpenMP turned off in the menu
+        est[BK_POOL] = p ? cost_pool(&c, p->n, &chunk) : INFINITY;
+#ifndef HAVE_OMP
+        est[BK_OMP] = INFINITY;
+#endif
+        b = BK_SINGLE;
+        if (threads > 1 && est[BK_OMP] < est[b]) b = BK_OMP;
+        if (est[BK_POOL] < est[b]) b = BK_POOL;
+        if (g_cost_log) {
+            if (op == BOP_MUL)
+                printf("auto: mul %dx%dx%d", A->rows, A->cols, B->cols);
+            else
+                printf("auto: %s %dx%d", backend_op_name(op), A->rows, A->cols);
+            printf(" -> %s", backend_name(b));
+            if (b == BK_OMP) printf(" (%d threads)", threads);
+            if (b == BK_POOL) printf(c.steps ? " (%d processes)" : " (%d per job)", chunk);
+            printf("   est single %.3gms", est[BK_SINGLE] * 1e3);
+            if (isfinite(est[BK_OMP])) printf("  omp %.3gms", est[BK_OMP] * 1e3);
+            if (isfinite(est[BK_POOL])) printf("  pool %.3gms", est[BK_POOL] * 1e3);
+            printf("\n");
+        }
+        return b;
+    }
+#ifndef HAVE_OMP
+    if (b == BK_OMP) return BK_SINGLE;
+#endif
+    return b;
+}
+
+void backend_rates(int op, const Matrix *A, const Matrix *B, int iters, uint64_t ns,
+                   double *gflops, double *gbs) {
+    OpCost c;
+    op_cost(op, A, B, &c);
+    double scale = op == BOP_EIGEN ? (double)iters / EIG_EST_ITERS : 1.0;   // the real iteration count
+    double sec = (double)ns * 1e-9;
+    *gflops = sec > 0.0 ? c.flops * scale / sec * 1e-9 : 0.0;
+    *gbs = sec > 0.0 ? c.bytes * scale / sec * 1e-9 : 0.0;
+}
+
+void backend_report(int b, int op, const Matrix *A, const Matrix *B, int iters, uint64_t ns, int script) {
+    double gflops, gbs;
+    backend_rates(op, A, B, iters, ns, &gflops, &gbs);
+    if (script) {
+        printf(" gflops=%.4g gbs=%.4g", gflops, gbs);
+        if (b != BK_POOL) return;
+        for (int i = 0; i < PH_COUNT; i++)
+            printf(" %s_ms=%.3f", phase_name(i), (double)g_phase.ns[i] * 1e-6);
+        printf(" jobs=%d ipc_mb=%.3f", g_phase.jobs, (double)g_phase.ipc_bytes / 1e6);
+        return;
+    }
+    printf("  %.3g GFLOP/s  %.3g GB/s\n", gflops, gbs);
+    if (b != BK_POOL) return;
+    // compute is summed over the workers and overlaps collect, see timer.h
+    printf(" ");
+    for (int i = 0; i < PH_COUNT; i++)
+        printf(" %s %.3fms", phase_name(i), (double)g_phase.ns[i] * 1e-6);
+    printf("  (%d jobs, %.3f MB through pipes)\n", g_phase.jobs, (double)g_phase.ipc_bytes / 1e6);
+}
+
+// Forces the OpenMP switch for single/omp and returns the old value
+static int omp_enter(int b) {
+    int old = g_omp_enabled;
+    if (b == BK_SINGLE) g_omp_enabled = 0;
+#ifdef HAVE_OMP
+    if (b == BK_OMP) g_omp_enabled = 1;
+#endif
+    return old;
+}
+
+Matrix *backend_binary(int b, int op, Pool *p, const Matrix *A, const Matrix *B) {
+    Matrix *C;
+    if (b == BK_POOL) {
+        if (op == BOP_ADD) C = op_add_processes(p, A, B, "");
+        else if (op == BOP_SUB) C = op_sub_processes(p, A, B, "");
+        else C = op_mul_processes(p, A, B, "");
+        return C;
+    }
+    int old = omp_enter(b);
+    if (op == BOP_ADD) C = op_add_single(A, B, "");
+    else if (op == BOP_SUB) C = op_sub_single(A, B, "");
+    else C = op_mul_single(A, B, "");
+    g_omp_enabled = old;
+    return C;
+}
+
+double backend_det(int b, Pool *p, const Matrix *A) {
+    if (b == BK_POOL) {
+        return op_det_processes(p, A);
+    }
+    int old = omp_enter(b);
+    double d = op_det_single(A);
+    g_omp_enabled = old;
+    return d;
+}
+
+double backend_det_factor(int b, Pool *p, Matrix *A) {
+    double d = backend_det(b, p, A);
+    det_state_seed(A, d);
+    return d;
+}
+
+int backend_eigen(int b, Pool *p, const Matrix *A, double tol, int maxit, const double *x0,
+                  double *lambda_out, double **vec_out) {
+    if (b == BK_POOL) {
+        return op_eigen_processes(p, A, tol, maxit, x0, lambda_out, vec_out);
+    }
+    int old = omp_enter(b);
+    int it = op_eigen_power(A, tol, maxit, x0, lambda_out, vec_out);
+    g_omp_enabled = old;
+    return it;
+}
+
+// Backends a compare run goes through
+static int compare_list(int list[BK_CONCRETE]) {
+    int n = 0;
+    list[n++] = BK_SINGLE;
+#ifdef HAVE_OMP
+    list[n++] = BK_OMP;
+#endif
+    list[n++] = BK_POOL;
+    return n;
+}
+
+static double max_diff(const double *a, const double *b, size_t n) {
+    double d = 0.0;
+    for (size_t i = 0; i < n; i++) {
+        double x = fabs(a[i] - b[i]);
+        if (x > d || x != x) d = x;   // NaN counts as a difference
+    }
+    return d;
+}
+
+// |a - b| for two scalar results: equal values (the same infinity too) and two
+// NaNs match, a NaN on one side only is a mismatch
+static double scalar_diff(double a, double b) {
+    if (a == b || (isnan(a) && isnan(b))) return 0.0;
+    if (isnan(a) || isnan(b)) return INFINITY;
+    return fabs(a - b);
+}
+
+Matrix *backend_compare_binary(int op, Pool *p, const Matrix *A, const Matrix *B,
+                               BackendRun runs[BK_CONCRETE], int *n) {
+    int list[BK_CONCRETE];
+    *n = compare_list(list);
+    Matrix *first = NULL;
+    for (int i = 0; i < *n; i++) {
+        BackendRun *r = &runs[i];
+        memset(r, 0, sizeof(*r));
+        r->backend = list[i];
+        uint64_t t0 = now_nanos();
+        Matrix *C = backend_binary(list[i], op, p, A, B);
+        r->ms = (double)(now_nanos() - t0) * 1e-6;
+        if (C == NULL) continue;
+        r->ok = 1;
+        if (first == NULL) {
+            first = C;
+            continue;
+        }
+        r->diff = (C->rows == first->rows && C->cols == first->cols)
+                ? max_diff(C->data, first->data, (size_t)C->rows * C->cols) : INFINITY;
+        matrix_free(C);
+    }
+    return first;
+}
+
+double backend_compare_det(Pool *p, const Matrix *A, BackendRun runs[BK_CONCRETE], int *n) {
+    int list[BK_CONCRETE];
+    *n = compare_list(list);
+    for (int i = 0; i < *n; i++) {
+        BackendRun *r = &runs[i];
+        memset(r, 0, sizeof(*r));
+        r->backend = list[i];
+        uint64_t t0 = now_nanos();
+        r->value = backend_det(list[i], p, A);
+        r->ms = (double)(now_nanos() - t0) * 1e-6;
+        r->ok = 1;
+        r->diff = scalar_diff(r->value, runs[0].value);
+    }
+    return runs[0].value;
+}
+
+int backend_compare_eigen(Pool *p, const Matrix *A, double tol, int maxit, const double *x0,
+                          double *lambda_out, double **vec_out, BackendRun runs[BK_CONCRETE], int *n) {
+    int list[BK_CONCRETE];
+    *n = compare_list(list);
+    int first = -1;
+    *vec_out = NULL;
+    for (int i = 0; i < *n; i++) {
+        BackendRun *r = &runs[i];
+        memset(r, 0, sizeof(*r));
+        r->backend = list[i];
+        double lambda, *vec = NULL;
+        uint64_t t0 = now_nanos();
+        int it = backend_eigen(list[i], p, A, tol, maxit, x0, &lambda, &vec);
+        r->ms = (double)(now_nanos() - t0) * 1e-6;
+        if (it < 0) continue;
+        r->ok = 1;
+        r->value = lambda;
+        r->iters = it;
+        r->has_vec = 1;
+        if (first < 0) {
+            first = it;
+            *lambda_out = lambda;
+            *vec_out = vec;
+            continue;
+        }
+        r->diff = scalar_diff(lambda, *lambda_out);
+        // a unit eigenvector is only defined up to its sign: compare with the
+        // sign that matches best
+        int n = A->rows;
+        double same = max_diff(vec, *vec_out, (size_t)n);
+        for (int k = 0; k < n; k++) vec[k] = -vec[k];
+        double flip = max_diff(vec, *vec_out, (size_t)n);
+        r->vec_diff = same < flip ? same : flip;
+        mat_free(vec);
+    }
+    return first;
+}
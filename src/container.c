@@ -0,0 +1,337 @@
+#define _GNU_SOURCE  // pread/pwrite, ftruncate
+
+#include "common.h"
+#include "container.h"
+#include "file_io.h"
+#include "mat_alloc.h"
+#include <limits.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#define PAK_ALIGN    64
+#define PAK_MMAP_MIN (64u * 1024u)   // smaller payloads are read, bigger ones mapped
+
+static uint64_t align_up(uint64_t x) {
+    return (x + PAK_ALIGN - 1) & ~(uint64_t)(PAK_ALIGN - 1);
+}
+
+int is_container_path(const char *path) {
+    size_t n = strlen(path), m = strlen(PAK_EXT);
+    return n >= m && strcmp(path + n - m, PAK_EXT) == 0;
+}
+
+// Checks that an index entry describes a matrix inside a file of fsize bytes,
+// so pak_load never maps or reads past the end of the file.
+static int entry_ok(const PakEntry *e, uint64_t fsize) {
+    if (e->rows > INT_MAX || e->cols > INT_MAX) return 0;
+    if (e->rows != 0 && e->cols > UINT64_MAX / sizeof(double) / e->rows) return 0;
+    uint64_t bytes = (uint64_t)e->rows * e->cols * sizeof(double);
+    return e->offset <= fsize && bytes <= fsize - e->offset;
+}
+
+// Opens a container and reads its header and index.
+Pak *pak_open(const char *path) {
+    int fd = open(path, O_RDWR);
+    if (fd < 0) fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror("open container");
+        return NULL;
+    }
+    Pak *p = (Pak*)xmalloc(sizeof(Pak));
+    p->fd = fd;
+    p->idx = NULL;
+    if (pread(fd, &p->hdr, sizeof(p->hdr), 0) != (ssize_t)sizeof(p->hdr) ||
+        memcmp(p->hdr.magic, PAK_MAGIC, sizeof(p->hdr.magic)) != 0 ||
+        p->hdr.version != PAK_VERSION) {
+        fprintf(stderr, "Not a matrix container: %s\n", path);
+        pak_close(p);
+        return NULL;
+    }
+    struct stat st;
+    uint64_t fsize = fstat(fd, &st) == 0 ? (uint64_t)st.st_size : 0;
+    size_t ibytes = (size_t)p->hdr.count * sizeof(PakEntry);
+    if (p->hdr.index_off > fsize || ibytes > fsize - p->hdr.index_off) {
+        fprintf(stderr, "Truncated container index: %s\n", path);
+        pak_close(p);
+        return NULL;
+    }
+    p->idx = (PakEntry*)xmalloc(ibytes ? ibytes : 1);
+    if (ibytes && pread(fd, p->idx, ibytes, (off_t)p->hdr.index_off) != (ssize_t)ibytes) {
+        fprintf(stderr, "Truncated container index: %s\n", path);
+        pak_close(p);
+        return NULL;
+    }
+    for (uint32_t i = 0; i < p->hdr.count; i++) {
+        if (!entry_ok(&p->idx[i], fsize)) {
+            fprintf(stderr, "Bad container entry %u in %s\n", i, path);
+            pak_close(p);
+            return NULL;
+        }
+    }
+    return p;
+}
+
+void pak_close(Pak *p) {
+    if (!p) return;
+    close(p->fd);
+    free(p->idx);
+    free(p);
+}
+
+int pak_find(const Pak *p, const char *name) {
+    for (int i = (int)p->hdr.count - 1; i >= 0; i--) {   // newest entry wins
+        if ((p->idx[i].flags & PAK_LIVE) && strncmp(p->idx[i].name, name, MAX_NAME) == 0) return i;
+    }
+    return -1;
+}
+
+// Finds the live entry holding a matrix of the given shape and checksum,
+// trying `hint` first (entries move when the container is compacted).
+int pak_find_data(const Pak *p, int hint, int rows, int cols, uint64_t checksum) {
+    for (int k = -1; k < (int)p->hdr.count; k++) {
+        int i = k < 0 ? hint : k;
+        if (i < 0 || i >= (int)p->hdr.count) continue;
+        const PakEntry *e = &p->idx[i];
+        if ((e->flags & PAK_LIVE) && e->checksum == checksum &&
+            e->rows == (uint32_t)rows && e->cols == (uint32_t)cols) return i;
+    }
+    return -1;
+}
+
+// Loads one entry. Big payloads are mapped privately (zero-copy, copy-on-write),
+// small ones are read into a buffer. Returns 0 on success, -1 on error.
+int pak_load(Pak *p, int i, const char *name_override, Matrix **out) {
+    const PakEntry *e = &p->idx[i];
+    const char *name = (name_override && *name_override) ? name_override : e->name;
+    size_t count = (size_t)e->rows * e->cols;
+    size_t bytes = count * sizeof(double);
+
+    if (bytes >= PAK_MMAP_MIN) {
+        long page = sysconf(_SC_PAGESIZE);
+        uint64_t start = e->offset & ~(uint64_t)(page - 1);   // mmap offsets must be page aligned
+        size_t len = (size_t)(e->offset - start) + bytes;
+        void *base = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE, p->fd, (off_t)start);
+        if (base != MAP_FAILED) {
+            double *data = (double*)((char*)base + (e->offset - start));
+            if (g_bin_verify && matrix_checksum(data, count) != e->checksum) {
+                fprintf(stderr, "Checksum mismatch for '%s' in container\n", e->name);
+                munmap(base, len);
+                return -1;
+            }
+            *out = matrix_create_mapped(name, (int)e->rows, (int)e->cols, data, base, len);
+            return 0;
+        }
+    }
+    Matrix *m = matrix_create(name, (int)e->rows, (int)e->cols);
+    if (bytes && pread(p->fd, m->data, bytes, (off_t)e->offset) != (ssize_t)bytes) {
+        fprintf(stderr, "Truncated payload for '%s' in container\n", e->name);
+        matrix_free(m);
+        return -1;
+    }
+    if (matrix_checksum(m->data, count) != e->checksum) {
+        fprintf(stderr, "Checksum mismatch for '%s' in container\n", e->name);
+        matrix_free(m);
+        return -1;
+    }
+    *out = m;
+    return 0;
+}
+
+// Loads every live entry into the registry (names already taken get a ~N suffix). aux (if not NULL) gets the header aux field.
+int pak_load_all(const char *path, MatrixRegistry *reg, uint64_t *aux) {
+    Pak *p = pak_open(path);
+    if (!p) return -1;
+    int loaded = 0;
+    for (int i = 0; i < (int)p->hdr.count; i++) {
+        if (!(p->idx[i].flags & PAK_LIVE)) continue;
+        // a registry saved earlier uses the same numeric names, so rename clashes
+        char name[MAX_NAME];
+        snprintf(name, sizeof(name), "%s", p->idx[i].name);
+        for (int k = 1; registry_get(reg, name) != NULL; k++) {
+            snprintf(name, sizeof(name), "%.20s~%d", p->idx[i].name, k);
+        }
+        Matrix *m = NULL;
+        if (pak_load(p, i, name, &m) == 0) {
+            if (registry_add(reg, m) == 0) loaded++;
+            else matrix_free(m);
+        }
+    }
+    if (aux) *aux = p->hdr.aux;
+    pak_close(p);
+    return loaded;
+}
+
+// Adds every live entry as a lazy matrix (only the index is read).
+// Returns the number added or -1.
+int pak_index_lazy(const char *path, MatrixRegistry *reg) {
+    Pak *p = pak_open(path);
+    if (!p) return -1;
+    int added = 0;
+    for (int i = 0; i < (int)p->hdr.count; i++) {
+        const PakEntry *e = &p->idx[i];
+        if (!(e->flags & PAK_LIVE)) continue;
+        Matrix *m = matrix_create_lazy(e->name, (int)e->rows, (int)e->cols, path, i);
+        m->src_sum = e->checksum;
+        if (registry_add(reg, m) == 0) added++;
+        else matrix_free(m);
+    }
+    pak_close(p);
+    return added;
+}
+
+// Writes zero bytes up to the next PAK_ALIGN boundary.
+static int pad_to(FILE *f, uint64_t *pos) {
+    static const char zeros[PAK_ALIGN] = {0};
+    uint64_t next = align_up(*pos);
+    if (next > *pos && fwrite(zeros, 1, (size_t)(next - *pos), f) != (size_t)(next - *pos)) return -1;
+    *pos = next;
+    return 0;
+}
+
+// Source of the matrices for write_all_entries: a plain list or the registry
+// (fetched one at a time, so a memory budget can keep spilling the others).
+typedef struct {
+    Matrix **list;
+    MatrixRegistry *reg;
+} PakSource;
+
+static Matrix *source_get(const PakSource *src, int i) {
+    return src->reg ? registry_at(src->reg, i) : src->list[i];
+}
+
+// Writes n matrices as a new container (one sequential pass) to path.
+static int write_all_entries(const char *path, const PakSource *src, int n, uint64_t aux) {
+    char tmp[600];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    FILE *f = fopen(tmp, "wb");
+    if (!f) {
+        perror("fopen");
+        return -1;
+    }
+    setvbuf(f, NULL, _IOFBF, 1 << 20);   // big sequential writes
+
+    PakEntry *idx = (PakEntry*)xmalloc((size_t)(n ? n : 1) * sizeof(PakEntry));
+    PakHeader h;
+    memset(&h, 0, sizeof(h));
+    uint64_t pos = sizeof(h);
+    int ok = fwrite(&h, sizeof(h), 1, f) == 1;   // placeholder, rewritten at the end
+
+    for (int i = 0; ok && i < n; i++) {
+        const Matrix *m = source_get(src, i);
+        size_t count = (size_t)m->rows * m->cols;
+        memset(&idx[i], 0, sizeof(idx[i]));
+        snprintf(idx[i].name, sizeof(idx[i].name), "%s", m->name);
+        idx[i].rows = (uint32_t)m->rows;
+        idx[i].cols = (uint32_t)m->cols;
+        idx[i].offset = pos;
+        idx[i].checksum = matrix_checksum(m->data, count);
+        idx[i].flags = PAK_LIVE;
+        ok = fwrite(m->data, sizeof(double), count, f) == count;
+        pos += count * sizeof(double);
+        if (ok) ok = pad_to(f, &pos) == 0;
+    }
+
+    memcpy(h.magic, PAK_MAGIC, sizeof(h.magic));
+    h.version = PAK_VERSION;
+    h.count = (uint32_t)n;
+    h.index_off = pos;
+    h.data_end = pos;
+    h.aux = aux;
+    if (ok) ok = fwrite(idx, sizeof(PakEntry), (size_t)n, f) == (size_t)n;
+    if (ok) ok = fseek(f, 0, SEEK_SET) == 0 && fwrite(&h, sizeof(h), 1, f) == 1;
+    if (fclose(f) != 0) ok = 0;
+    free(idx);
+
+    if (!ok || rename(tmp, path) != 0) {   // replace the old file only when complete
+        perror("write container");
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+// Saves every registry matrix into one container file. Returns 0 or -1.
+int pak_write_registry(const char *path, MatrixRegistry *reg, uint64_t aux) {
+    PakSource src = { NULL, reg };
+    return write_all_entries(path, &src, reg->count, aux);
+}
+
+// Rewrites the container with only its live entries.
+int pak_compact(const char *path) {
+    Pak *p = pak_open(path);
+    if (!p) return -1;
+    int n = 0;
+    Matrix **list = (Matrix**)xmalloc((size_t)(p->hdr.count ? p->hdr.count : 1) * sizeof(Matrix*));
+    int ok = 1;
+    for (int i = 0; i < (int)p->hdr.count && ok; i++) {
+        if (!(p->idx[i].flags & PAK_LIVE)) continue;
+        if (pak_load(p, i, NULL, &list[n]) == 0) n++;
+        else ok = 0;
+    }
+    uint64_t aux = p->hdr.aux;
+    pak_close(p);
+    PakSource src = { list, NULL };
+    int rc = ok ? write_all_entries(path, &src, n, aux) : -1;
+    for (int i = 0; i < n; i++) matrix_free(list[i]);
+    free(list);
+    return rc;
+}
+
+// Appends one matrix (replacing a live entry with the same name).
+// Creates the container if it doesn't exist. Compacts when dead space
+// grows bigger than the live payload.
+int pak_append(const char *path, const Matrix *m) {
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        Matrix *one = (Matrix*)m;
+        PakSource src = { &one, NULL };
+        return write_all_entries(path, &src, 1, 0);
+    }
+    Pak *p = pak_open(path);
+    if (!p) return -1;
+
+    uint32_t n = p->hdr.count;
+    PakEntry *idx = (PakEntry*)xmalloc((size_t)(n + 1) * sizeof(PakEntry));
+    memcpy(idx, p->idx, (size_t)n * sizeof(PakEntry));
+    uint64_t live = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        if ((idx[i].flags & PAK_LIVE) && strncmp(idx[i].name, m->name, MAX_NAME) == 0) {
+            idx[i].flags &= ~(uint32_t)PAK_LIVE;     // replaced by the new entry
+        }
+        if (idx[i].flags & PAK_LIVE) live += (uint64_t)idx[i].rows * idx[i].cols * sizeof(double);
+    }
+
+    // new payload goes after the current index, the new index after the payload
+    size_t count = (size_t)m->rows * m->cols;
+    uint64_t off = align_up(p->hdr.index_off + (uint64_t)n * sizeof(PakEntry));
+    PakEntry *e = &idx[n];
+    memset(e, 0, sizeof(*e));
+    snprintf(e->name, sizeof(e->name), "%s", m->name);
+    e->rows = (uint32_t)m->rows;
+    e->cols = (uint32_t)m->cols;
+    e->offset = off;
+    e->checksum = matrix_checksum(m->data, count);
+    e->flags = PAK_LIVE;
+    live += count * sizeof(double);
+
+    PakHeader h = p->hdr;
+    h.count = n + 1;
+    h.data_end = off + count * sizeof(double);
+    h.index_off = align_up(h.data_end);
+
+    int ok = pwrite(p->fd, m->data, count * sizeof(double), (off_t)off) == (ssize_t)(count * sizeof(double)) &&
+             pwrite(p->fd, idx, (size_t)(n + 1) * sizeof(PakEntry), (off_t)h.index_off) ==
+                 (ssize_t)((size_t)(n + 1) * sizeof(PakEntry)) &&
+             fdatasync(p->fd) == 0 &&                       // payload and index first,
+             pwrite(p->fd, &h, sizeof(h), 0) == (ssize_t)sizeof(h);   // then the header points at them
+    pak_close(p);
+    free(idx);
+    if (!ok) {
+        perror("append container");
+        return -1;
+    }
+    if (h.index_off - sizeof(PakHeader) > 2 * live) {     // more dead than live bytes
+        return pak_compact(path);
+    }
+    return 0;
+}
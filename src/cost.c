@@ -0,0 +1,306 @@
+#define _GNU_SOURCE  // sched_getaffinity, CPU_COUNT
+
+#include "common.h"
+#include "cost.h"
+#include "timer.h"
+#include <sched.h>
+#ifdef HAVE_OMP
+#include <omp.h>
+#endif
+
+#define PROBE_DOT_N     4096        // doubles per vector of the flop probe (stays in cache)
+#define PROBE_DOT_REPS  64          // dot products per timing
+#define PROBE_BW_N      (1u << 20)  // doubles per array of the bandwidth probe (8 MB each)
+#define PROBE_REGIONS   64          // empty OpenMP regions timed
+#define PROBE_JOBS      64          // one-element round trips to a pool worker
+#define PROBE_IPC_N     (1u << 16)  // elements of the big pool job (1 MB out, 512 KB back)
+#define PROBE_FORKS     8           // fork/exit/wait cycles timed
+#define PROBE_TRIES     3           // each probe keeps its best of this many timings
+
+#define POOL_OVERHEAD   8           // a pool job computes and moves at least 8x its round-trip cost
+#define POOL_JOBS_PER_W 4           // jobs per worker kept for load balance
+#define POOL_JOB_BYTES  (1 << 20)   // pipe bytes of one job at most
+
+CostModel g_cost = { 1, 1e9, 5e9, 5e9, 5e-6, 20e-6, 2e9, 200e-6 };
+int g_cost_threads = 0;
+int g_cost_max_threads = 0;
+int g_cost_chunk = 0;
+int g_cost_log = 0;
+
+static volatile double g_sink;      // keeps probe results alive
+static CostModel g_late_preset;     // config values of the fields measured after the fork
+
+static double now_sec(void) {
+    return (double)now_nanos() * 1e-9;
+}
+
+static int probe_cores(void) {
+    cpu_set_t set;
+    if (sched_getaffinity(0, sizeof(set), &set) == 0 && CPU_COUNT(&set) > 0) {
+        return CPU_COUNT(&set);
+    }
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+}
+
+static double probe_flops(void) {
+    double *a = (double*)xmalloc(PROBE_DOT_N * sizeof(double));
+    double *b = (double*)xmalloc(PROBE_DOT_N * sizeof(double));
+    for (int i = 0; i < PROBE_DOT_N; i++) {
+        a[i] = 1.0 + i * 1e-6;
+        b[i] = 1.0 - i * 1e-6;
+    }
+    double best = INFINITY;
+    for (int t = 0; t < PROBE_TRIES; t++) {
+        double t0 = now_sec(), s = 0.0;
+        for (int r = 0; r < PROBE_DOT_REPS; r++)
+            for (int i = 0; i < PROBE_DOT_N; i++) s += a[i] * b[i];
+        double dt = now_sec() - t0;
+        g_sink += s;
+        if (dt < best) best = dt;
+    }
+    free(a);
+    free(b);
+    return 2.0 * PROBE_DOT_N * PROBE_DOT_REPS / best;
+}
+
+// c = a + b over arrays bigger than most caches, on `threads` threads
+static double probe_bw(int threads) {
+    double *a = (double*)xmalloc(PROBE_BW_N * sizeof(double));
+    double *b = (double*)xmalloc(PROBE_BW_N * sizeof(double));
+    double *c = (double*)xmalloc(PROBE_BW_N * sizeof(double));
+    (void)threads;
+    #pragma omp parallel for num_threads(threads) if(threads > 1) schedule(static)
+    for (int i = 0; i < (int)PROBE_BW_N; i++) {
+        a[i] = i;
+        b[i] = 1.0;
+        c[i] = 0.0;
+    }
+    double best = INFINITY;
+    for (int t = 0; t < PROBE_TRIES; t++) {
+        double t0 = now_sec();
+        #pragma omp parallel for num_threads(threads) if(threads > 1) schedule(static)
+        for (int i = 0; i < (int)PROBE_BW_N; i++) c[i] = a[i] + b[i];
+        double dt = now_sec() - t0;
+        g_sink += c[t];
+        if (dt < best) best = dt;
+    }
+    free(a);
+    free(b);
+    free(c);
+    return 3.0 * PROBE_BW_N * sizeof(double) / best;
+}
+
+static double probe_omp_fork(int threads) {
+#ifdef HAVE_OMP
+    double best = INFINITY;
+    #pragma omp parallel num_threads(threads)   // the first region starts the threads
+    {
+        if (omp_get_thread_num() == 0) g_sink += 1.0;
+    }
+    for (int t = 0; t < PROBE_TRIES; t++) {
+        double t0 = now_sec();
+        for (int r = 0; r < PROBE_REGIONS; r++) {
+            #pragma omp parallel num_threads(threads)
+            {
+                if (omp_get_thread_num() == 0) g_sink += 1.0;
+            }
+        }
+        double dt = (now_sec() - t0) / PROBE_REGIONS;
+        if (dt < best) best = dt;
+    }
+    return best;
+#else
+    (void)threads;
+    return 0.0;
+#endif
+}
+
+// One add job of n elements on worker wi, waited for. Returns its seconds or -1.
+static double pool_round_trip(Pool *p, int wi, int n, double *buf) {
+    JobHeader h = { .cmd = CMD_ADD_ELEM, .job_id = 0, .i = 0, .j = 0, .n = n,
+                    .rows = 1, .cols = n, .payload_bytes = (int)(2 * (size_t)n * sizeof(double)) };
+    ResultHeader rh;
+    int got;
+    double t0 = now_sec();
+    if (pool_send(wi, p, &h, buf) != 0) return -1.0;
+    if (pool_wait_any(p, &got) != 1 || got != wi) return -1.0;
+    if (pool_recv(wi, p, &rh, buf, (size_t)n * sizeof(double)) < 0) return -1.0;
+    return now_sec() - t0;
+}
+
+static void probe_pool(Pool *p, double *job, double *bw) {
+    int wi = p ? pool_find_idle(p) : -1;
+    if (wi < 0) return;
+    double *buf = (double*)xmalloc(2 * (size_t)PROBE_IPC_N * sizeof(double));
+    memset(buf, 0, 2 * (size_t)PROBE_IPC_N * sizeof(double));
+    double best_job = INFINITY, best_big = INFINITY;
+    for (int t = 0; t < PROBE_TRIES; t++) {
+        double t0 = now_sec();
+        for (int r = 0; r < PROBE_JOBS; r++) {
+            if (pool_round_trip(p, wi, 1, buf) < 0) {
+                free(buf);
+                return;
+            }
+        }
+        double dt = (now_sec() - t0) / PROBE_JOBS;
+        if (dt < best_job) best_job = dt;
+        dt = pool_round_trip(p, wi, PROBE_IPC_N, buf);
+        if (dt < 0) break;
+        if (dt < best_big) best_big = dt;
+    }
+    free(buf);
+    *job = best_job;
+    if (best_big > best_job) *bw = 3.0 * PROBE_IPC_N * sizeof(double) / (best_big - best_job);
+}
+
+static double probe_fork(void) {
+    double best = INFINITY;
+    for (int t = 0; t < PROBE_TRIES; t++) {
+        double t0 = now_sec();
+        for (int r = 0; r < PROBE_FORKS; r++) {
+            pid_t pid = fork();
+            if (pid < 0) return g_cost.proc_fork;
+            if (pid == 0) _exit(0);
+            waitpid(pid, NULL, 0);
+        }
+        double dt = (now_sec() - t0) / PROBE_FORKS;
+        if (dt < best) best = dt;
+    }
+    return best;
+}
+
+void cost_calibrate(const CostModel *preset) {
+    CostModel m = *preset;
+    if (m.cores <= 0) m.cores = probe_cores();
+    if (m.flops <= 0) m.flops = probe_flops();
+    if (m.bw <= 0) m.bw = probe_bw(1);
+    if (m.proc_fork <= 0) m.proc_fork = probe_fork();
+    g_late_preset = m;                                // the rest until cost_calibrate_pool
+    if (m.bw_all <= 0) m.bw_all = m.bw * m.cores;
+    if (m.omp_fork <= 0) m.omp_fork = g_cost.omp_fork;
+    if (m.ipc_job <= 0) m.ipc_job = g_cost.ipc_job;
+    if (m.ipc_bw <= 0) m.ipc_bw = g_cost.ipc_bw;
+    g_cost = m;
+}
+
+void cost_calibrate_pool(Pool *p) {
+    if (g_late_preset.bw_all <= 0)
+        g_cost.bw_all = g_cost.cores > 1 ? probe_bw(g_cost.cores) : g_cost.bw;
+    if (g_cost.bw_all < g_cost.bw) g_cost.bw_all = g_cost.bw;
+    if (g_late_preset.omp_fork <= 0) g_cost.omp_fork = probe_omp_fork(g_cost.cores);
+    double job = g_cost.ipc_job, bw = g_cost.ipc_bw;
+    if (g_late_preset.ipc_job <= 0 || g_late_preset.ipc_bw <= 0) probe_pool(p, &job, &bw);
+    if (g_late_preset.ipc_job <= 0) g_cost.ipc_job = job;
+    if (g_late_preset.ipc_bw <= 0) g_cost.ipc_bw = bw;
+    if (g_cost_log) cost_print();
+}
+
+void cost_print(void) {
+    printf("machine model: cores=%d  %.2f GFLOP/s  mem %.2f GB/s (all cores %.2f)  "
+           "omp region %.1f us  pool job %.1f us  pipe %.2f GB/s  fork %.1f us\n",
+           g_cost.cores, g_cost.flops * 1e-9, g_cost.bw * 1e-9, g_cost.bw_all * 1e-9,
+           g_cost.omp_fork * 1e6, g_cost.ipc_job * 1e6, g_cost.ipc_bw * 1e-9, g_cost.proc_fork * 1e6);
+}
+
+double cost_single(const OpCost *c) {
+    double compute = c->flops / g_cost.flops, memory = c->bytes / g_cost.bw;
+    return compute > memory ? compute : memory;
+}
+
+// Loop time on a team of t threads, region overhead included
+static double omp_time(const OpCost *c, int t) {
+    if (t <= 1) return cost_single(c);
+    double bw = g_cost.bw * t < g_cost.bw_all ? g_cost.bw * t : g_cost.bw_all;
+    double compute = c->flops / (g_cost.flops * t), memory = c->bytes / bw;
+    // team start-up grows with its size, omp_fork is a region on every core
+    return c->regions * g_cost.omp_fork * t / g_cost.cores + (compute > memory ? compute : memory);
+}
+
+double cost_omp(const OpCost *c, int *threads) {
+    int best_t = 1;
+#ifdef HAVE_OMP
+    if (g_cost_threads > 0) {
+        best_t = g_cost_threads;
+    } else {
+        double best = cost_single(c);
+        int lim = g_cost_max_threads > 0 && g_cost_max_threads < g_cost.cores ? g_cost_max_threads : g_cost.cores;
+        for (int t = 2; t <= lim; t++) {
+            double e = omp_time(c, t);
+            if (e < best) {
+                best = e;
+                best_t = t;
+            }
+        }
+    }
+#endif
+    if (threads) *threads = best_t;
+    return omp_time(c, best_t);
+}
+
+int cost_threads(double flops, double bytes) {
+    if (!g_omp_enabled) return 1;
+    OpCost c = { .flops = flops, .bytes = bytes, .regions = 1 };
+    int t;
+    cost_omp(&c, &t);
+    return t;
+}
+
+int cost_chunk(double items, double item_flops, double item_ipc, int workers) {
+    double chunk;
+    if (g_cost_chunk > 0) {
+        chunk = g_cost_chunk;
+    } else {
+        double item_t = item_flops / g_cost.flops + item_ipc / g_cost.ipc_bw;
+        double least = ceil(POOL_OVERHEAD * g_cost.ipc_job / item_t);
+        double balanced = ceil(items / ((workers > 0 ? workers : 1) * POOL_JOBS_PER_W));
+        chunk = least > balanced ? least : balanced;
+        if (item_ipc > 0 && chunk * item_ipc > POOL_JOB_BYTES) chunk = floor(POOL_JOB_BYTES / item_ipc);
+    }
+    if (chunk > items) chunk = items;
+    return chunk < 1 ? 1 : (int)chunk;
+}
+
+double cost_fit_job(double chunk, double item_flops, double item_ipc) {
+    double item_t = item_flops / g_cost.flops + item_ipc / g_cost.ipc_bw;
+    return chunk * item_t / POOL_OVERHEAD;
+}
+
+// Step time with w children (w = 1: in this process, no pipes)
+static double procs_time(double flops, double ipc, int w) {
+    if (w <= 1) return flops / g_cost.flops;
+    return w * g_cost.proc_fork + ipc / g_cost.ipc_bw + flops / (g_cost.flops * w);
+}
+
+int cost_procs(double flops, double ipc, int min, int max) {
+    if (min > max) min = max;
+    int lim = g_cost.cores < max ? g_cost.cores : max;
+    if (lim < min) lim = min;
+    int best_w = min > 1 ? min : 1;
+    double best = procs_time(flops, ipc, best_w);
+    for (int w = best_w + 1; w <= lim; w++) {
+        double e = procs_time(flops, ipc, w);
+        if (e < best) {
+            best = e;
+            best_w = w;
+        }
+    }
+    return best_w;
+}
+
+double cost_pool(const OpCost *c, int workers, int *chunk) {
+    double ipc = c->items * c->item_ipc;
+    if (c->steps > 0) {                       // children forked for every step
+        int w = cost_procs(c->flops / c->steps, ipc / c->steps, 2, 64);   // what the pool ops fork
+        if (chunk) *chunk = w;
+        return c->steps * procs_time(c->flops / c->steps, ipc / c->steps, w);
+    }
+    double items = c->items > 1 ? c->items : 1;
+    int k = cost_chunk(items, c->flops / items, c->item_ipc, workers);
+    if (chunk) *chunk = k;
+    double jobs = ceil(items / k);
+    int par = workers < g_cost.cores ? workers : g_cost.cores;
+    if (par < 1) par = 1;
+    // the parent moves every job through the pipes itself, the workers compute side by side
+    return jobs * g_cost.ipc_job + (ipc + jobs * c->job_ipc) / g_cost.ipc_bw + c->flops / (g_cost.flops * par);
+}
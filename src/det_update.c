@@ -0,0 +1,231 @@
+#include "common.h"
+#include "det_update.h"
+#include "mat_alloc.h"
+#include "cost.h"
+
+#define DET_MAX_UPDATES 32      // refactor after this many rank-1 updates (rounding drift)
+#define DET_MIN_ALPHA   1e-8    // |1 + v^T A^-1 u| below this: update is unstable, refactor
+#define DET_MAX_N       4096    // don't keep an n*n inverse for bigger matrices
+
+static inline double dabs(double x) { return x < 0 ? -x : x; }
+
+// OpenMP threads worth a pass over `mats` n x n matrices (2 flops, 2 doubles per cell)
+static int pass_threads(int n, int mats) {
+    return cost_threads(2.0 * mats * n * (double)n, 16.0 * mats * n * (double)n);
+}
+
+void det_state_free(DetState *s) {
+    if (s == NULL) return;
+    mat_free(s->inv);
+    free(s);
+}
+
+// Gauss-Jordan elimination with partial pivoting on [A | I].
+// Leaves A^-1 in s->inv and the determinant in s->det. A singular matrix gets
+// inv = NULL, det = 0 and the number of columns without a pivot in s->nullity.
+static void factor(DetState *s, const Matrix *m) {
+    int n = m->rows;
+    double *M = mat_alloc((size_t)n * n);
+    double *I = mat_alloc_zeroed((size_t)n * n);
+    memcpy(M, m->data, (size_t)n * n * sizeof(double));
+    for (int i = 0; i < n; i++) I[(size_t)i * n + i] = 1.0;
+
+    double det = 1.0;
+    int r = 0;                          // next pivot row, r < k once a column had no pivot
+    for (int k = 0; k < n; k++) {
+        // find the pivot row
+        int piv = r;
+        double maxv = dabs(M[(size_t)r * n + k]);
+        for (int i = r + 1; i < n; i++) {
+            double v = dabs(M[(size_t)i * n + k]);
+            if (v > maxv) { maxv = v; piv = i; }
+        }
+        if (maxv < 1e-12) {             // singular, same cutoff as op_det_single; keep going for the rank
+            continue;
+        }
+        if (piv != r) {                 // swap rows r and piv in both halves
+            for (int j = 0; j < n; j++) {
+                double t = M[(size_t)r * n + j]; M[(size_t)r * n + j] = M[(size_t)piv * n + j]; M[(size_t)piv * n + j] = t;
+                t = I[(size_t)r * n + j]; I[(size_t)r * n + j] = I[(size_t)piv * n + j]; I[(size_t)piv * n + j] = t;
+            }
+            det = -det;
+        }
+        double pivot = M[(size_t)r * n + k];
+        det *= pivot;
+        // scale the pivot row to 1
+        for (int j = 0; j < n; j++) {
+            M[(size_t)r * n + j] /= pivot;
+            I[(size_t)r * n + j] /= pivot;
+        }
+        // eliminate column k from every other row
+        int T = pass_threads(n, 2);
+#pragma omp parallel for num_threads(T) if(T > 1) schedule(static)
+        for (int i = 0; i < n; i++) {
+            if (i == r) continue;
+            double f = M[(size_t)i * n + k];
+            if (f == 0.0) continue;
+            for (int j = 0; j < n; j++) {
+                M[(size_t)i * n + j] -= f * M[(size_t)r * n + j];
+                I[(size_t)i * n + j] -= f * I[(size_t)r * n + j];
+            }
+        }
+        r++;
+    }
+    mat_free(M);
+    s->nullity = n - r;
+    if (r < n) {
+        mat_free(I);
+        s->inv = NULL;
+        s->det = 0.0;
+        return;
+    }
+    s->inv = I;
+    s->det = det;
+}
+
+// Builds (or rebuilds) the state of a square matrix. Returns 1 if it did
+// (the determinant is then in m->det_state->det), 0 if the matrix gets none.
+int det_state_factor(Matrix *m) {
+    if (m->rows != m->cols || m->rows > DET_MAX_N) return 0;
+    DetState *s = m->det_state;
+    if (s == NULL) {
+        s = (DetState*)xmalloc(sizeof(DetState));
+        memset(s, 0, sizeof(*s));
+        m->det_state = s;
+    }
+    mat_free(s->inv);
+    s->n = m->rows;
+    factor(s, m);
+    s->version = m->version;
+    s->updates = 0;
+    s->pending = 0;
+    return 1;
+}
+
+void det_state_seed(Matrix *m, double det) {
+    if (m->rows != m->cols || m->rows > DET_MAX_N) return;
+    det_state_free(m->det_state);
+    DetState *s = (DetState*)xmalloc(sizeof(DetState));
+    memset(s, 0, sizeof(*s));
+    s->n = m->rows;
+    s->det = det;
+    s->version = m->version;
+    s->pending = 1;
+    m->det_state = s;
+}
+
+int det_state_lookup(const Matrix *m, double *det, int *updates) {
+    const DetState *s = m->det_state;
+    if (s == NULL || s->version != m->version) return 0;
+    *det = s->det;
+    if (updates) *updates = s->updates;
+    return 1;
+}
+
+// Drops the state when it can't follow the edit (stale, singular, unstable).
+static void drop(Matrix *m) {
+    det_state_free(m->det_state);
+    m->det_state = NULL;
+}
+
+// Checks that the state can take a rank-1 update, refactors when it is due.
+// Returns the state to update, or NULL if it was rebuilt/dropped instead.
+static DetState *updatable(Matrix *m, uint64_t from_version) {
+    DetState *s = m->det_state;
+    if (s == NULL) return NULL;
+    if (s->version != from_version) {        // missed an edit, can't be trusted
+        drop(m);
+        return NULL;
+    }
+    if (s->pending || s->updates >= DET_MAX_UPDATES) {
+        det_state_factor(m);                 // no inverse yet, or too much drift
+        return NULL;
+    }
+    if (s->inv == NULL) {                    // singular: a rank-1 edit lowers the rank deficiency by at most one
+        if (s->nullity > 1) {
+            s->nullity--;                    // still singular, det stays 0
+            s->updates++;
+            s->version = m->version;
+        } else {
+            det_state_factor(m);             // may have become invertible
+        }
+        return NULL;
+    }
+    return s;
+}
+
+// Row i changed: A' = A + e_i d^T with d = new_row - old_row.
+//   w = d^T A^-1, alpha = 1 + w_i, det' = det * alpha,
+//   A'^-1 = A^-1 - (A^-1 e_i) w^T / alpha
+void det_state_row_changed(Matrix *m, uint64_t from_version, int i, const double *old_row) {
+    DetState *s = updatable(m, from_version);
+    if (s == NULL) return;
+    int n = s->n;
+    double *inv = s->inv;
+    int T = pass_threads(n, 1);
+    double *d = mat_alloc((size_t)n);
+    double *w = mat_alloc_zeroed((size_t)n);
+    for (int l = 0; l < n; l++) d[l] = matrix_get(m, i, l) - old_row[l];
+
+    for (int l = 0; l < n; l++) {
+        if (d[l] == 0.0) continue;           // single-cell edits touch one row of inv only
+        const double *row = &inv[(size_t)l * n];
+        for (int k = 0; k < n; k++) w[k] += d[l] * row[k];
+    }
+    double alpha = 1.0 + w[i];
+    if (dabs(alpha) < DET_MIN_ALPHA) {       // new matrix (nearly) singular
+        mat_free(d); mat_free(w);
+        det_state_factor(m);
+        return;
+    }
+#pragma omp parallel for num_threads(T) if(T > 1) schedule(static)
+    for (int r = 0; r < n; r++) {
+        double f = inv[(size_t)r * n + i] / alpha;
+        if (f == 0.0) continue;
+        for (int k = 0; k < n; k++) inv[(size_t)r * n + k] -= f * w[k];
+    }
+    s->det *= alpha;
+    s->updates++;
+    s->version = m->version;
+    mat_free(d); mat_free(w);
+}
+
+// Column j changed: A' = A + c e_j^T with c = new_col - old_col.
+//   z = A^-1 c, alpha = 1 + z_j, det' = det * alpha,
+//   A'^-1 = A^-1 - z (e_j^T A^-1) / alpha
+void det_state_col_changed(Matrix *m, uint64_t from_version, int j, const double *old_col) {
+    DetState *s = updatable(m, from_version);
+    if (s == NULL) return;
+    int n = s->n;
+    double *inv = s->inv;
+    int T = pass_threads(n, 1);
+    double *c = mat_alloc((size_t)n);
+    double *z = mat_alloc((size_t)n);
+    double *rowj = mat_alloc((size_t)n);
+    for (int l = 0; l < n; l++) c[l] = matrix_get(m, l, j) - old_col[l];
+
+#pragma omp parallel for num_threads(T) if(T > 1) schedule(static)
+    for (int r = 0; r < n; r++) {
+        double acc = 0.0;
+        const double *row = &inv[(size_t)r * n];
+        for (int l = 0; l < n; l++) acc += row[l] * c[l];
+        z[r] = acc;
+    }
+    double alpha = 1.0 + z[j];
+    if (dabs(alpha) < DET_MIN_ALPHA) {
+        mat_free(c); mat_free(z); mat_free(rowj);
+        det_state_factor(m);
+        return;
+    }
+    memcpy(rowj, &inv[(size_t)j * n], (size_t)n * sizeof(double));   // row j is overwritten below
+#pragma omp parallel for num_threads(T) if(T > 1) schedule(static)
+    for (int r = 0; r < n; r++) {
+        double f = z[r] / alpha;
+        if (f == 0.0) continue;
+        for (int k = 0; k < n; k++) inv[(size_t)r * n + k] -= f * rowj[k];
+    }
+    s->det *= alpha;
+    s->updates++;
+    s->version = m->version;
+    mat_free(c); mat_free(z); mat_free(rowj);
+}
@@ -1,7 +1,29 @@
+#define _GNU_SOURCE  // madvise, MADV_SEQUENTIAL
+
 #include "common.h" 
 #include "file_io.h"
+#include "mat_alloc.h"
+#include "container.h"
+#include "timer.h"
+#include "aio.h"
+#include "npy.h"
+#include <limits.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/mman.h>
+#ifdef HAVE_OMP
+#include <omp.h>
+#endif
+
+#define PARALLEL_PARSE_MIN (4u << 20)   // bodies smaller than 4MB are parsed on one thread
+#define MAX_PARSE_CHUNKS   256
+#define LOAD_BATCH         64          // files parsed per thread before the batch is inserted
+#define LOAD_BATCH_BYTES   (64u << 20) // a batch stops growing past this many bytes of file data (two in RAM)
+#define LOAD_QUEUE_MAX     (16u << 20) // bigger text files are mapped at parse time, not read into a buffer
+#define SHAPE_HEAD         4096        // bytes read per file when only the shape is needed
+#define WRITE_INFLIGHT_MAX (64u << 20)  // formatted bytes queued for writing before the formatter waits
+#define WRITE_BLOCK        (1u << 16)  // elements formatted per block by the text writer
+#define MAX_NUM_CHARS      26          // longest number format_double writes ("-1.2345678901234567e-308")
 
 // Checks whether the given string `s` ends with the suffix `suf`, which suf is .txt |.mtx.
 // Returns 1 if the suffix matches the end of the string, otherwise 0.
@@ -14,24 +36,674 @@ static int has_suffix(const char *s, const char *suf) {
     return strcmp(s + (n-m), suf) == 0;
 }
 
+// Character classes for the tokenizer: 1 = whitespace (same set as isspace in the C locale)
+static unsigned char g_space[256];
+
+static void init_space_table(void) {
+    if (g_space[' ']) return;
+    g_space[' '] = g_space['\t'] = g_space['\n'] = g_space['\r'] = g_space['\v'] = g_space['\f'] = 1;
+}
+
+// Exact powers of ten representable as doubles (Clinger's fast path limit)
+static const double g_pow10[23] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+// Skips whitespace, returns the first non-space byte (or end).
+static inline const char *skip_space(const char *p, const char *end) {
+    while (p < end && g_space[(unsigned char)*p]) p++;
+    return p;
+}
+
+// Slow path: copies the token and lets strtod handle it (hex floats, inf, nan,
+// more than 19 digits, exponents outside the exact range, ...).
+// Returns the end of the token, or NULL if it isn't a number.
+static const char *parse_double_slow(const char *p, const char *end, double *out) {
+    char tok[128];
+    size_t n = 0;
+    while (p + n < end && !g_space[(unsigned char)p[n]]) {
+        if (n + 1 >= sizeof(tok)) return NULL;   // absurdly long token
+        tok[n] = p[n];
+        n++;
+    }
+    tok[n] = '\0';
+    char *e = NULL;
+    *out = strtod(tok, &e);
+    if (n == 0 || e != tok + n) return NULL;      // not (only) a number
+    return p + n;
+}
+
+// Parses one double starting at p. Plain integers and decimals with up to 19
+// significant digits and a small exponent are converted exactly with one
+// multiply/divide by a power of ten; everything else goes to strtod.
+// Returns the end of the token, or NULL if it isn't a number.
+static const char *parse_double(const char *p, const char *end, double *out) {
+    const char *s = p;
+    int neg = 0;
+    if (p < end && (*p == '-' || *p == '+')) { neg = (*p == '-'); p++; }
+
+    uint64_t mant = 0;
+    int ndig = 0, exp10 = 0;
+    while (p < end && (unsigned)(*p - '0') < 10) { mant = mant * 10 + (uint64_t)(*p - '0'); ndig++; p++; }
+    if (p < end && *p == '.') {
+        p++;
+        while (p < end && (unsigned)(*p - '0') < 10) { mant = mant * 10 + (uint64_t)(*p - '0'); ndig++; exp10--; p++; }
+    }
+    if (ndig == 0 || ndig > 19) return parse_double_slow(s, end, out);
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        p++;
+        int eneg = 0, e = 0, edig = 0;
+        if (p < end && (*p == '-' || *p == '+')) { eneg = (*p == '-'); p++; }
+        while (p < end && (unsigned)(*p - '0') < 10 && e < 10000) { e = e * 10 + (*p - '0'); edig++; p++; }
+        if (edig == 0) return parse_double_slow(s, end, out);
+        exp10 += eneg ? -e : e;
+    }
+    if (p < end && !g_space[(unsigned char)*p]) return parse_double_slow(s, end, out);   // odd suffix
+    if (mant > (1ull << 53) || exp10 < -22 || exp10 > 22) return parse_double_slow(s, end, out);
+
+    double v = (double)mant;   // exact, mant <= 2^53
+    if (exp10 < 0) v /= g_pow10[-exp10];
+    else           v *= g_pow10[exp10];
+    *out = neg ? -v : v;
+    return p;
+}
+
+// Converts a byte offset into a 1-based line and column for error messages.
+static void offset_to_line_col(const char *buf, const char *at, int *line, int *col) {
+    *line = 1;
+    const char *ls = buf;
+    for (const char *q = buf; q < at; q++) {
+        if (*q == '\n') { (*line)++; ls = q + 1; }
+    }
+    *col = (int)(at - ls) + 1;
+}
+
+// Counts whitespace-separated tokens in [p, end).
+static size_t count_tokens(const char *p, const char *end) {
+    size_t n = 0;
+    int in_tok = 0;
+    for (; p < end; p++) {
+        int sp = g_space[(unsigned char)*p];
+        n += (!sp & !in_tok);   // space -> token transition
+        in_tok = !sp;
+    }
+    return n;
+}
+
+// Parses up to `want` numbers from [p, end) into d. Returns how many were parsed,
+// stops early at the first malformed token.
+static size_t parse_range(const char *p, const char *end, double *d, size_t want) {
+    size_t k = 0;
+    while (k < want) {
+        p = skip_space(p, end);
+        if (p >= end) break;
+        const char *q = parse_double(p, end, &d[k]);
+        if (q == NULL) break;
+        p = q;
+        k++;
+    }
+    return k;
+}
+
+// Parallel body parse for big files: the body is cut into one byte range per
+// thread, each starting at a line boundary (or at least at whitespace, so no
+// token is split). A counting pass gives each range its token count, a prefix
+// sum turns those into element offsets, then every range is parsed straight
+// into its slice of the matrix data.
+// Returns 0 when all `total` values were filled, -1 if anything went wrong
+// (the caller then reruns the serial parser, which reports the exact error).
+static int parse_body_parallel(const char *p, const char *end, double *d, size_t total, int nthreads) {
+#ifdef HAVE_OMP
+    int T = nthreads;
+    if (T > MAX_PARSE_CHUNKS) T = MAX_PARSE_CHUNKS;
+    const char *start[MAX_PARSE_CHUNKS + 1];
+    size_t count[MAX_PARSE_CHUNKS], off[MAX_PARSE_CHUNKS + 1];
+    size_t len = (size_t)(end - p);
+
+    // chunk boundaries, moved forward to the next line start
+    start[0] = p;
+    for (int t = 1; t < T; t++) {
+        const char *b = p + len * (size_t)t / (size_t)T;
+        if (b < start[t - 1]) b = start[t - 1];
+        const char *nl = memchr(b, '\n', (size_t)(end - b));
+        if (nl != NULL) {
+            b = nl + 1;
+        } else {
+            while (b < end && !g_space[(unsigned char)*b]) b++;   // one huge line: any whitespace
+        }
+        start[t] = b;
+    }
+    start[T] = end;
+
+    // pass 1: token count per chunk
+#pragma omp parallel for num_threads(T) schedule(static)
+    for (int t = 0; t < T; t++) count[t] = count_tokens(start[t], start[t + 1]);
+
+    off[0] = 0;
+    for (int t = 0; t < T; t++) off[t + 1] = off[t] + count[t];
+    if (off[T] < total) return -1;   // not enough values
+
+    // pass 2: parse each chunk into its slice
+    int failed = 0;
+#pragma omp parallel for num_threads(T) schedule(static) reduction(|:failed)
+    for (int t = 0; t < T; t++) {
+        if (off[t] >= total) continue;   // trailing extra values are ignored, like the serial parser
+        size_t want = count[t];
+        if (off[t] + want > total) want = total - off[t];
+        if (parse_range(start[t], start[t + 1], d + off[t], want) != want) failed = 1;
+    }
+    return failed ? -1 : 0;
+#else
+    (void)p; (void)end; (void)d; (void)total; (void)nthreads;
+    return -1;
+#endif
+}
+
+// Parses the "<rows> <cols>" header. Returns the position after it, or NULL.
+static const char *parse_header(const char *p, const char *end, const char *path, int *rows, int *cols) {
+    double hdr[2];
+    for (int k = 0; k < 2; k++) {   // header: two integers
+        p = skip_space(p, end);
+        const char *q = (p < end) ? parse_double(p, end, &hdr[k]) : NULL;
+        // range first: casting a NaN or a value past INT_MAX to int is undefined
+        if (q == NULL || !isfinite(hdr[k]) || hdr[k] < 0 || hdr[k] > INT_MAX || hdr[k] != (double)(int)hdr[k]) {
+            fprintf(stderr, "Invalid matrix header in %s\n", path);
+            return NULL;
+        }
+        p = q;
+    }
+    *rows = (int)hdr[0];
+    *cols = (int)hdr[1];
+    return p;
+}
+
+// Parses "<rows> <cols>" and rows*cols numbers from a text buffer into a new matrix.
+// `path` is only used in error messages. Returns 0 on success, -1 on error.
+static int parse_matrix_text(const char *buf, size_t len, const char *path, const char *name, Matrix **out) {
+    init_space_table();
+    const char *p, *end = buf + len;
+    int rows, cols;
+    if ((p = parse_header(buf, end, path, &rows, &cols)) == NULL) {
+        return -1;
+    }
+
+    Matrix *m = matrix_create(name, rows, cols);  // Allocate matrix with metadata
+    size_t total = (size_t)rows * (size_t)cols;
+    double *d = m->data;
+
+#ifdef HAVE_OMP
+    // big body and OpenMP on: parse chunks on all threads
+    if (g_omp_enabled && !omp_in_parallel() && (size_t)(end - p) >= PARALLEL_PARSE_MIN && omp_get_max_threads() > 1 &&
+        parse_body_parallel(p, end, d, total, omp_get_max_threads()) == 0) {
+        *out = m;
+        return 0;
+    }
+#endif
+    for (size_t k = 0; k < total; k++) {
+        p = skip_space(p, end);
+        const char *q = (p < end) ? parse_double(p, end, &d[k]) : NULL;
+        if (q == NULL) {           // missing or malformed value
+            int line, col;
+            offset_to_line_col(buf, p, &line, &col);
+            fprintf(stderr, "Invalid data in %s at (%d,%d), line %d col %d\n",
+                    path, (int)(k / (size_t)cols), (int)(k % (size_t)cols), line, col);
+            matrix_free(m);
+            return -1;
+        }
+        p = q;
+    }
+    *out = m;
+    return 0;
+}
+
+// Maps a whole file into memory (read-only). Falls back to reading it into a
+// heap buffer when mmap isn't possible (empty file, pipe, ...).
+// *mapped tells the caller whether to munmap or free the buffer.
+static int load_file(const char *path, char **buf, size_t *len, int *mapped) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror("fopen");
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void *p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p != MAP_FAILED) {
+            madvise(p, (size_t)st.st_size, MADV_SEQUENTIAL);
+            close(fd);
+            *buf = (char*)p;
+            *len = (size_t)st.st_size;
+            *mapped = 1;
+            return 0;
+        }
+    }
+    // read() loop in large blocks
+    size_t cap = 1 << 20, n = 0;
+    char *b = (char*)xmalloc(cap);
+    for (;;) {
+        if (n == cap) {
+            cap *= 2;
+            b = realloc(b, cap);
+            if (!b) die("realloc");
+        }
+        ssize_t r = read(fd, b + n, cap - n);
+        if (r < 0) {
+            if (errno == EINTR) continue;
+            perror("read");
+            free(b);
+            close(fd);
+            return -1;
+        }
+        if (r == 0) break;
+        n += (size_t)r;
+    }
+    close(fd);
+    *buf = b;
+    *len = n;
+    *mapped = 0;
+    return 0;
+}
+
+static void unload_file(char *buf, size_t len, int mapped) {
+    if (mapped) munmap(buf, len);
+    else free(buf);
+}
+
+int g_bin_verify = 0;
+
+// 64-bit FNV-1a over 8-byte words of the payload.
+uint64_t matrix_checksum(const double *d, size_t n) {
+    return matrix_checksum_continue(0xcbf29ce484222325ull, d, n);
+}
+
+// Continues a checksum over the next n values, for data that is hashed in chunks.
+uint64_t matrix_checksum_continue(uint64_t h, const double *d, size_t n) {
+    const uint64_t *w = (const uint64_t*)d;
+    for (size_t k = 0; k < n; k++) {
+        h ^= w[k];
+        h *= 0x100000001b3ull;
+    }
+    return h;
+}
+
+// Checks a .mbin header against the file behind fd. On success *need is the
+// file size the header asks for (header + rows*ld doubles). Returns 0 or -1
+// (after a message).
+static int check_bin_header(int fd, const MatBinHeader *h, const char *path, size_t *need) {
+    if (h->version != MATBIN_VERSION || h->dtype != MATBIN_F64 || h->ld < h->cols ||
+        h->rows > INT32_MAX || h->cols > INT32_MAX || h->ld > INT32_MAX) {
+        fprintf(stderr, "Unsupported binary matrix header in %s\n", path);
+        return -1;
+    }
+    size_t count = (size_t)h->rows * (size_t)h->ld;   // < 2^62, can't wrap
+    if (count > (SIZE_MAX - sizeof(MatBinHeader)) / sizeof(double)) {
+        fprintf(stderr, "Unsupported binary matrix header in %s\n", path);
+        return -1;
+    }
+    *need = sizeof(MatBinHeader) + count * sizeof(double);
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (uint64_t)st.st_size < (uint64_t)*need) {
+        fprintf(stderr, "Truncated binary matrix %s\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+// Loads a .mbin file whose header was already read from fd.
+// Tightly packed files (ld == cols) are mapped privately and used in place;
+// padded ones are copied row by row. Returns 0 on success, -1 on error.
+static int read_matrix_bin(int fd, const MatBinHeader *h, const char *path, const char *name, Matrix **out) {
+    size_t need;
+    if (check_bin_header(fd, h, path, &need) != 0) {
+        return -1;
+    }
+    int rows = (int)h->rows, cols = (int)h->cols;
+    size_t count = (size_t)h->rows * (size_t)h->ld;
+
+    if (h->ld == h->cols && count > 0) {
+        // zero-copy: private writable mapping, pages are copied on first write only
+        void *base = mmap(NULL, need, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        if (base != MAP_FAILED) {
+            double *data = (double*)((char*)base + sizeof(MatBinHeader));
+            if (g_bin_verify && matrix_checksum(data, count) != h->checksum) {
+                fprintf(stderr, "Checksum mismatch in %s\n", path);
+                munmap(base, need);
+                return -1;
+            }
+            *out = matrix_create_mapped(name, rows, cols, data, base, need);
+            return 0;
+        }
+    }
+
+    // copy path: read the padded rows and keep the first cols values of each
+    double *buf = mat_alloc(count);
+    if (pread(fd, buf, count * sizeof(double), sizeof(MatBinHeader)) != (ssize_t)(count * sizeof(double))) {
+        perror("read");
+        mat_free(buf);
+        return -1;
+    }
+    if (matrix_checksum(buf, count) != h->checksum) {
+        fprintf(stderr, "Checksum mismatch in %s\n", path);
+        mat_free(buf);
+        return -1;
+    }
+    Matrix *m = matrix_create(name, rows, cols);
+    for (int i = 0; i < rows; i++) {
+        memcpy(&m->data[(size_t)i * cols], &buf[(size_t)i * h->ld], (size_t)cols * sizeof(double));
+    }
+    mat_free(buf);
+    *out = m;
+    return 0;
+}
+
+// Writes a matrix in the .mbin format (ld = cols).
+static int write_matrix_bin(const char *path, const Matrix *m) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0) {
+        perror("fopen");
+        return -1;
+    }
+    size_t count = (size_t)m->rows * m->cols;
+    MatBinHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, MATBIN_MAGIC, sizeof(h.magic));
+    h.version = MATBIN_VERSION;
+    h.dtype = MATBIN_F64;
+    h.rows = (uint64_t)m->rows;
+    h.cols = (uint64_t)m->cols;
+    h.ld = (uint64_t)m->cols;
+    h.checksum = matrix_checksum(m->data, count);
+    if (write_all(fd, &h, sizeof(h)) != (ssize_t)sizeof(h) ||
+        write_all(fd, m->data, count * sizeof(double)) != (ssize_t)(count * sizeof(double))) {
+        perror("write");
+        close(fd);
+        return -1;
+    }
+    close(fd);
+    return 0;
+}
+
+// Writes the decimal digits of u (no sign). Returns the length.
+static int format_u64(char *out, uint64_t u) {
+    char tmp[20];
+    int n = 0;
+    do { tmp[n++] = (char)('0' + u % 10); u /= 10; } while (u);
+    for (int k = 0; k < n; k++) out[k] = tmp[n - 1 - k];
+    return n;
+}
+
+// Lays out significant digits dig[0..nd) with decimal exponent e (value is
+// d.ddd * 10^e) like %g: plain for -5 <= e < 17, scientific otherwise.
+static int layout_digits(char *out, int neg, const char *dig, int nd, int e) {
+    char *o = out;
+    if (neg) *o++ = '-';
+    if (e >= -5 && e < 17) {
+        if (e < 0) {                 // 0.000ddd
+            *o++ = '0';
+            *o++ = '.';
+            for (int k = -1; k > e; k--) *o++ = '0';
+            memcpy(o, dig, (size_t)nd);
+            o += nd;
+        } else {                     // ddd000 or ddd.ddd
+            for (int k = 0; k <= e; k++) *o++ = k < nd ? dig[k] : '0';
+            if (nd > e + 1) {
+                *o++ = '.';
+                memcpy(o, dig + e + 1, (size_t)(nd - e - 1));
+                o += nd - e - 1;
+            }
+        }
+    } else {
+        *o++ = dig[0];
+        if (nd > 1) {
+            *o++ = '.';
+            memcpy(o, dig + 1, (size_t)(nd - 1));
+            o += nd - 1;
+        }
+        o += sprintf(o, "e%+03d", e);
+    }
+    return (int)(o - out);
+}
+
+// Writes v with the fewest digits that read back to the same double.
+// Integers and short decimals are found directly: t = |v| * 10^d is tried
+// for growing d until t is an integer below 2^53 with t / 10^d == |v|, which is
+// exactly how parse_double reads "t with d decimals" back. Other values get
+// 17 correctly rounded digits from one snprintf, and the 15 and 16 digit
+// roundings of those are kept if strtod reads them back to v. Returns the length.
+static int format_double(char *out, double v) {
+    char dig[32];
+    int neg = signbit(v) != 0;
+    double a = fabs(v);
+    if (a == 0.0) {
+        return layout_digits(out, neg, "0", 1, 0);
+    }
+    if (!isfinite(a)) {
+        return snprintf(out, MAX_NUM_CHARS + 1, "%g", v);
+    }
+    if (a < 9007199254740992.0 && a >= 1e-5) {
+        for (int d = 0; d <= 22; d++) {
+            double t = a * g_pow10[d];
+            if (t >= 9007199254740992.0) break;
+            if (t != floor(t) || t / g_pow10[d] != a) continue;
+            int nd = format_u64(dig, (uint64_t)t);
+            int e = nd - 1 - d;
+            while (nd > 1 && dig[nd - 1] == '0') nd--;    // 1090 * 10^-3 -> 1.09
+            return layout_digits(out, neg, dig, nd, e);
+        }
+    }
+    // "d.dddddddddddddddde+XX": 17 significant digits
+    char sci[32];
+    snprintf(sci, sizeof(sci), "%.16e", a);
+    dig[0] = sci[0];
+    memcpy(dig + 1, sci + 2, 16);
+    int e = atoi(sci + 19);
+    int nd = 17;
+    for (int k = 15; k <= 16; k++) {
+        char cand[32], tmp[40];
+        memcpy(cand, dig, (size_t)k);
+        int ce = e;
+        if (dig[k] >= '5') {                  // round up, carrying through nines
+            int j = k - 1;
+            while (j >= 0 && cand[j] == '9') cand[j--] = '0';
+            if (j >= 0) cand[j]++;
+            else { memmove(cand + 1, cand, (size_t)k - 1); cand[0] = '1'; ce++; }
+        }
+        int n = k;
+        while (n > 1 && cand[n - 1] == '0') n--;
+        snprintf(tmp, sizeof(tmp), "%c.%.*se%d", cand[0], n - 1, cand + 1, ce);
+        if (strtod(tmp, NULL) == a) {
+            memcpy(dig, cand, (size_t)n);
+            nd = n;
+            e = ce;
+            break;
+        }
+    }
+    while (nd > 1 && dig[nd - 1] == '0') nd--;
+    return layout_digits(out, neg, dig, nd, e);
+}
+
+// Formats rows [r0, r1) into buf, one text line per row. Returns the length.
+static size_t format_rows(const Matrix *m, int r0, int r1, char *buf) {
+    char *o = buf;
+    for (int i = r0; i < r1; i++) {
+        const double *row = m->data + (size_t)i * m->cols;
+        for (int j = 0; j < m->cols; j++) {
+            o += format_double(o, row[j]);
+            // Add a space between values, but not after the last column
+            *o++ = (j + 1 < m->cols) ? ' ' : '\n';
+        }
+        if (m->cols == 0) *o++ = '\n';
+    }
+    return (size_t)(o - buf);
+}
+
+// Text files being written through the I/O queue. Each block of formatted
+// text is one write request that owns its buffer; a file is closed and
+// renamed over its target when its last block is on disk.
+typedef struct {
+    int fd;
+    int pending;            // writes in flight
+    int formatted;          // all blocks queued
+    int failed;
+    char path[512];
+    char tmp[600];
+} OutFile;
+
+typedef struct {
+    AioCtx *io;
+    OutFile *files;
+    int nfiles, cap;
+    size_t queued;          // bytes in flight
+    int failures;
+} TextWriter;
+
+// A queued block, passed as the request tag
+typedef struct {
+    char *buf;
+    size_t len;
+    int file;
+} WriteJob;
+
+static void writer_init(TextWriter *w) {
+    memset(w, 0, sizeof(*w));
+    w->io = aio_create(AIO_DEPTH, g_aio_uring);
+    if (w->io == NULL) die("aio_create");
+}
+
+// Closes a finished file and moves it into place (or drops it if a write failed).
+static void writer_close_file(TextWriter *w, OutFile *f) {
+    if (close(f->fd) != 0) f->failed = 1;
+    f->fd = -1;
+    if (!f->failed && rename(f->tmp, f->path) != 0) {
+        perror("rename");
+        f->failed = 1;
+    }
+    if (f->failed) {
+        fprintf(stderr, "Failed to write %s\n", f->path);
+        unlink(f->tmp);
+        w->failures++;
+    }
+}
+
+// Waits for one write and releases its buffer.
+static void writer_reap(TextWriter *w) {
+    uint64_t tag;
+    ssize_t res;
+    if (aio_wait(w->io, &tag, &res) != 0) return;
+    WriteJob *job = (WriteJob*)(uintptr_t)tag;
+    OutFile *f = &w->files[job->file];
+    if (res != (ssize_t)job->len) f->failed = 1;
+    w->queued -= job->len;
+    free(job->buf);
+    free(job);
+    if (--f->pending == 0 && f->formatted) writer_close_file(w, f);
+}
+
+// Opens <path>.tmp for a new file. Returns its index or -1.
+static int writer_open(TextWriter *w, const char *path) {
+    if (w->nfiles == w->cap) {
+        w->cap = w->cap ? w->cap * 2 : 16;
+        w->files = (OutFile*)realloc(w->files, (size_t)w->cap * sizeof(OutFile));
+        if (w->files == NULL) die("realloc");
+    }
+    OutFile *f = &w->files[w->nfiles];
+    memset(f, 0, sizeof(*f));
+    snprintf(f->path, sizeof(f->path), "%s", path);
+    snprintf(f->tmp, sizeof(f->tmp), "%s.tmp", path);
+    f->fd = open(f->tmp, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (f->fd < 0) {
+        perror("open");
+        w->failures++;
+        return -1;
+    }
+    return w->nfiles++;
+}
+
+// Queues buf (ownership moves to the writer) at offset off of a file.
+static void writer_queue(TextWriter *w, int file, char *buf, size_t len, off_t off) {
+    while (aio_inflight(w->io) == aio_depth(w->io) ||
+           (w->queued > WRITE_INFLIGHT_MAX && aio_inflight(w->io) > 0)) {
+        writer_reap(w);
+    }
+    WriteJob *job = (WriteJob*)xmalloc(sizeof(WriteJob));
+    job->buf = buf;
+    job->len = len;
+    job->file = file;
+    w->files[file].pending++;
+    w->queued += len;
+    aio_write(w->io, w->files[file].fd, buf, len, off, (uint64_t)(uintptr_t)job);
+}
+
+// Marks a file complete; it is closed once its writes are done.
+static void writer_done(TextWriter *w, int file) {
+    OutFile *f = &w->files[file];
+    f->formatted = 1;
+    if (f->pending == 0) writer_close_file(w, f);
+}
+
+// Waits for all writes. Returns the number of files that failed.
+static int writer_finish(TextWriter *w) {
+    while (aio_inflight(w->io) > 0) writer_reap(w);
+    aio_destroy(w->io);
+    free(w->files);
+    return w->failures;
+}
+
+// Formats a matrix in the text format and queues it as file `path`: rows are
+// formatted in blocks (in parallel when OpenMP is on and the matrix is big);
+// a round of blocks is formatted while the previous one is being written.
+static void queue_matrix_text(TextWriter *w, const char *path, const Matrix *m) {
+    int file = writer_open(w, path);
+    if (file < 0) return;
+    char *head = (char*)xmalloc(32);
+    int hn = snprintf(head, 32, "%d %d\n", m->rows, m->cols);
+    off_t off = 0;
+    writer_queue(w, file, head, (size_t)hn, off);
+    off += hn;
+
+    int block_rows = m->cols > 0 ? (int)(WRITE_BLOCK / (unsigned)m->cols) : m->rows;
+    if (block_rows < 1) block_rows = 1;
+    int nblocks = m->rows > 0 ? (m->rows + block_rows - 1) / block_rows : 0;
+    int threads = 1;
+#ifdef HAVE_OMP
+    if (g_omp_enabled && nblocks > 1) {
+        threads = omp_get_max_threads();
+        if (threads > nblocks) threads = nblocks;
+    }
+#endif
+    size_t cap = (size_t)block_rows * ((size_t)m->cols * (MAX_NUM_CHARS + 1) + 1);
+    char **bufs = (char**)xmalloc((size_t)threads * sizeof(char*));
+    size_t *lens = (size_t*)xmalloc((size_t)threads * sizeof(size_t));
+
+    // one block per thread per round, then the round is queued in order
+    for (int b0 = 0; b0 < nblocks; b0 += threads) {
+        int nb = nblocks - b0 < threads ? nblocks - b0 : threads;
+        for (int t = 0; t < nb; t++) bufs[t] = (char*)xmalloc(cap);
+        #pragma omp parallel for num_threads(threads) schedule(static, 1) if(threads > 1)
+        for (int t = 0; t < nb; t++) {
+            int r0 = (b0 + t) * block_rows;
+            int r1 = r0 + block_rows < m->rows ? r0 + block_rows : m->rows;
+            lens[t] = format_rows(m, r0, r1, bufs[t]);
+        }
+        for (int t = 0; t < nb; t++) {
+            writer_queue(w, file, bufs[t], lens[t], off);
+            off += (off_t)lens[t];
+        }
+    }
+    free(bufs);
+    free(lens);
+    writer_done(w, file);
+}
+
 // Loads a matrix from a text file and returns it through `out`.
 // The file format should start with: <rows> <cols>, then rows*cols numbers.
 // If `name_override` is provided, it becomes the matrix name; otherwise
 // we derive the name from the filename. Returns 0 on success, -1 on error.
+// The file is mapped in one piece and parsed by parse_matrix_text (no stdio per number).
+// Files starting with the .mbin magic are loaded as binary, whatever their extension.
 int read_matrix_file(const char *path, const char *name_override, Matrix **out) {
 
-    FILE *f = fopen(path, "r"); // Try to open the matrix file
-    if (!f) { 
-      perror("fopen");   // print error if file couldn't be opened
-      return -1; 
-      }     
-    int rows = 0, cols = 0;
-    // Read matrix dimensions (rows and columns)
-    if (fscanf(f, "%d %d", &rows, &cols) != 2) {  // Ensure both values were read
-        fprintf(stderr, "Invalid matrix header in %s\n", path);
-        fclose(f);
-        return -1;
-    }
     char name[MAX_NAME] = {0};
     // Use provided name if available, otherwise derive from the filename
     if (name_override && *name_override) {
@@ -52,105 +724,542 @@ int read_matrix_file(const char *path, const char *name_override, Matrix **out)
             *dot = 0;
         }
     }
-    Matrix *m = matrix_create(name, rows, cols);  // Allocate matrix with metadata
-    // Read matrix values one by one
-    for (int i = 0; i < rows; i++) {    // Loop through rows
-        for (int j = 0; j < cols; j++) {    // Loop through columns
-            double v;
-
-            if (fscanf(f, "%lf", &v) != 1) {// Ensure valid numeric value
-                fprintf(stderr, "Invalid data in %s at (%d,%d)\n", path, i, j);
-                matrix_free(m);  // Free allocated matrix on error
-                fclose(f);
-                return -1;
-            }
 
-            matrix_set(m, i, j, v); // Store the value in matrix cell
+    // binary file (.mbin or .npy)? check the magic first
+    int fd = open(path, O_RDONLY);
+    if (fd >= 0) {
+        MatBinHeader h;
+        ssize_t n = pread(fd, &h, sizeof(h), 0);
+        if (n == (ssize_t)sizeof(h) && memcmp(h.magic, MATBIN_MAGIC, sizeof(h.magic)) == 0) {
+            int rc = read_matrix_bin(fd, &h, path, name, out);
+            close(fd);
+            return rc;
         }
+        if (n > 0 && is_npy_data(&h, (size_t)n)) {
+            int rc = npy_read(fd, path, name, out);
+            close(fd);
+            return rc;
+        }
+        close(fd);
     }
 
-    fclose(f);  // Close file
-    *out = m;  // Output the loaded matrix
-    return 0; // Success
+    char *buf;
+    size_t len;
+    int mapped;
+    if (load_file(path, &buf, &len, &mapped) != 0) {
+        return -1;
+    }
+    int rc = parse_matrix_text(buf, len, path, name, out);
+    unload_file(buf, len, mapped);
+    return rc;
 }
     
 // Writes a matrix to a text file at the given path or in the same dir in a new file
 // The file format is: <rows> <cols> on the first line,
-// followed by the matrix values row by row.
-// Returns 0 on success, or -1 if the file can't be opened.
+// followed by the matrix values row by row (shortest form that reads back exactly).
+// Returns 0 on success, or -1 if the file can't be written.
+// Paths ending in .mbin get the binary format instead, .npy a NumPy array; paths ending in .mpak
+// append the matrix to that container. The file is replaced atomically.
 int write_matrix_file(const char *path, const Matrix *m) {
 
-    FILE *f = fopen(path, "w");   // Try to open file for writing
-    if (!f) {    // Check if file open failed
-        perror("fopen");
-        return -1;
+    if (is_container_path(path)) {
+        return pak_append(path, m);
     }
-    // Write matrix dimensions to the first line
-    fprintf(f, "%d %d\n", m->rows, m->cols);
-
-    // Write matrix contents row by row
-    for (int i = 0; i < m->rows; i++) {       
-        for (int j = 0; j < m->cols; j++) {
-            // Print matrix cell value
-            fprintf(f, "%.10g", matrix_get(m, i, j));
-            // Add a space between values, but not after the last column
-            if (j + 1 < m->cols) {
-                fprintf(f, " ");
-            }
-        }
-        fprintf(f, "\n");   // Newline after each row
+    if (!has_suffix(path, MATBIN_EXT) && !is_npy_path(path)) {   // text: the writer uses a temp file too
+        TextWriter w;
+        writer_init(&w);
+        queue_matrix_text(&w, path, m);
+        return writer_finish(&w) == 0 ? 0 : -1;
     }
-    fclose(f);              // Close the file
-    return 0;               // Success
+    // write next to the target and rename over it, so a crash or a full disk
+    // never leaves a half written matrix behind
+    char tmp[600];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    int rc = is_npy_path(path) ? npy_write(tmp, m) : write_matrix_bin(tmp, m);
+    if (rc == 0 && rename(tmp, path) != 0) {
+        perror("rename");
+        rc = -1;
+    }
+    if (rc != 0) {
+        unlink(tmp);
+    }
+    return rc;
 }
-// Loads all matrix files (.txt or .mtx) from a directory into the registry.
-// Returns the number of successfully loaded matrices.
-int load_directory(const char *dir, MatrixRegistry *reg) {
 
+// write_matrix_file for values that aren't in a Matrix (row-major, rows*cols),
+// without copying them into one. `name` is the entry name in a .mpak container.
+int write_matrix_data(const char *path, const char *name, int rows, int cols, const double *data) {
+    Matrix view;   // only read by the writers, which are done when this returns
+    memset(&view, 0, sizeof(view));
+    snprintf(view.name, sizeof(view.name), "%s", name);
+    view.rows = rows;
+    view.cols = cols;
+    view.data = (double*)data;
+    view.src_entry = -1;
+    return write_matrix_file(path, &view);
+}
+static int cmp_names(const void *a, const void *b) {
+    return strcmp(*(const char* const*)a, *(const char* const*)b);
+}
+
+// Lists the matrix files of a directory (.txt, .mtx, .mbin, .mpak) sorted by name.
+// Returns NULL if the directory can't be opened; the caller frees the names.
+static char **collect_names(const char *dir, int *count_out) {
     DIR *d = opendir(dir);  // Try to open directory
-    if (!d) {      // Directory might not exist — not fatal
-        return 0;
+    if (!d) {
+        return NULL;
     }
+    char **names = NULL;
+    int count = 0, cap = 0;
     struct dirent *ent;
-    int loaded = 0;
-    // Read files inside directory one by one
     while ((ent = readdir(d)) != NULL) {
         // Skip hidden entries like "." and ".."
         if (ent->d_name[0] == '.') {
             continue;
         }
-        // Skip files that are not .txt or .mtx
+        // Skip files that are not .txt, .mtx, .mbin, .npy or .mpak
         if (!has_suffix(ent->d_name, ".txt") &&
-            !has_suffix(ent->d_name, ".mtx")) 
+            !has_suffix(ent->d_name, ".mtx") &&
+            !has_suffix(ent->d_name, MATBIN_EXT) &&
+            !has_suffix(ent->d_name, NPY_EXT) &&
+            !has_suffix(ent->d_name, PAK_EXT)) 
         {
             continue;
         }
-        // Build full file path
+        if (count == cap) {
+            cap = cap ? cap * 2 : 64;
+            names = (char**)realloc(names, (size_t)cap * sizeof(char*));
+            if (!names) die("realloc");
+        }
+        names[count++] = strdup(ent->d_name);
+    }
+    closedir(d);      // Close directory
+    qsort(names, (size_t)count, sizeof(char*), cmp_names);   // deterministic order
+    *count_out = count;
+    return names ? names : (char**)xmalloc(sizeof(char*));
+}
+
+// Matrix name from a file name: the name without its extension.
+static void name_from_file(const char *file, char name[MAX_NAME]) {
+    snprintf(name, MAX_NAME, "%.*s", MAX_NAME - 1, file);
+    char *dot = strrchr(name, '.');
+    if (dot) {
+        *dot = 0;
+    }
+}
+
+// Whole-file reads of a directory listing, queued a batch at a time.
+typedef struct {
+    AioCtx *io;
+    const char *dir;
+    char **names;
+    int count, next, max_batch;
+    size_t head;            // > 0: only the first `head` bytes of every matrix file (shapes)
+    int pending;            // reads in flight
+    int *fd;
+    char **buf;             // NULL: not a text file, left to read_matrix_file
+    size_t *len;
+    ssize_t *res;
+} DirReads;
+
+static void reads_init(DirReads *rd, const char *dir, char **names, int count, int max_batch, size_t head) {
+    memset(rd, 0, sizeof(*rd));
+    rd->head = head;
+    rd->io = aio_create(AIO_DEPTH, g_aio_uring);
+    if (rd->io == NULL) die("aio_create");
+    rd->dir = dir;
+    rd->names = names;
+    rd->count = count;
+    rd->max_batch = max_batch;
+    rd->fd = (int*)xmalloc(((size_t)count + 1) * sizeof(int));
+    rd->buf = (char**)calloc((size_t)count + 1, sizeof(char*));
+    rd->len = (size_t*)calloc((size_t)count + 1, sizeof(size_t));
+    rd->res = (ssize_t*)calloc((size_t)count + 1, sizeof(ssize_t));
+    if (!rd->buf || !rd->len || !rd->res) die("calloc");
+}
+
+static void reads_reap(DirReads *rd) {
+    uint64_t k;
+    ssize_t res;
+    if (aio_wait(rd->io, &k, &res) == 0) {
+        rd->res[k] = res;
+        rd->pending--;
+    }
+}
+
+// Queues the reads of the next batch: up to max_batch files or LOAD_BATCH_BYTES.
+// Whole files are queued for text only, up to LOAD_QUEUE_MAX; with `head` the
+// start of every file but containers.
+static void reads_queue_batch(DirReads *rd) {
+    size_t batch_bytes = 0;
+    int start = rd->next;
+    while (rd->next < rd->count && rd->next - start < rd->max_batch && batch_bytes < LOAD_BATCH_BYTES) {
+        int k = rd->next++;
+        rd->fd[k] = -1;
+        if (rd->head ? is_container_path(rd->names[k])
+                     : !has_suffix(rd->names[k], ".txt") && !has_suffix(rd->names[k], ".mtx")) continue;
         char path[512];
-        snprintf(path, sizeof(path), "%s/%s", dir, ent->d_name);
-        // Extract matrix name (filename without extension)
-        char name[MAX_NAME];
-        snprintf(name, sizeof(name), "%.*s", MAX_NAME - 1, ent->d_name);
-        // Remove file extension
-        char *dot = strrchr(name, '.');
-        if (dot) {
-            *dot = 0;
+        snprintf(path, sizeof(path), "%s/%s", rd->dir, rd->names[k]);
+        struct stat st;
+        rd->fd[k] = open(path, O_RDONLY);
+        if (rd->fd[k] < 0 || fstat(rd->fd[k], &st) != 0) {
+            continue;   // buf stays NULL, read_matrix_file reports the error
         }
-        Matrix *m = NULL;
-        // Try to load the matrix file
-        if (read_matrix_file(path, name, &m) == 0) {
-            registry_add(reg, m);    // Add to registry
-            loaded++;    // Count successful load
+        if (!rd->head && (size_t)st.st_size > LOAD_QUEUE_MAX) {
+            continue;   // buf stays NULL, read_matrix_file maps it
         }
+        rd->len[k] = (size_t)st.st_size;
+        if (rd->head && rd->len[k] > rd->head) rd->len[k] = rd->head;
+        rd->buf[k] = (char*)xmalloc(rd->len[k] ? rd->len[k] : 1);
+        batch_bytes += rd->len[k];
+        if (rd->len[k] == 0) continue;
+        while (aio_inflight(rd->io) == aio_depth(rd->io)) reads_reap(rd);
+        aio_read(rd->io, rd->fd[k], rd->buf[k], rd->len[k], 0, (uint64_t)k);
+        rd->pending++;
     }
-    closedir(d);      // Close directory
+}
+
+// Waits for every queued read.
+static void reads_wait(DirReads *rd) {
+    while (rd->pending > 0) reads_reap(rd);
+}
+
+static void reads_release(DirReads *rd, int k) {
+    if (rd->fd[k] >= 0) close(rd->fd[k]);
+    rd->fd[k] = -1;
+    free(rd->buf[k]);
+    rd->buf[k] = NULL;
+}
+
+static void reads_free(DirReads *rd) {
+    aio_destroy(rd->io);
+    free(rd->fd);
+    free(rd->buf);
+    free(rd->len);
+    free(rd->res);
+}
+
+int g_io_threads = 0;
+
+// Loads all matrix files (.txt, .mtx, .mbin or .npy) from a directory into the registry.
+// .mpak containers in the directory are loaded entry by entry, and `dir` itself
+// may be a container file. Returns the number of successfully loaded matrices.
+// Files are parsed concurrently (g_io_threads, 0 = OpenMP default) in batches,
+// and inserted in filename order so the IDs given afterwards are stable.
+int load_directory(const char *dir, MatrixRegistry *reg) {
+
+    if (is_container_path(dir)) {
+        int n = pak_load_all(dir, reg, NULL);
+        return n < 0 ? 0 : n;
+    }
+    int count = 0;
+    char **names = collect_names(dir, &count);
+    if (names == NULL) {      // Directory might not exist — not fatal
+        return 0;
+    }
+
+    int threads = 1;
+#ifdef HAVE_OMP
+    threads = g_io_threads > 0 ? g_io_threads : omp_get_max_threads();
+    if (!g_omp_enabled) threads = 1;
+#endif
+    init_space_table();   // shared by all parser threads, fill it before they start
+
+    // Text files are read through the I/O queue: while one batch is parsed, the
+    // reads of the next batch are in flight. Binary files and containers are
+    // mapped by read_matrix_file / pak_load_all at parse time instead.
+    DirReads rd;
+    reads_init(&rd, dir, names, count, LOAD_BATCH * threads, 0);
+    Matrix **parsed = (Matrix**)calloc((size_t)count + 1, sizeof(Matrix*));
+    if (parsed == NULL) die("calloc");
+
+    uint64_t t0 = now_millis();
+    int loaded = 0;
+    size_t bytes = 0;
+    reads_queue_batch(&rd);
+    for (int base = 0; base < count; ) {
+        int end = rd.next;
+        reads_wait(&rd);          // this batch is in
+        reads_queue_batch(&rd);   // the next one is read while this one is parsed
+
+        // Parse this batch concurrently (containers are handled below, in order)
+        #pragma omp parallel for num_threads(threads) schedule(dynamic, 1) if(threads > 1)
+        for (int k = base; k < end; k++) {
+            const char *file = names[k];
+            if (is_container_path(file)) continue;
+            // Build full file path
+            char path[512];
+            snprintf(path, sizeof(path), "%s/%s", dir, file);
+            // Extract matrix name (filename without extension)
+            char name[MAX_NAME];
+            name_from_file(file, name);
+            Matrix *m = NULL;
+            const char *buf = rd.buf[k];
+            size_t len = rd.len[k];
+            if (buf == NULL || (len >= 8 && memcmp(buf, MATBIN_MAGIC, 8) == 0) || is_npy_data(buf, len)) {
+                // not read through the queue, or binary whatever the extension
+                if (read_matrix_file(path, name, &m) == 0) parsed[k] = m;
+            } else if (rd.res[k] != (ssize_t)len) {
+                fprintf(stderr, "Cannot read %s\n", path);
+            } else if (parse_matrix_text(buf, len, path, name, &m) == 0) {
+                parsed[k] = m;
+            }
+        }
+        // Insert in filename order
+        for (int k = base; k < end; k++) {
+            reads_release(&rd, k);
+            const char *file = names[k];
+            if (is_container_path(file)) {
+                char path[512];
+                snprintf(path, sizeof(path), "%s/%s", dir, file);
+                int c = pak_load_all(path, reg, NULL);
+                if (c > 0) loaded += c;
+                continue;
+            }
+            if (parsed[k] == NULL) continue;
+            bytes += matrix_bytes(parsed[k]);
+            if (registry_add(reg, parsed[k]) == 0) {    // Add to registry
+                loaded++;    // Count successful load
+            } else {
+                matrix_free(parsed[k]);
+            }
+        }
+        base = end;
+    }
+    const char *backend = aio_backend(rd.io);
+    reads_free(&rd);
+    uint64_t ms = now_millis() - t0;
+    if (count > 0) {
+        printf("Loaded %d matrices from %d files in %s: %.1f MB in %llu ms (%.1f MB/s, %d thread%s, %s)\n",
+               loaded, count, dir, bytes / 1048576.0, (unsigned long long)ms,
+               ms ? bytes / 1048576.0 / (ms / 1000.0) : 0.0, threads, threads == 1 ? "" : "s", backend);
+    }
+    free(parsed);
+    for (int k = 0; k < count; k++) free(names[k]);
+    free(names);
     return loaded;    // Return number of loaded matrices
 }
 
+// Registry loader for lazy matrices: reads the whole matrix from its source.
+static int load_source(const Matrix *m, Matrix **out) {
+    int rc;
+    if (m->src_entry >= 0) {
+        // the matrix may have been renamed and the container compacted or appended
+        // to since startup, so the entry is found by its contents, not name or index
+        Pak *p = pak_open(m->src_path);
+        int i = p ? pak_find_data(p, m->src_entry, m->rows, m->cols, m->src_sum) : -1;
+        if (i < 0) {
+            if (p) fprintf(stderr, "%s no longer holds matrix %s\n", m->src_path, m->name);
+            pak_close(p);
+            return -1;
+        }
+        rc = pak_load(p, i, m->name, out);
+        pak_close(p);
+    } else {
+        rc = read_matrix_file(m->src_path, m->name, out);
+    }
+    if (rc == 0 && ((*out)->rows != m->rows || (*out)->cols != m->cols)) {   // file changed on disk
+        fprintf(stderr, "%s changed shape since startup\n", m->src_path);
+        matrix_free(*out);
+        return -1;
+    }
+    return rc;
+}
+
+// Shape of a matrix file from its first n bytes (n = -1: the read failed; the
+// file is still open on fd). Returns 0, or -1 if it can't be read.
+static int shape_from_head(int fd, const char *path, const char *buf, ssize_t n, int *rows, int *cols) {
+    if (n > 0 && is_npy_data(buf, (size_t)n)) {
+        return npy_shape(fd, path, rows, cols);     // its header may be longer than this block
+    }
+    if (n < 0) {
+        return -1;
+    }
+    if ((size_t)n >= sizeof(MatBinHeader) && memcmp(buf, MATBIN_MAGIC, 8) == 0) {
+        MatBinHeader h;
+        size_t need;
+        memcpy(&h, buf, sizeof(h));
+        if (check_bin_header(fd, &h, path, &need) != 0) {
+            return -1;
+        }
+        *rows = (int)h.rows;
+        *cols = (int)h.cols;
+        return 0;
+    }
+    const char *end = buf + n;
+    const char *p = parse_header(buf, end, path, rows, cols);
+    // a number cut at the end of the block isn't complete yet
+    return (p != NULL && (p < end || n < SHAPE_HEAD)) ? 0 : -1;
+}
+
+// Startup variant of load_directory: only the shapes are read, each matrix is
+// parsed on its first registry_get (or by the prefetch thread). Files whose
+// header can't be read are loaded eagerly so errors show up as before.
+int load_directory_lazy(const char *dir, MatrixRegistry *reg) {
+    int count = 0;
+    char **names = collect_names(dir, &count);
+    if (names == NULL) {
+        return 0;
+    }
+    init_space_table();
+    reg->loader = load_source;
+
+    // the first block of every file is read through the I/O queue, a batch ahead
+    DirReads rd;
+    reads_init(&rd, dir, names, count, AIO_DEPTH, SHAPE_HEAD);
+    uint64_t t0 = now_millis();
+    int loaded = 0;
+    reads_queue_batch(&rd);
+    for (int base = 0; base < count; ) {
+        int end = rd.next;
+        reads_wait(&rd);
+        reads_queue_batch(&rd);
+        for (int k = base; k < end; k++) {
+            char path[512];
+            snprintf(path, sizeof(path), "%s/%s", dir, names[k]);
+            if (is_container_path(names[k])) {
+                int c = pak_index_lazy(path, reg);
+                if (c > 0) loaded += c;
+                continue;
+            }
+            char name[MAX_NAME];
+            name_from_file(names[k], name);
+            int rows, cols;
+            Matrix *m = NULL;
+            ssize_t n = rd.buf[k] == NULL ? -1 : rd.len[k] == 0 ? 0 : rd.res[k];
+            int shaped = shape_from_head(rd.fd[k], path, rd.buf[k], n, &rows, &cols) == 0;
+            reads_release(&rd, k);
+            if (shaped) {
+                m = matrix_create_lazy(name, rows, cols, path, -1);
+            } else if (read_matrix_file(path, name, &m) != 0) {
+                continue;
+            }
+            if (registry_add(reg, m) == 0) {
+                loaded++;
+            } else {
+                matrix_free(m);
+            }
+        }
+        base = end;
+    }
+    reads_free(&rd);
+    if (count > 0) {
+        printf("Indexed %d matrices from %d files in %s in %llu ms (data is read on first use)\n",
+               loaded, count, dir, (unsigned long long)(now_millis() - t0));
+    }
+    for (int k = 0; k < count; k++) free(names[k]);
+    free(names);
+    return loaded;
+}
+
+// Writes the whole registry (names, shapes, data and the next free ID) to one
+// .mpak image. Returns 0 or -1.
+int save_snapshot(const char *path, MatrixRegistry *reg, uint64_t next_id) {
+    save_all_wait(reg);
+    return pak_write_registry(path, reg, next_id);
+}
+
+// Restores a registry image written by save_snapshot: big matrices are mapped,
+// or with `lazy` only the index is read and data comes in on first use.
+// *next_id gets the saved ID counter. Returns the number of matrices or -1.
+int load_snapshot(const char *path, MatrixRegistry *reg, int lazy, uint64_t *next_id) {
+    Pak *p = pak_open(path);
+    if (p == NULL) {
+        return -1;
+    }
+    *next_id = p->hdr.aux;
+    pak_close(p);
+    if (lazy) {
+        reg->loader = load_source;
+        return pak_index_lazy(path, reg);
+    }
+    return pak_load_all(path, reg, NULL);
+}
+
+// Background save state (one save at a time)
+static pthread_t g_save_thread;
+static int g_save_running = 0;
+static int g_save_failed = 0;
+static char g_save_dir[256];
+static Matrix **g_save_list = NULL;   // private copies of the dirty matrices
+static int g_save_count = 0;
+
+// Queues matrix m as <dir>/<name>.txt on the writer.
+static void save_one(TextWriter *w, const char *dir, const Matrix *m) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s.txt", dir, m->name);
+    queue_matrix_text(w, path, m);
+}
+
+// Tells whether save_all_to_dir has to write this matrix: it changed since
+// the last save to the same folder, or its file isn't there anymore.
+static int needs_save(const MatrixRegistry *reg, const char *dir, const Matrix *m) {
+    if (m == NULL) {
+        return 0;
+    }
+    if (m->dirty || strcmp(reg->save_dir, dir) != 0) {
+        return 1;
+    }
+    char path[512];
+    struct stat st;
+    snprintf(path, sizeof(path), "%s/%s.txt", dir, m->name);
+    return stat(path, &st) != 0;
+}
+
+static void *save_thread_main(void *arg) {
+    (void)arg;
+    TextWriter w;
+    writer_init(&w);
+    for (int i = 0; i < g_save_count; i++) {
+        save_one(&w, g_save_dir, g_save_list[i]);   // formatted already, the copy can go
+        matrix_free(g_save_list[i]);
+    }
+    if (writer_finish(&w) != 0) {
+        g_save_failed = 1;
+    }
+    free(g_save_list);
+    g_save_list = NULL;
+    return NULL;
+}
+
+// Waits for a background save. If it failed, the next save writes everything again.
+int save_all_wait(MatrixRegistry *reg) {
+    if (!g_save_running) {
+        return 0;
+    }
+    pthread_join(g_save_thread, NULL);
+    g_save_running = 0;
+    if (g_save_failed) {
+        fprintf(stderr, "Background save to %s failed\n", g_save_dir);
+        reg->save_dir[0] = '\0';
+        return -1;
+    }
+    return 0;
+}
+
 // Saves all matrices in the registry to the given directory.
-// Creates the directory if it does not exist.
-// Returns 0 on success, or -1 on error.
-int save_all_to_dir(const char *dir, MatrixRegistry *reg) {
+// Creates the directory if it does not exist. Only matrices changed since
+// the last save to the same folder are written (each through a temp file
+// and a rename, with the writes of all files queued together). A path ending in .mpak writes one container file instead
+// (one sequential write). With `background` the changed matrices are copied
+// and written by a thread while the caller goes on.
+// Returns the number of matrices written (or being written), or -1 on error.
+int save_all_to_dir(const char *dir, MatrixRegistry *reg, int background) {
+    save_all_wait(reg);   // one save at a time
+    if (is_container_path(dir)) {
+        if (pak_write_registry(dir, reg, 0) != 0) {
+            reg->save_dir[0] = '\0';   // write everything again next time
+            return -1;
+        }
+        for (int i = 0; i < reg->count; i++) {   // every matrix went in, all are clean now
+            Matrix *m = registry_peek(reg, i);
+            if (m != NULL) {
+                m->dirty = 0;
+            }
+        }
+        snprintf(reg->save_dir, sizeof(reg->save_dir), "%s", dir);
+        return reg->count;
+    }
     struct stat st;
     // Check if directory exists; create it if not
     if (stat(dir, &st) != 0) {
@@ -159,15 +1268,49 @@ int save_all_to_dir(const char *dir, MatrixRegistry *reg) {
             return -1;
         }
     }
-    // Save each matrix as a .txt file
+    int written = 0;
+    TextWriter w;
+    if (background) {
+        g_save_list = (Matrix**)xmalloc((size_t)(reg->count ? reg->count : 1) * sizeof(Matrix*));
+    } else {
+        writer_init(&w);
+    }
     for (int i = 0; i < reg->count; i++) {
-        Matrix *m = reg->items[i];
-        char path[512];
-        snprintf(path, sizeof(path), "%s/%s.txt", dir, m->name);
-        // If writing fails, stop and return error
-        if (write_matrix_file(path, m) != 0) {
-            return -1;
+        if (!needs_save(reg, dir, registry_peek(reg, i))) {   // clean: not even read back into RAM
+            continue;
+        }
+        Matrix *m = registry_at(reg, i);   // brings spilled and lazy matrices in first
+        if (m == NULL) {
+            continue;
+        }
+        if (background) {   // the copy is what gets written, the menu may change m meanwhile
+            Matrix *c = matrix_create(m->name, m->rows, m->cols);
+            memcpy(c->data, m->data, matrix_bytes(m));
+            g_save_list[written] = c;
+        } else {
+            save_one(&w, dir, m);
+        }
+        m->dirty = 0;
+        written++;
+    }
+    if (!background && writer_finish(&w) != 0) {   // If writing fails, return error
+        reg->save_dir[0] = '\0';   // and write everything again next time
+        return -1;
+    }
+    snprintf(reg->save_dir, sizeof(reg->save_dir), "%s", dir);
+    if (background) {
+        snprintf(g_save_dir, sizeof(g_save_dir), "%s", dir);
+        g_save_count = written;
+        g_save_failed = 0;
+        if (pthread_create(&g_save_thread, NULL, save_thread_main, NULL) == 0) {
+            g_save_running = 1;
+        } else {
+            save_thread_main(NULL);   // no thread: write them now
+            if (g_save_failed) {
+                reg->save_dir[0] = '\0';
+                return -1;
+            }
         }
     }
-    return 0;           // Success
+    return written;
 }
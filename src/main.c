@@ -1,5 +1,6 @@
 #include "common.h"
 #include "menu.h"
+#include "autotune.h"
 
 // Global flag used to detect Ctrl+C interruption
 static volatile sig_atomic_t g_interrupted = 0;
@@ -22,6 +23,9 @@ int main(int argc, char **argv) {
 
     AppConfig cfg; // Holds configuration values
     const char *config_path = "config/default.conf";  // Default config path
+    const char *restore = NULL;   // snapshot image to start from
+    const char *script = NULL;    // run commands from this file ("-" = stdin) instead of the menu
+    int autotune = 0;             // measure the machine and write tuned keys into the config
 
     // Parse command-line arguments
     for (int i = 1; i < argc; i++) {
@@ -31,15 +35,32 @@ int main(int argc, char **argv) {
             config_path = argv[i + 1];      // Use the provided config file
             i++;   // Skip next argument
         }
+        // restore <image>: start from a registry snapshot instead of matrix_dir
+        else if (strcmp(argv[i], "--restore") == 0 && (i + 1) < argc) {
+            restore = argv[i + 1];
+            i++;   // Skip next argument
+        }
+        // script <file|->: non-interactive command mode
+        else if (strcmp(argv[i], "--script") == 0 && (i + 1) < argc) {
+            script = argv[i + 1];
+            i++;   // Skip next argument
+        }
+        // autotune: sweep parameters, store the fastest in the config file
+        else if (strcmp(argv[i], "--autotune") == 0) {
+            autotune = 1;
+        }
         // help
         else if (strcmp(argv[i], "--help") == 0) {
-            printf("Usage: %s [--config path]\n", argv[0]);
+            printf("Usage: %s [--config path] [--restore snapshot.mpak] [--script file|-] [--autotune]\n", argv[0]);
             return 0;  // Exit after showing help
         }
     }
 
     // Load configuration file, this function in menu
     load_config(config_path, &cfg);
+    if (restore != NULL) {
+        snprintf(cfg.restore, sizeof(cfg.restore), "%s", restore);
+    }
 
     // Register signal handlers
     signal(SIGINT, on_sigint);   // Handle Ctrl+C
@@ -47,6 +68,12 @@ int main(int argc, char **argv) {
 
     (void)g_interrupted; // Silence unused-warning for now
 
+    if (autotune) {
+        return run_autotune(&cfg, config_path) == 0 ? 0 : 1;   // writes into the --config file
+    }
+    if (script != NULL) {
+        return run_script(&cfg, script) == 0 ? 0 : 1;   // exit status 1 if a command failed
+    }
     // Run the main interactive menu, given the config content 
     run_menu(&cfg);
     return 0;
@@ -0,0 +1,231 @@
+#include "common.h"
+#include "maintained.h"
+#include "ops.h"
+#include "cost.h"
+#include "mat_alloc.h"
+
+typedef struct {
+    char c[MAX_NAME], a[MAX_NAME], b[MAX_NAME];
+    uint64_t vc, va, vb;   // versions the product is consistent with
+} Product;
+
+static Product *g_prod = NULL;
+static int g_count = 0, g_cap = 0;
+
+// Starts tracking C = A*B (C must already be registered, so its version is final).
+void maint_add(const Matrix *C, const Matrix *A, const Matrix *B) {
+    if (g_count == g_cap) {
+        g_cap = g_cap ? g_cap * 2 : 8;
+        g_prod = realloc(g_prod, (size_t)g_cap * sizeof(Product));
+        if (g_prod == NULL) die("realloc products");
+    }
+    Product *p = &g_prod[g_count++];
+    snprintf(p->c, sizeof(p->c), "%s", C->name);
+    snprintf(p->a, sizeof(p->a), "%s", A->name);
+    snprintf(p->b, sizeof(p->b), "%s", B->name);
+    p->vc = C->version;
+    p->va = A->version;
+    p->vb = B->version;
+}
+
+static void remove_at(int k) {
+    g_prod[k] = g_prod[g_count - 1];
+    g_count--;
+}
+
+void maint_forget(const char *name) {
+    for (int k = g_count - 1; k >= 0; k--) {
+        Product *p = &g_prod[k];
+        if (!strcmp(p->c, name) || !strcmp(p->a, name) || !strcmp(p->b, name)) {
+            remove_at(k);
+        }
+    }
+}
+
+int maint_count(void) {
+    return g_count;
+}
+
+void maint_free(void) {
+    free(g_prod);
+    g_prod = NULL;
+    g_count = g_cap = 0;
+}
+
+// The updates below return the Frobenius norm of their change to C, which
+// eig_warm_note_edit needs to judge C's warm start vector.
+
+// Recomputes the whole product into C (same ID, same buffer).
+static double recompute_all(Matrix *C, const Matrix *A, const Matrix *B) {
+    Matrix *T = op_mul_single(A, B, C->name);
+    if (T == NULL) return INFINITY;
+    double d2 = 0.0;
+    for (size_t k = 0; k < (size_t)C->rows * C->cols; k++) {
+        double d = T->data[k] - C->data[k];
+        d2 += d * d;
+    }
+    memcpy(C->data, T->data, matrix_bytes(C));
+    matrix_free(T);
+    return sqrt(d2);
+}
+
+// C[i,:] = A[i,:] * B; the overwritten row goes to old (N entries)
+static double recompute_row(Matrix *C, const Matrix *A, const Matrix *B, int i, double *old) {
+    int K = A->cols, N = B->cols;
+    double *crow = &C->data[(size_t)i * N];
+    memcpy(old, crow, (size_t)N * sizeof(double));
+    for (int j = 0; j < N; j++) crow[j] = 0.0;
+    for (int k = 0; k < K; k++) {
+        double a = matrix_get(A, i, k);
+        if (a == 0.0) continue;
+        const double *brow = &B->data[(size_t)k * N];
+        for (int j = 0; j < N; j++) crow[j] += a * brow[j];
+    }
+    double d2 = 0.0;
+    for (int j = 0; j < N; j++) d2 += (crow[j] - old[j]) * (crow[j] - old[j]);
+    return sqrt(d2);
+}
+
+// C[:,j] = A * B[:,j]; the overwritten column goes to old (M entries)
+static double recompute_col(Matrix *C, const Matrix *A, const Matrix *B, int j, double *old) {
+    int M = A->rows, K = A->cols;
+    int T = cost_threads(2.0 * M * K, 16.0 * M * K);   // B's column is read with a stride
+    double d2 = 0.0;
+#pragma omp parallel for num_threads(T) if(T > 1) schedule(static) reduction(+:d2)
+    for (int i = 0; i < M; i++) {
+        double s = 0.0;
+        for (int k = 0; k < K; k++) s += matrix_get(A, i, k) * matrix_get(B, k, j);
+        old[i] = matrix_get(C, i, j);
+        double d = s - old[i];
+        d2 += d * d;
+        matrix_set(C, i, j, s);
+    }
+    return sqrt(d2);
+}
+
+// C += u * v^T (u has M entries, v has N entries), skipping zero entries of u
+static double rank1_add(Matrix *C, const double *u, const double *v) {
+    int M = C->rows, N = C->cols;
+    int T = cost_threads(2.0 * M * N, 16.0 * M * N);
+#pragma omp parallel for num_threads(T) if(T > 1) schedule(static)
+    for (int i = 0; i < M; i++) {
+        if (u[i] == 0.0) continue;
+        double *crow = &C->data[(size_t)i * N];
+        for (int j = 0; j < N; j++) crow[j] += u[i] * v[j];
+    }
+    double uu = 0.0, vv = 0.0;   // |u v^T|_F = |u| |v|
+    for (int i = 0; i < M; i++) uu += u[i] * u[i];
+    for (int j = 0; j < N; j++) vv += v[j] * v[j];
+    return sqrt(uu * vv);
+}
+
+// What an edit changed in a matrix
+#define CH_ALL (-1)   // anything
+#define CH_COL 0      // column idx
+#define CH_ROW 1      // row idx
+
+// A patched product that is itself an operand of other products
+typedef struct {
+    char name[MAX_NAME];
+    uint64_t from_version;
+    int kind, idx;
+    double *old;          // overwritten row / column (CH_ROW / CH_COL)
+} Change;
+
+static int used_as_operand(const char *name) {
+    for (int k = 0; k < g_count; k++) {
+        if (!strcmp(g_prod[k].a, name) || !strcmp(g_prod[k].b, name)) return 1;
+    }
+    return 0;
+}
+
+// Applies one edit of matrix `name` to every product that uses it, then the
+// changes of those products to the products built on them (D = C*E after C = A*B).
+// A product is always newer than its operands, so this ends.
+// kind: CH_ROW / CH_COL with the overwritten values in old, or CH_ALL.
+static void on_edit(MatrixRegistry *reg, const char *name, uint64_t from_version, int kind, int idx, const double *old) {
+    Change *next = NULL;
+    int nnext = 0;
+    for (int k = g_count - 1; k >= 0; k--) {
+        Product *p = &g_prod[k];
+        if (!strcmp(p->c, name)) {           // the user edited the result itself
+            remove_at(k);
+            continue;
+        }
+        int edits_a = !strcmp(p->a, name);
+        int edits_b = !strcmp(p->b, name);
+        if (!edits_a && !edits_b) continue;
+
+        Matrix *C = registry_acquire(reg, p->c);   // pinned: fetching one must not spill another
+        Matrix *A = registry_acquire(reg, p->a);
+        Matrix *B = registry_acquire(reg, p->b);
+        if (!C || !A || !B) {                // an operand is gone
+            remove_at(k);
+            registry_release(reg, C);
+            registry_release(reg, A);
+            registry_release(reg, B);
+            continue;
+        }
+
+        int in_sync = C->version == p->vc &&
+                      (edits_a ? from_version : A->version) == p->va &&
+                      (edits_b ? from_version : B->version) == p->vb;
+        Change ch = { .kind = CH_ALL, .idx = idx, .old = NULL };
+        snprintf(ch.name, sizeof(ch.name), "%s", C->name);
+        ch.from_version = C->version;
+        double delta;
+        if (!in_sync || (edits_a && edits_b) || kind == CH_ALL) {
+            delta = recompute_all(C, A, B);  // A*A, or something changed without the hooks
+        } else if (edits_a && kind == CH_ROW) {
+            ch.kind = CH_ROW;
+            ch.old = mat_alloc((size_t)C->cols);
+            delta = recompute_row(C, A, B, idx, ch.old);
+        } else if (edits_b && kind == CH_COL) {
+            ch.kind = CH_COL;
+            ch.old = mat_alloc((size_t)C->rows);
+            delta = recompute_col(C, A, B, idx, ch.old);
+        } else if (edits_a) {                // column idx of A: C += dA[:,idx] * B[idx,:]
+            double *d = mat_alloc((size_t)A->rows);
+            for (int i = 0; i < A->rows; i++) d[i] = matrix_get(A, i, idx) - old[i];
+            delta = rank1_add(C, d, &B->data[(size_t)idx * B->cols]);
+            mat_free(d);
+        } else {                             // row idx of B: C += A[:,idx] * dB[idx,:]
+            double *u = mat_alloc((size_t)A->rows);
+            double *d = mat_alloc((size_t)B->cols);
+            for (int i = 0; i < A->rows; i++) u[i] = matrix_get(A, i, idx);
+            for (int j = 0; j < B->cols; j++) d[j] = matrix_get(B, idx, j) - old[j];
+            delta = rank1_add(C, u, d);
+            mat_free(u); mat_free(d);
+        }
+
+        registry_changed(reg, C);            // C changed: its cached results are stale
+        eig_warm_note_edit(C, delta);        // and its warm start may be too far off now
+        p->vc = C->version;
+        p->va = A->version;
+        p->vb = B->version;
+        registry_release(reg, C);
+        registry_release(reg, A);
+        registry_release(reg, B);
+
+        if (used_as_operand(ch.name)) {      // passed on once this loop is done with g_prod
+            next = (Change*)realloc(next, (size_t)(nnext + 1) * sizeof(Change));
+            if (next == NULL) die("realloc changes");
+            next[nnext++] = ch;
+        } else {
+            mat_free(ch.old);
+        }
+    }
+    for (int k = 0; k < nnext; k++) {
+        on_edit(reg, next[k].name, next[k].from_version, next[k].kind, next[k].idx, next[k].old);
+        mat_free(next[k].old);
+    }
+    free(next);
+}
+
+void maint_row_changed(MatrixRegistry *reg, Matrix *m, uint64_t from_version, int i, const double *old_row) {
+    on_edit(reg, m->name, from_version, CH_ROW, i, old_row);
+}
+
+void maint_col_changed(MatrixRegistry *reg, Matrix *m, uint64_t from_version, int j, const double *old_col) {
+    on_edit(reg, m->name, from_version, CH_COL, j, old_col);
+}
@@ -0,0 +1,175 @@
+#define _GNU_SOURCE  // MAP_ANONYMOUS, MAP_HUGETLB, MADV_HUGEPAGE
+
+#include "common.h"
+#include "mat_alloc.h"
+#include <sys/mman.h>
+#include <pthread.h>
+
+#define HDR_BYTES     64                   // header in front of every buffer, keeps data 64-byte aligned
+#define MIN_CLASS_LOG 6                    // smallest class is 64 bytes
+#define NCLASSES      192                  // 4 classes per power of two, up to 2^53 bytes
+#define MMAP_MIN      (256u * 1024u)       // classes at or above this size are mmap'ed
+#define HUGE_PAGE     (2u * 1024u * 1024u) // x86-64 huge page size
+
+// Header stored right before the pointer handed to the caller.
+typedef struct BufHdr {
+    size_t bytes;           // usable size of the class (without the header)
+    size_t map_len;         // length of the mmap, 0 if the buffer came from aligned_alloc
+    int cls;                // size class index
+    struct BufHdr *next;    // free list link while cached
+} BufHdr;
+
+static BufHdr *g_free[NCLASSES];                     // free list per size class
+static size_t g_cached = 0;                          // bytes sitting in free lists
+static size_t g_cache_limit = 256u * 1024u * 1024u;  // max bytes kept in free lists
+static int g_hugepages = MAT_HUGEPAGES_THP;
+static unsigned long long g_allocs = 0, g_reused = 0, g_fresh = 0;
+static pthread_mutex_t g_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// fork() while another thread (registry prefetch) holds the lock would leave it
+// locked forever in the child, so the lock is taken around every fork
+static void fork_prepare(void) { pthread_mutex_lock(&g_lock); }
+static void fork_release(void) { pthread_mutex_unlock(&g_lock); }
+static void install_fork_handlers(void) { pthread_atfork(fork_prepare, fork_release, fork_release); }
+
+// Sets the huge page mode and how many bytes of freed buffers may be cached.
+void mat_alloc_config(int hugepages, size_t cache_bytes) {
+    static pthread_once_t once = PTHREAD_ONCE_INIT;
+    pthread_once(&once, install_fork_handlers);
+    pthread_mutex_lock(&g_lock);
+    g_hugepages = hugepages;
+    g_cache_limit = cache_bytes;
+    pthread_mutex_unlock(&g_lock);
+}
+
+// Returns the class for a byte count: classes are 2^h, 1.25*2^h, 1.5*2^h, 1.75*2^h
+static int class_of(size_t bytes) {
+    if (bytes <= ((size_t)1 << MIN_CLASS_LOG)) return 0;
+    int h = 63 - __builtin_clzll((unsigned long long)(bytes - 1));   // 2^h < bytes <= 2^(h+1)
+    size_t quarter = (size_t)1 << (h - 2);
+    size_t s = (bytes - ((size_t)1 << h) + quarter - 1) / quarter;  // round up to a quarter step
+    return (h - MIN_CLASS_LOG) * 4 + (int)s;                        // s == 4 lands on the next power
+}
+
+// Size in bytes of a class
+static size_t class_size(int cls) {
+    int h = MIN_CLASS_LOG + cls / 4;
+    return ((size_t)4 + (size_t)(cls % 4)) << (h - 2);
+}
+
+// Gets fresh memory from the system for a class.
+static BufHdr *fresh_buffer(int cls) {
+    size_t bytes = class_size(cls);
+    size_t total = bytes + HDR_BYTES;
+    BufHdr *h = NULL;
+    size_t map_len = 0;
+
+    if (bytes >= MMAP_MIN) {
+        void *p = MAP_FAILED;
+        if (g_hugepages == MAT_HUGEPAGES_EXPLICIT) {
+            map_len = (total + HUGE_PAGE - 1) & ~((size_t)HUGE_PAGE - 1);
+            p = mmap(NULL, map_len, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        }
+        if (p == MAP_FAILED) {   // normal pages (or no reserved huge pages)
+            map_len = total;
+            p = mmap(NULL, map_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (p == MAP_FAILED) die("mmap");
+            if (g_hugepages != MAT_HUGEPAGES_OFF && map_len >= HUGE_PAGE) {
+                madvise(p, map_len, MADV_HUGEPAGE);   // best effort, ignore failure
+            }
+        }
+        h = (BufHdr*)p;
+    } else {
+        // C11 wants the size of aligned_alloc to be a multiple of the alignment,
+        // and the small classes (80, 96, 112 bytes, ...) aren't
+        h = (BufHdr*)aligned_alloc(HDR_BYTES, (total + HDR_BYTES - 1) & ~((size_t)HDR_BYTES - 1));
+        if (!h) die("aligned_alloc");
+    }
+    h->bytes = bytes;
+    h->map_len = map_len;
+    h->cls = cls;
+    h->next = NULL;
+    return h;
+}
+
+// Returns memory of a buffer to the system.
+static void release_buffer(BufHdr *h) {
+    if (h->map_len > 0) {
+        munmap(h, h->map_len);
+    } else {
+        free(h);
+    }
+}
+
+// Takes a buffer from the class free list or the system.
+// *zeroed is set to 1 when the memory is known to be all zeros (fresh mmap).
+static double *alloc_impl(size_t count, int *zeroed) {
+    size_t bytes = count * sizeof(double);
+    if (bytes == 0) bytes = sizeof(double);
+    int cls = class_of(bytes);
+    if (cls >= NCLASSES) die("mat_alloc: size too large");
+
+    pthread_mutex_lock(&g_lock);
+    g_allocs++;
+    BufHdr *h = g_free[cls];
+    if (h != NULL) {
+        g_free[cls] = h->next;
+        g_cached -= h->bytes;
+        g_reused++;
+    } else {
+        g_fresh++;
+    }
+    pthread_mutex_unlock(&g_lock);
+
+    *zeroed = 0;
+    if (h == NULL) {
+        h = fresh_buffer(cls);
+        *zeroed = (h->map_len > 0);   // anonymous mmap pages are already zero
+    }
+    return (double*)((char*)h + HDR_BYTES);
+}
+
+// Allocates count doubles, contents undefined.
+double *mat_alloc(size_t count) {
+    int zeroed;
+    return alloc_impl(count, &zeroed);
+}
+
+// Allocates count doubles set to 0.0. Fresh mmap memory is not touched,
+// so pages of big matrices are faulted in by the op that writes them, not here.
+double *mat_alloc_zeroed(size_t count) {
+    int zeroed;
+    double *p = alloc_impl(count, &zeroed);
+    if (!zeroed) {
+        memset(p, 0, count * sizeof(double));
+    }
+    return p;
+}
+
+// Gives a buffer back. It is cached for reuse unless the cache is full.
+void mat_free(void *p) {
+    if (p == NULL) return;
+    BufHdr *h = (BufHdr*)((char*)p - HDR_BYTES);
+
+    pthread_mutex_lock(&g_lock);
+    if (g_cached + h->bytes <= g_cache_limit) {
+        h->next = g_free[h->cls];
+        g_free[h->cls] = h;
+        g_cached += h->bytes;
+        h = NULL;
+    }
+    pthread_mutex_unlock(&g_lock);
+
+    if (h != NULL) {
+        release_buffer(h);   // cache full, give it back to the system
+    }
+}
+
+// Prints how many allocations were served from the cache.
+void mat_alloc_print_stats(void) {
+    pthread_mutex_lock(&g_lock);
+    printf("allocator: %llu allocs, %llu reused, %llu fresh, %.1f MB cached\n",
+           g_allocs, g_reused, g_fresh, (double)g_cached / (1024.0 * 1024.0));
+    pthread_mutex_unlock(&g_lock);
+}
@@ -1,14 +1,215 @@
+#define _POSIX_C_SOURCE 200809L  // strdup
+
 #include "matrix.h"
+#include "mat_alloc.h"
+#include "det_update.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Source of matrix versions, so (ID, version) never repeats even if an ID is reused
+static uint64_t g_version_clock = 0;
+
+// Gives the matrix a new version, called whenever its content changes.
+// Atomic because load_directory creates matrices on several threads.
+void matrix_bump_version(Matrix *m) {
+    m->version = __atomic_add_fetch(&g_version_clock, 1, __ATOMIC_RELAXED);
+    m->dirty = 1;   // has to be saved again
+}
 
 // Initializes an empty matrix registry.
 void registry_init(MatrixRegistry *r) {
     r->items = NULL;       // No items yet
     r->count = 0;          // Count of matrices
     r->cap = 0;            // Capacity of items array
+    r->mem_budget = 0;     // No memory limit by default
+    r->mem_used = 0;
+    r->clock = 0;
+    r->hits = r->misses = r->spills = 0;
+    r->spill = NULL;       // Spill file is opened lazily on first eviction
+    r->spill_end = 0;
+    r->spill_path[0] = '\0';
+    r->spill_created = 0;
+    r->holes = NULL;
+    r->nholes = r->capholes = 0;
+    r->loader = NULL;
+    r->loads = 0;
+    pthread_mutex_init(&r->lock, NULL);
+    r->prefetching = 0;
+    r->stop = 0;
+    r->save_dir[0] = '\0';
+}
+
+// Sets the memory budget (bytes of matrix data kept in RAM, 0 = unlimited)
+// and the spill file path (NULL or "" = anonymous temporary file).
+void registry_set_budget(MatrixRegistry *r, size_t bytes, const char *spill_path) {
+    r->mem_budget = bytes;
+    if (spill_path != NULL) {
+        snprintf(r->spill_path, sizeof(r->spill_path), "%s", spill_path);
+    } else {
+        r->spill_path[0] = '\0';
+    }
+}
+
+// Reserves `bytes` in the spill file: the first hole left by a removed matrix
+// that is big enough, else the end of the file.
+static long spill_reserve(MatrixRegistry *r, size_t bytes) {
+    for (int i = 0; i < r->nholes; i++) {
+        if (r->holes[i].bytes >= bytes) {
+            long off = r->holes[i].off;
+            r->holes[i].off += (long)bytes;
+            r->holes[i].bytes -= bytes;
+            if (r->holes[i].bytes == 0) r->holes[i] = r->holes[--r->nholes];
+            return off;
+        }
+    }
+    long off = r->spill_end;
+    r->spill_end += (long)bytes;
+    return off;
+}
+
+// Gives the spill slot of a matrix leaving the registry back for reuse.
+static void spill_release(MatrixRegistry *r, const Matrix *m) {
+    if (m->spill_off < 0) return;
+    size_t bytes = matrix_bytes(m);
+    if (m->spill_off + (long)bytes == r->spill_end) {   // last slot: just shrink the used area
+        r->spill_end = m->spill_off;
+        return;
+    }
+    if (r->nholes == r->capholes) {
+        r->capholes = r->capholes ? r->capholes * 2 : 8;
+        r->holes = (SpillHole*)realloc(r->holes, (size_t)r->capholes * sizeof(SpillHole));
+        if (r->holes == NULL) die("realloc spill holes");
+    }
+    r->holes[r->nholes].off = m->spill_off;
+    r->holes[r->nholes].bytes = bytes;
+    r->nholes++;
+}
+
+// Writes the matrix data to the spill file and frees it from RAM.
+// Each matrix keeps the same slot in the file for its whole life (its size never changes).
+// Returns 0 on success, -1 if the spill file can't be used (matrix stays in RAM).
+static int spill_out(MatrixRegistry *r, Matrix *m) {
+    if (r->spill == NULL) {
+        if (r->spill_path[0] != '\0') {
+            struct stat st;
+            r->spill_created = stat(r->spill_path, &st) != 0;   // only a file we made is removed at exit
+            r->spill = fopen(r->spill_path, "w+b");
+        } else {
+            r->spill = tmpfile();   // removed automatically when closed
+        }
+        if (r->spill == NULL) {
+            perror("spill file");
+            return -1;
+        }
+    }
+    size_t bytes = matrix_bytes(m);
+    if (m->spill_off < 0) {          // First eviction: reserve a slot
+        m->spill_off = spill_reserve(r, bytes);
+    }
+    if (fseek(r->spill, m->spill_off, SEEK_SET) != 0 ||
+        fwrite(m->data, 1, bytes, r->spill) != bytes) {
+        perror("spill write");
+        return -1;
+    }
+    matrix_release_data(m);
+    m->spilled = 1;
+    det_state_free(m->det_state);    // n*n inverse isn't worth keeping for a cold matrix
+    m->det_state = NULL;
+    r->mem_used -= bytes;
+    r->spills++;
+    return 0;
+}
+
+// Reads a spilled matrix back from the spill file into a fresh buffer.
+static void spill_in(MatrixRegistry *r, Matrix *m) {
+    size_t bytes = matrix_bytes(m);
+    m->data = mat_alloc((size_t)m->rows * m->cols);
+    if (fseek(r->spill, m->spill_off, SEEK_SET) != 0 ||
+        fread(m->data, 1, bytes, r->spill) != bytes) {
+        die("spill read");           // the registry can't continue without the data
+    }
+    m->spilled = 0;
+    r->mem_used += bytes;
+}
+
+// Evicts least-recently-used matrices until the registry fits in its budget.
+// Pinned matrices (registry_acquire) are skipped, so the budget can be
+// exceeded for a short time when everything resident is in use.
+static void enforce_budget(MatrixRegistry *r) {
+    if (r->mem_budget == 0) {
+        return;   // Unlimited
+    }
+    while (r->mem_used > r->mem_budget) {
+        Matrix *victim = NULL;
+        for (int i = 0; i < r->count; i++) {
+            Matrix *m = r->items[i];
+            if (m == NULL || m->data == NULL) continue;   // spilled or not loaded yet
+            if (m->pins > 0) continue;   // in use by an op
+            if (victim == NULL || m->last_use < victim->last_use) {
+                victim = m;
+            }
+        }
+        if (victim == NULL || spill_out(r, victim) != 0) {
+            return;   // Nothing left to evict
+        }
+    }
+}
+
+// Moves the data of a freshly read matrix into the lazy matrix m and frees src.
+static void adopt_data(MatrixRegistry *r, Matrix *m, Matrix *src) {
+    m->data = src->data;
+    m->map_base = src->map_base;
+    m->map_len = src->map_len;
+    src->data = NULL;
+    src->map_base = NULL;
+    matrix_free(src);
+    free(m->src_path);
+    m->src_path = NULL;
+    r->mem_used += matrix_bytes(m);
+    r->loads++;
+}
+
+// Reads a lazy matrix from its source file. Returns 0, or -1 if the file
+// can't be read anymore (the matrix stays lazy).
+static int load_lazy(MatrixRegistry *r, Matrix *m) {
+    Matrix *src = NULL;
+    if (r->loader == NULL || r->loader(m, &src) != 0) {
+        fprintf(stderr, "Cannot load matrix '%s' from %s\n", m->name, m->src_path);
+        return -1;
+    }
+    adopt_data(r, m, src);
+    return 0;
+}
+
+// Makes room for a matrix just brought in, without evicting that matrix:
+// if it doesn't fit next to the pinned ones the budget is overshot instead.
+static void enforce_budget_for(MatrixRegistry *r, Matrix *m) {
+    m->pins++;
+    enforce_budget(r);
+    m->pins--;
+}
+
+// Marks a matrix as used now and brings its data back into RAM if needed.
+// Returns NULL if a lazy matrix can't be read.
+static Matrix *touch(MatrixRegistry *r, Matrix *m) {
+    m->last_use = ++r->clock;
+    if (m->spilled) {
+        r->misses++;
+        spill_in(r, m);
+        enforce_budget_for(r, m);
+    } else if (m->data == NULL && m->src_path != NULL) {
+        r->misses++;
+        if (load_lazy(r, m) != 0) return NULL;
+        enforce_budget_for(r, m);
+    } else {
+        r->hits++;
+    }
+    return m;
 }
 
 // Frees all matrices and the registry itself.
 void registry_free(MatrixRegistry *r) {
+    registry_prefetch_stop(r);
     // Free each matrix in the registry
     for (int i = 0; i < r->count; i++) {
         if (r->items[i] != NULL) {
@@ -19,6 +220,18 @@ void registry_free(MatrixRegistry *r) {
     r->items = NULL;
     r->count = 0;
     r->cap = 0;
+    r->mem_used = 0;
+    if (r->spill != NULL) {   // Close and remove the spill file
+        fclose(r->spill);
+        r->spill = NULL;
+        if (r->spill_created) {
+            unlink(r->spill_path);
+        }
+    }
+    free(r->holes);
+    r->holes = NULL;
+    r->nholes = r->capholes = 0;
+    pthread_mutex_destroy(&r->lock);
 }
 
 // Compares two matrix names (up to MAX_NAME characters)
@@ -26,9 +239,8 @@ static int name_eq(const char *a, const char *b) {
     return strncmp(a, b, MAX_NAME) == 0;
 }
 
-// Retrieves a matrix by name from the registry.
-// Returns NULL if not found.
-Matrix *registry_get(MatrixRegistry *r, const char *name) {
+// Finds a matrix by name without touching it (no LRU update, no fault-in).
+static Matrix *find(MatrixRegistry *r, const char *name) {
     for (int i = 0; i < r->count; i++) {
         if (r->items[i] != NULL) {
             if (name_eq(r->items[i]->name, name)) {
@@ -39,14 +251,183 @@ Matrix *registry_get(MatrixRegistry *r, const char *name) {
     return NULL;   // Not found
 }
 
+// Retrieves a matrix by name from the registry.
+// Spilled and lazy matrices are read into RAM before returning.
+// Returns NULL if not found.
+Matrix *registry_get(MatrixRegistry *r, const char *name) {
+    pthread_mutex_lock(&r->lock);
+    Matrix *m = find(r, name);
+    if (m != NULL) {
+        m = touch(r, m);
+    }
+    pthread_mutex_unlock(&r->lock);
+    return m;
+}
+
+// Retrieves the i-th matrix of the registry with its data in RAM.
+// Used by code that walks over all matrices (list, save all).
+Matrix *registry_at(MatrixRegistry *r, int i) {
+    pthread_mutex_lock(&r->lock);
+    Matrix *m = NULL;
+    if (i >= 0 && i < r->count && r->items[i] != NULL) {
+        m = touch(r, r->items[i]);
+    }
+    pthread_mutex_unlock(&r->lock);
+    return m;
+}
+
+// registry_get that also pins the matrix: it is not spilled (nor freed by
+// registry_remove) until the matching registry_release.
+Matrix *registry_acquire(MatrixRegistry *r, const char *name) {
+    pthread_mutex_lock(&r->lock);
+    Matrix *m = find(r, name);
+    if (m != NULL) {
+        m = touch(r, m);
+    }
+    if (m != NULL) {
+        m->pins++;
+    }
+    pthread_mutex_unlock(&r->lock);
+    return m;
+}
+
+// Pins a matrix the caller already holds, e.g. a result before registry_add.
+void registry_pin(MatrixRegistry *r, Matrix *m) {
+    pthread_mutex_lock(&r->lock);
+    m->pins++;
+    pthread_mutex_unlock(&r->lock);
+}
+
+// Drops one pin (m may be NULL). The last pin of a matrix removed meanwhile
+// frees it; otherwise the budget is enforced again, it may have waited for m.
+void registry_release(MatrixRegistry *r, Matrix *m) {
+    if (m == NULL) return;
+    pthread_mutex_lock(&r->lock);
+    if (--m->pins == 0 && m->removed) {
+        matrix_free(m);
+    } else {
+        enforce_budget(r);
+    }
+    pthread_mutex_unlock(&r->lock);
+}
+
+// Returns the i-th matrix as it is (spilled or lazy data stays where it is, no LRU
+// update), NULL if there is none. For code that only needs names and shapes.
+Matrix *registry_peek(MatrixRegistry *r, int i) {
+    pthread_mutex_lock(&r->lock);
+    Matrix *m = (i >= 0 && i < r->count) ? r->items[i] : NULL;
+    pthread_mutex_unlock(&r->lock);
+    return m;
+}
+
+// Looks a matrix up by name without bringing its data in (no LRU update).
+// For code that only needs to know whether the name is taken.
+Matrix *registry_find(MatrixRegistry *r, const char *name) {
+    pthread_mutex_lock(&r->lock);
+    Matrix *m = find(r, name);
+    pthread_mutex_unlock(&r->lock);
+    return m;
+}
+
+// Gives a registered matrix whose data was changed in place a new version.
+// The prefetch thread reads versions under the lock, so they change under it too.
+void registry_changed(MatrixRegistry *r, Matrix *m) {
+    pthread_mutex_lock(&r->lock);
+    matrix_bump_version(m);
+    pthread_mutex_unlock(&r->lock);
+}
+
+// Renames a matrix (registered or not) and marks it to be saved under the new name.
+void registry_rename(MatrixRegistry *r, Matrix *m, const char *name) {
+    pthread_mutex_lock(&r->lock);
+    snprintf(m->name, sizeof(m->name), "%s", name);
+    m->dirty = 1;
+    pthread_mutex_unlock(&r->lock);
+}
+
+// Prefetch thread: reads the lazy matrices one by one while the menu is running.
+// The file is parsed without the lock; the result is dropped if the matrix
+// was loaded, removed or changed meanwhile (versions are never reused).
+static void *prefetch_main(void *arg) {
+    MatrixRegistry *r = (MatrixRegistry*)arg;
+    for (int i = 0; !r->stop; i++) {
+        pthread_mutex_lock(&r->lock);
+        while (i < r->count && (r->items[i] == NULL || r->items[i]->data != NULL || r->items[i]->src_path == NULL)) i++;
+        if (i >= r->count) {
+            pthread_mutex_unlock(&r->lock);
+            break;
+        }
+        Matrix *m = r->items[i];
+        uint64_t version = m->version;
+        Matrix shell;                       // source info only, read under the lock
+        memset(&shell, 0, sizeof(shell));
+        shell.rows = m->rows;
+        shell.cols = m->cols;
+        shell.src_entry = m->src_entry;
+        shell.src_sum = m->src_sum;
+        shell.src_path = strdup(m->src_path);
+        pthread_mutex_unlock(&r->lock);
+
+        Matrix *src = NULL;
+        int rc = r->loader(&shell, &src);
+        free(shell.src_path);
+        if (rc != 0) continue;              // reported again on first use
+
+        pthread_mutex_lock(&r->lock);
+        int k = 0;
+        while (k < r->count && !(r->items[k] == m && m->version == version)) k++;
+        if (k < r->count && m->data == NULL && m->src_path != NULL) {
+            adopt_data(r, m, src);
+            src = NULL;
+        }
+        pthread_mutex_unlock(&r->lock);
+        matrix_free(src);
+    }
+    return NULL;
+}
+
+// Starts reading all lazy matrices in the background (no-op without a loader).
+void registry_prefetch_start(MatrixRegistry *r) {
+    if (r->prefetching || r->loader == NULL) return;
+    r->stop = 0;
+    if (pthread_create(&r->prefetch, NULL, prefetch_main, r) == 0) {
+        r->prefetching = 1;
+    } else {
+        perror("prefetch thread");
+    }
+}
+
+// Stops the prefetch thread and waits for it (the file in progress finishes first).
+void registry_prefetch_stop(MatrixRegistry *r) {
+    if (!r->prefetching) return;
+    r->stop = 1;
+    pthread_join(r->prefetch, NULL);
+    r->prefetching = 0;
+}
+
+// Prints the memory budget usage and the get hit/miss counters.
+void registry_print_stats(const MatrixRegistry *r) {
+    printf("registry: %d matrices, %.1f MB in RAM (budget %s%.1f MB), hits=%llu misses=%llu spills=%llu loads=%llu\n",
+           r->count,
+           (double)r->mem_used / (1024.0 * 1024.0),
+           r->mem_budget ? "" : "unlimited, ",
+           (double)r->mem_budget / (1024.0 * 1024.0),
+           (unsigned long long)r->hits,
+           (unsigned long long)r->misses,
+           (unsigned long long)r->spills,
+           (unsigned long long)r->loads);
+}
+
 // Adds a matrix to the registry.
 // Returns 0 on success, -1 if matrix is NULL or already exists.
 int registry_add(MatrixRegistry *r, Matrix *m) {
     if (m == NULL) {
         return -1;  // Cannot add NULL
     }
+    pthread_mutex_lock(&r->lock);
     // Check for duplicate by name
-    if (registry_get(r, m->name) != NULL) {
+    if (find(r, m->name) != NULL) {
+        pthread_mutex_unlock(&r->lock);
         fprintf(stderr, "Matrix '%s' already exists.\n", m->name);
         return -1;
     }
@@ -66,32 +447,53 @@ int registry_add(MatrixRegistry *r, Matrix *m) {
     r->items[r->count] = m;
     r->count++;
 
+    matrix_bump_version(m);   // entering the registry counts as a change for cached results
+
+    // Account for its data and spill older matrices if we went over budget
+    m->last_use = ++r->clock;
+    if (m->data != NULL) {   // lazy matrices count once they are read
+        r->mem_used += matrix_bytes(m);
+    }
+    enforce_budget_for(r, m);   // the caller still holds m
+    pthread_mutex_unlock(&r->lock);
+
     return 0;
 }
 
 // Removes a matrix by name from the registry.
 // Returns 0 on success, -1 if not found.
 int registry_remove(MatrixRegistry *r, const char *name) {
+    pthread_mutex_lock(&r->lock);
     for (int i = 0; i < r->count; i++) {
         if (r->items[i] != NULL) {
             if (name_eq(r->items[i]->name, name)) {
-                matrix_free(r->items[i]);     // Free the matrix
+                Matrix *m = r->items[i];
+                if (m->data != NULL) {
+                    r->mem_used -= matrix_bytes(m);
+                }
+                spill_release(r, m);
+                if (m->pins > 0) {
+                    m->removed = 1;            // still in use, the last registry_release frees it
+                } else {
+                    matrix_free(m);            // Free the matrix
+                }
                 // Shift remaining items left
                 for (int k = i + 1; k < r->count; k++) {
                     r->items[k - 1] = r->items[k];
                 }
                 r->count--;
+                pthread_mutex_unlock(&r->lock);
                 return 0;  // Success
             }
         }
     }
+    pthread_mutex_unlock(&r->lock);
     fprintf(stderr, "Matrix '%s' not found.\n", name);
     return -1;
 }
 
-// Creates a new matrix with the specified id, number of rows and columns.
-// Returns A pointer to the newly created Matrix. The caller is responsible for freeing it
-Matrix *matrix_create(const char *name, int rows, int cols) {
+// Allocates and fills the Matrix structure, without the data.
+static Matrix *matrix_new(const char *name, int rows, int cols) {
     // Allocate memory for the Matrix structure
     Matrix *m = (Matrix*)xmalloc(sizeof(Matrix));
     // Clear all fields to zero to avoid uninitialized values
@@ -106,21 +508,65 @@ Matrix *matrix_create(const char *name, int rows, int cols) {
     // Set matrix dimensions
     m->rows = rows;
     m->cols = cols;
+    m->spill_off = -1;   // Never written to the spill file yet
+    m->src_entry = -1;
+    matrix_bump_version(m);
+    return m;
+}
 
-    // Allocate memory for the matrix data (rows * cols doubles)
-    m->data = (double*)xmalloc((size_t)rows * cols * sizeof(double));
+// Creates a new matrix with the specified id, number of rows and columns.
+// Returns A pointer to the newly created Matrix. The caller is responsible for freeing it
+Matrix *matrix_create(const char *name, int rows, int cols) {
+    Matrix *m = matrix_new(name, rows, cols);
 
-    // Initialize all elements of the data array to zero
-    memset(m->data, 0, (size_t)rows * cols * sizeof(double));
+    // Allocate the matrix data (rows * cols doubles) from the buffer cache,
+    // initialized to zero (fresh mmap pages are zero already and are not touched)
+    m->data = mat_alloc_zeroed((size_t)rows * cols);
     return m; // Return the pointer to the newly created matrix
 }
 
+// Creates a matrix whose data lives inside a file mapping (zero-copy load).
+// The mapping must be MAP_PRIVATE and writable: the first write to a page makes
+// a private copy of it, the file itself is never changed. matrix_free unmaps it.
+Matrix *matrix_create_mapped(const char *name, int rows, int cols, double *data, void *map_base, size_t map_len) {
+    Matrix *m = matrix_new(name, rows, cols);
+    m->data = data;
+    m->map_base = map_base;
+    m->map_len = map_len;
+    return m;
+}
+
+// Creates a matrix whose data is still in a file: only the shape is known.
+// The registry reads the data on first use through its loader.
+Matrix *matrix_create_lazy(const char *name, int rows, int cols, const char *src_path, int src_entry) {
+    Matrix *m = matrix_new(name, rows, cols);
+    m->src_path = strdup(src_path);
+    if (m->src_path == NULL) die("strdup");
+    m->src_entry = src_entry;
+    return m;
+}
+
+// Frees the data of a matrix (buffer cache or file mapping), keeps the structure.
+void matrix_release_data(Matrix *m) {
+    if (m->map_base != NULL) {
+        munmap(m->map_base, m->map_len);
+        m->map_base = NULL;
+        m->map_len = 0;
+    } else {
+        mat_free(m->data);
+    }
+    m->data = NULL;
+}
+
 // Frees a matrix and its data
 void matrix_free(Matrix *m) {
 
     if (m == NULL) {
         return;  // Nothing to free
     }
-    free(m->data);
+    matrix_release_data(m);
+    det_state_free(m->det_state);
+    mat_free(m->eig_vec);
+    free(m->src_path);
     free(m);
 }
@@ -5,8 +5,21 @@
 #include "ops.h"
 #include "pool.h"
 #include "timer.h"
+#include "mat_alloc.h"
+#include "result_cache.h"
+#include "det_update.h"
+#include "maintained.h"
+#include "container.h"
+#include "ooc_mul.h"
+#include "aio.h"
+#include "npy.h"
+#include "output.h"
+#include "backend.h"
+#include "cost.h"
 #include <sys/stat.h>
  
+#define MENU_OPS 22           // number of operation codes (1..MENU_OPS) the menu knows
+
 // Global flag to indicate whether OpenMP is enabled
 #ifdef HAVE_OMP
 int g_omp_enabled = 1;
@@ -17,6 +30,8 @@ int g_omp_enabled = 0;
 static MatrixRegistry g_reg;  // Global registry for matrices
 static Pool *g_pool = NULL;   // Global process pool pointer
 static int g_next_id = 1;     // Global ID counter for assigning unique matrix IDs
+static int g_save_async = 0;   // save all runs on a background thread (config save_async)
+static size_t g_ooc_mem = 256u << 20;  // buffer bytes for out-of-core multiply (config ooc_mem_mb)
 
 // Returns a string for OpenMP state ("ON" or "OFF")
 static const char* omp_state_str(void) {
@@ -32,7 +47,7 @@ static void rename_to_id(Matrix *m, int id) {
 
     char nbuf[MAX_NAME];   // Temporary buffer for integer -> string
     snprintf(nbuf, sizeof(nbuf), "%d", id);       // Convert id to string
-    snprintf(m->name, sizeof(m->name), "%s", nbuf);  // Copy string into matrix name
+    registry_rename(&g_reg, m, nbuf);  // Copy string into matrix name, saved under it next time
 }
 
 // Assigns a new unique ID to the matrix and renames it
@@ -58,6 +73,13 @@ static void print_matrix_raw(const Matrix *m) {
     }
 }
 
+// File label for the eigenvector of A ("eig_<id>")
+static const char *eig_label(const Matrix *A) {
+    static char label[MAX_NAME + 8];
+    snprintf(label, sizeof(label), "eig_%s", A->name);
+    return label;
+}
+
 // Prints the matrix with its ID and dimensions as a header
 static void print_matrix_with_header(const Matrix *m) {
     printf("ID : %s, dimension : %d*%d\n", m->name, m->rows, m->cols);  // Header
@@ -163,6 +185,7 @@ static void delete_matrix() {
     }
 
     if (ans == 'y' || ans == 'Y') {
+        maint_forget(key);// products that use it can't be maintained anymore
         registry_remove(&g_reg, key);
         printf("Deleted ID %d\n", id);
     } else {
@@ -170,7 +193,16 @@ static void delete_matrix() {
     }
 }
 
+// Euclidean norm of the change between new and old values of a row/column
+static double edit_norm(const double *vals, const double *old, int n) {
+    double s = 0.0;
+    for (int k = 0; k < n; k++) s += (vals[k] - old[k]) * (vals[k] - old[k]);
+    return sqrt(s);
+}
+
 // Edit matrix values
+// All new values are read first and applied together, so a bad entry leaves the matrix untouched.
+// The overwritten values are passed to the edit hooks (incremental determinant).
 static void modify_matrix() {
 
     int id;
@@ -196,6 +228,11 @@ static void modify_matrix() {
         return;
     }
 
+    uint64_t from_version = m->version;// version before the edit, for the incremental states
+    int len = (m->rows > m->cols) ? m->rows : m->cols;
+    double *vals = mat_alloc((size_t)len);// new values
+    double *old = mat_alloc((size_t)len);// overwritten row / column
+
     if (choice == 1) { // if the change on a specific value, get i:rows index, j:col index "both start from 0 idex " v:new value
 
         int i, j;
@@ -203,14 +240,19 @@ static void modify_matrix() {
         printf("i j v: ");
         if (scanf("%d %d %lf", &i, &j, &v)!= 3) {        
                 fprintf(stderr, "Invalid entry.\n");
-                return;
+                goto out;
             }
 
         if (i < 0 || i >= m->rows || j < 0 || j >= m->cols) {
             printf("Index out of range\n");
-            return;
+            goto out;
         }
+        for (int c = 0; c < m->cols; c++) old[c] = matrix_get(m, i, c);// a cell edit is a row edit with one change
         matrix_set(m, i, j, v);// function that take the matrix id and apply new data to the matrix 
+        registry_changed(&g_reg, m);// content changed, cached results of this matrix are stale
+        eig_warm_note_edit(m, fabs(v - old[j]));
+        det_state_row_changed(m, from_version, i, old);
+        maint_row_changed(&g_reg, m, from_version, i, old);// patch products that use this matrix
 
     } else if (choice == 2) { // change a full row, get i:row index, v: set of new valuse as num as col 
 
@@ -218,21 +260,27 @@ static void modify_matrix() {
         printf("Row index: ");
         if ( scanf(" %d", &i)!= 1) {        
                 fprintf(stderr, "Invalid entry.\n");
-                return;
+                goto out;
             }
         if (i < 0 || i >= m->rows) {
             printf("Index out of range\n");
-            return;
+            goto out;
         }
 
         for (int j = 0; j < m->cols; j++) {
-            double v;
-            if ( scanf(" %lf", &v)!= 1) {        
+            if ( scanf(" %lf", &vals[j])!= 1) {        
             fprintf(stderr, "Invalid entry.\n");
-            return;
+            goto out;
               }
-            matrix_set(m, i, j, v);
         }
+        for (int j = 0; j < m->cols; j++) {
+            old[j] = matrix_get(m, i, j);
+            matrix_set(m, i, j, vals[j]);
+        }
+        registry_changed(&g_reg, m);
+        eig_warm_note_edit(m, edit_norm(vals, old, m->cols));
+        det_state_row_changed(m, from_version, i, old);
+        maint_row_changed(&g_reg, m, from_version, i, old);
 
     } else if (choice == 3) {// change a full col, get j:col index, v: set of new valuse as num as row 
 
@@ -240,30 +288,40 @@ static void modify_matrix() {
         printf("Column index: ");
         if ( scanf(" %d", &j)!= 1) {        
         fprintf(stderr, "Invalid entry.\n");
-        return;
+        goto out;
     }
 
         if (j < 0 || j >= m->cols) {
             printf("Index out of range\n");
-            return;
+            goto out;
         }
 
         for (int i = 0; i < m->rows; i++) {
-            double v;
-            if ( scanf(" %lf", &v)!= 1) {        
+            if ( scanf(" %lf", &vals[i])!= 1) {        
         fprintf(stderr, "Invalid entry.\n");
-        return;
+        goto out;
     }
-            matrix_set(m, i, j, v);
         }
+        for (int i = 0; i < m->rows; i++) {
+            old[i] = matrix_get(m, i, j);
+            matrix_set(m, i, j, vals[i]);
+        }
+        registry_changed(&g_reg, m);
+        eig_warm_note_edit(m, edit_norm(vals, old, m->rows));
+        det_state_col_changed(m, from_version, j, old);
+        maint_col_changed(&g_reg, m, from_version, j, old);
 
     } else {
         printf("Invalid choice\n");
-        return;
+        goto out;
     }
-    // Show updated matrix
+    // Show updated matrix (fetched again: updating products may have spilled it)
+    m = registry_get(&g_reg, key);
     printf("Updated matrix (ID=%d):\n", id);
     print_matrix_with_header(m);
+out:
+    mat_free(vals);
+    mat_free(old);
 }
 
 // options in menu I/O FUNCTIONS
@@ -318,7 +376,7 @@ static void read_dir() {
     // Process only newly-loaded matrices
     for (int i = prev; i < g_reg.count; ++i) {
 
-        Matrix *m = g_reg.items[i];
+        Matrix *m = registry_at(&g_reg, i);  // may read it back if loading spilled it
         if (m == NULL)
             continue;
         int id = assign_new_id(m);   // Assign a proper ID
@@ -374,12 +432,101 @@ static void save_all() {
         return;
     }
 
-    mkdir(dir, 0777);  // Ensure folder exists (ignore failure)
+    if (!is_container_path(dir))
+        mkdir(dir, 0777);  // Ensure folder exists (ignore failure)
 
-    if (save_all_to_dir(dir, &g_reg) < 0)
+    int n = save_all_to_dir(dir, &g_reg, g_save_async);
+    if (n < 0)
         printf("Failed to save all\n");
+    else if (g_save_async)
+        printf("Saving %d changed matrices to %s in the background (%d unchanged)\n", n, dir, g_reg.count - n);
     else
-        printf("Saved all matrices to %s\n", dir);
+        printf("Saved all matrices to %s (%d written, %d unchanged)\n", dir, n, g_reg.count - n);
+}
+
+// Multiply two .mbin files into a third one without loading them:
+// panels stream through a buffer of ooc_mem_mb
+static void mul_out_of_core() {
+
+    char a[256], b[256], c[256];
+    printf("A file (.mbin): ");
+    if ( scanf(" %255s", a)!= 1) {
+        fprintf(stderr, "Invalid entry.\n");
+        return;
+    }
+    printf("B file (.mbin): ");
+    if ( scanf(" %255s", b)!= 1) {
+        fprintf(stderr, "Invalid entry.\n");
+        return;
+    }
+    printf("Result file (.mbin): ");
+    if ( scanf(" %255s", c)!= 1) {
+        fprintf(stderr, "Invalid entry.\n");
+        return;
+    }
+    if (strcmp(c, a) == 0 || strcmp(c, b) == 0) {
+        printf("The result must go to a new file\n");
+        return;
+    }
+    OocStats st;
+    if (ooc_mul_files(a, b, c, g_ooc_mem, &st) < 0) {
+        printf("Out-of-core multiply failed\n");
+        return;
+    }
+    printf("[OUT-OF-CORE mul] (OMP=%s) -> %s  tiles %dx%dx%d, %.1f MB buffers\n",
+           omp_state_str(), c, st.tile_m, st.tile_n, st.tile_k, st.buffer_bytes / 1048576.0);
+    printf("  time=%llums, read %.1f MB, wrote %.1f MB, waited %llums for reads\n",
+           (unsigned long long)st.total_ms, st.read_mb, st.write_mb, (unsigned long long)st.wait_ms);
+}
+
+// Pick how op results are shown: nothing, a summary, the corners, everything or files
+static void choose_output() {
+
+    char mode[16];
+    printf("Output (none, summary, head, full, file) [now %s]: ", output_mode_name(output_mode()));
+    if ( scanf(" %15s", mode)!= 1) {
+        fprintf(stderr, "Invalid entry.\n");
+        return;
+    }
+    int m = output_parse_mode(mode);
+    if (m < 0) {
+        printf("unknown output mode\n");
+        return;
+    }
+    int head = 0;
+    char dir[256] = "";
+    if (m == OUT_HEAD) {
+        printf("Rows/columns at each end: ");
+        if ( scanf(" %d", &head)!= 1 || head < 1) {
+            fprintf(stderr, "Invalid entry.\n");
+            return;
+        }
+    } else if (m == OUT_FILE) {
+        printf("Folder: ");
+        if ( scanf(" %255s", dir)!= 1) {
+            fprintf(stderr, "Invalid entry.\n");
+            return;
+        }
+    }
+    output_set(m, head, dir);
+    printf("Results are shown as: %s\n", output_mode_name(m));
+}
+
+// Write the whole registry (IDs, next ID, data) to one image file
+static void snapshot() {
+
+    char path[256];
+    printf("Snapshot file (.mpak): ");
+    if ( scanf(" %255s", path)!= 1) {
+        fprintf(stderr, "Invalid entry.\n");
+        return;
+    }
+    uint64_t t0 = now_millis();
+    if (save_snapshot(path, &g_reg, (uint64_t)g_next_id) < 0)
+        printf("Failed to write snapshot\n");
+    else
+        printf("Snapshot of %d matrices written to %s in %llu ms\n",
+               g_reg.count, path, (unsigned long long)(now_millis() - t0));
 }
 
 //Menu option of Display ALL
@@ -392,21 +539,42 @@ static void list_all() {
         return;
     }
     for (int i = 0; i < g_reg.count; i++) {
-        Matrix *m = g_reg.items[i];
+        Matrix *m = registry_at(&g_reg, i);
         if (m == NULL)
             continue;
         print_matrix_with_header(m);
     }
+    if (g_reg.mem_budget > 0) {
+        registry_print_stats(&g_reg);  // show spill activity when a budget is set
+    }
+    mat_alloc_print_stats();  // buffers served from the size-class cache
+    rcache_print_stats();     // and results served from the result cache
+}
+
+// Prints the per-backend lines of a compare run
+static void print_compare(const BackendRun *runs, int n, int scalar) {
+    for (int i = 0; i < n; i++) {
+        const BackendRun *r = &runs[i];
+        if (!r->ok) {
+            printf("[%s] failed\n", backend_title(r->backend));
+        } else if (scalar) {
+            printf("[%s] = %.10g  time=%.3fms  |diff|=%.3g", backend_title(r->backend), r->value,
+                   r->ms, r->diff);
+            if (r->has_vec) printf("  vector max|diff|=%.3g", r->vec_diff);
+            printf("\n");
+        } else {
+            printf("[%s] time=%.3fms  max|diff|=%.3g\n", backend_title(r->backend),
+                   r->ms, r->diff);
+        }
+    }
 }
 
 //Reads two matrix IDs from the user.
 //Retrieves matrices A and B from the registry.
-//Measures execution time for both paths.
-//Stores the single-process result in memory (registry).
-//Prints both results.
-//Multi-process result is NOT stored (only printed then freed).
-//Single-process is stored because it has a unique ID.
-static void add_two() {
+//Runs the op on the session backend for it (backend= / backend_<op>= in the
+//config, menu op 22), or on every backend in compare mode.
+//Stores the result in memory (registry) and shows it per the output policy.
+static void binary_op(int op) {
 
     int idA, idB;        // variables to store user-selected matrix IDs
     printf("A ID: ");      // ask user for first matrix ID
@@ -428,189 +596,136 @@ static void add_two() {
     snprintf(a, sizeof(a), "%d", idA);// convert idA (int) → string key
     snprintf(b, sizeof(b), "%d", idB);// convert idB (int) → string key
 
-    Matrix *A = registry_get(&g_reg, a);// retrieve matrix A from registry
-    Matrix *B = registry_get(&g_reg, b);// retrieve matrix B from registry
+    // pinned: fetching B or adding C must not spill an operand still in use
+    Matrix *A = registry_acquire(&g_reg, a);// retrieve matrix A from registry
+    Matrix *B = registry_acquire(&g_reg, b);// retrieve matrix B from registry
+    Matrix *C = NULL;
 
     if (!A || !B) {// full IF BLOCK: ensure both matrices exist
         printf("missing matrices\n");                              
-        return;                                                 
+        goto out;
     }
 
-    char out_single[MAX_NAME];// buffer for temporary output matrix name (string ID)
-    snprintf(out_single, sizeof(out_single), "%d", g_next_id);// next available ID before assignment
-
-    uint64_t t0 = now_millis();// start time for single-process timing
-
-    Matrix *C_single = op_add_single(A, B, out_single);// perform single-process matrix addition
-
-    uint64_t t1 = now_millis();// end time measurement for single-process mode
-
-    if (!C_single) { // full IF BLOCK
-        printf("add failed\n");                                   
-        return;                                                   
+    RCacheKey ck;
+    if (op == BOP_MUL) {
+        rcache_key(&ck, RC_MUL, A, B, 0.0, 0);               // same operands, same versions -> same product
+        const RCacheValue *hit = rcache_lookup(&ck);
+        if (hit) {                                           // copy the cached product into a new ID
+            C = matrix_create("", hit->mat->rows, hit->mat->cols);
+            memcpy(C->data, hit->mat->data, matrix_bytes(C));
+            int id = assign_new_id(C);
+            registry_pin(&g_reg, C);
+            registry_add(&g_reg, C);
+            printf("\n(ID=%d, %dx%d)\n[CACHED result] (cache hits=%llu)\n",
+                   id, C->rows, C->cols, rcache_hits());
+            output_matrix(C, C->name);
+            goto out;
+        }
     }
 
-    int id_single = assign_new_id(C_single);// assign unique ID and rename matrix accordingly
-    registry_add(&g_reg, C_single);// store result matrix in registry
-
-    printf("\n(ID=%d, %dx%d) \n[SINGLE-PROCESS result] (OMP=%s)  time=%llums\n",
-           id_single, // print assigned ID
-           C_single->rows, C_single->cols,// dimensions
-           omp_state_str(),// OMP status (ON/OFF)
-           (unsigned long long)(t1 - t0));// execution time in ms
-
-    print_matrix_raw(C_single);// display final matrix values (no header)
-
-    t0 = now_millis();// start timing: multi-process version
-
-    Matrix *C_mp = op_add_processes(g_pool, A, B, "_tmp");
-
-    uint64_t t2 = now_millis();// end timing for multi-process addition
-
-    if (C_mp) {// full IF BLOCK: ensure multi-process succeeded
-        printf("\n[MULTI-PROCESS result] (already saved)   time=%llums\n",
-               (unsigned long long)(t2 - t0));// print execution time
-        print_matrix_raw(C_mp);// display multi-process final matrix
-        matrix_free(C_mp);// free temporary result (not saved to registry)
-    }
-    else {// fallback if it failed
-        printf("\n[MULTI-PROCESS] failed\n");// error message
+    int bk = backend_get(op);
+    BackendRun runs[BK_CONCRETE];
+    int nruns = 0;
+    uint64_t t0 = now_nanos();// start time
+    if (bk == BK_COMPARE) {
+        C = backend_compare_binary(op, g_pool, A, B, runs, &nruns);// every backend, first result kept
+    } else {
+        bk = backend_resolve(bk, op, g_pool, A, B);// auto -> cheapest by the machine model
+        C = backend_binary(bk, op, g_pool, A, B);
     }
-}
-// as add
-static void sub_two() {
+    uint64_t t1 = now_nanos();// end time
 
-    int idA,idB;                                            
-
-    printf("A ID: ");                                       
-    if ( scanf(" %d", &idA)!= 1) {        
-        fprintf(stderr, "Invalid entry.\n");
-        return;
-    }                                   
-    printf("B ID: ");                                      
-     if ( scanf(" %d", &idB)!= 1) {        
-        fprintf(stderr, "Invalid entry.\n");
-        return;
-    }                                    
-
-    char a[MAX_NAME], b[MAX_NAME];                         
-
-    snprintf(a, sizeof(a), "%d", idA);// convert idA to string key
-    snprintf(b, sizeof(b), "%d", idB);// convert idB to string key
-
-
-    Matrix *A = registry_get(&g_reg, a);// retrieve matrix A by key
-    Matrix *B = registry_get(&g_reg, b);// retrieve matrix B by key
-
-    //CHECK: both matrices must exist -
-    if (!A || !B) {                                          
-        printf("missing matrices\n");                      
-        return;                                           
+    if (!C) { // full IF BLOCK
+        printf("%s failed\n", backend_op_name(op));                                   
+        goto out;
     }
-    char out_single[MAX_NAME];       // name buffer for output matrix
-    snprintf(out_single, sizeof(out_single), "%d", g_next_id); // temporary name matching next ID
-    uint64_t t0 = now_millis();// timestamp: start single-process
-    Matrix *C_single = op_sub_single(A, B, out_single);      // do subtraction (single process)
-    uint64_t t1 = now_millis();// timestamp: end single-process
+    if (op == BOP_MUL)
+        rcache_put(&ck, 0.0, 0, NULL, 0, C);// remember the product for A,B at these versions
 
+    int id = assign_new_id(C);// assign unique ID and rename matrix accordingly
+    registry_pin(&g_reg, C);// stays in RAM until it has been shown
+    registry_add(&g_reg, C);// store result matrix in registry
 
-    //CHECK: ensure subtraction succeeded
-    if (!C_single) {// check returned matrix pointer
-        printf("sub failed\n");                          
-        return;                                             
+    if (bk == BK_COMPARE) {
+        printf("\n(ID=%d, %dx%d)\n", id, C->rows, C->cols);
+        print_compare(runs, nruns, 0);// times and differences to the kept result
+    } else {
+        printf("\n(ID=%d, %dx%d) \n[%s result] (OMP=%s)  time=%.3fms\n",
+               id, // print assigned ID
+               C->rows, C->cols,// dimensions
+               backend_title(bk),// which implementation ran
+               bk == BK_SINGLE ? "OFF" : bk == BK_OMP ? "ON" : omp_state_str(),// OMP status (ON/OFF)
+               (double)(t1 - t0) * 1e-6);// execution time in ms
+        backend_report(bk, op, A, B, 0, t1 - t0, 0);// GFLOP/s, GB/s and the pool phases
     }
+    output_matrix(C, C->name);// display final matrix values (per the output policy)
+out:
+    registry_release(&g_reg, A);
+    registry_release(&g_reg, B);
+    registry_release(&g_reg, C);
+}
 
-    int id_single = assign_new_id(C_single);       
-    registry_add(&g_reg, C_single);                  
-
-    printf("\n(ID=%d, %dx%d) \n[SINGLE-PROCESS result] (OMP=%s)  time=%llums\n",
-           id_single,                                
-           C_single->rows, C_single->cols,                   
-           omp_state_str(),                                 
-           (unsigned long long)(t1 - t0));                 
-
-    print_matrix_raw(C_single);                
-    t0 = now_millis();    // timestamp: start multi-process
-    Matrix *C_mp = op_sub_processes(g_pool, A, B, "_tmp");   // perform subtraction via processes
-
-    uint64_t t2 = now_millis(); // timestamp: end multi-process
-
-    //CHECK: multi-process success
-    if (C_mp) {                                             
-        printf("\n[MULTI-PROCESS result] (already saved)    time=%llums\n",
-               (unsigned long long)(t2 - t0));   
+static void add_two() {
+    binary_op(BOP_ADD);
+}
 
-        print_matrix_raw(C_mp);               
-        matrix_free(C_mp);                     
-    }
-    else {                                     
-        printf("\n[MULTI-PROCESS] failed\n");     
-    }
+static void sub_two() {
+    binary_op(BOP_SUB);
 }
-// (1) single-process (optionally with OMP)
-//(2) multi-process using child processes + pipes
-//Measures execution time for both.
+
 static void mul_two() {
+    binary_op(BOP_MUL);
+}
 
-    int idA, idB;              
+// Multiply A*B and keep the result maintained: later row/column edits of A or B
+// through modify_matrix patch the result in O(n^2) under the same ID.
+static void mul_maintained() {
 
-    printf("A ID: ");                                   
-    if ( scanf(" %d", &idA)!= 1) {        
-        fprintf(stderr, "Invalid entry.\n");
-        return;
-    }               
+    int idA, idB;
 
-    printf("B ID: ");                              
-     if ( scanf(" %d", &idB)!= 1) {        
+    printf("A ID: ");
+    if ( scanf(" %d", &idA)!= 1) {
         fprintf(stderr, "Invalid entry.\n");
         return;
-    }                      
-    char a[MAX_NAME], b[MAX_NAME];                           // buffers for string keys
-    snprintf(a, sizeof(a), "%d", idA);                       // convert numeric idA → string key
-    snprintf(b, sizeof(b), "%d", idB);                       // convert numeric idB → string key
-    Matrix *A = registry_get(&g_reg, a);                     // fetch matrix A from registry
-    Matrix *B = registry_get(&g_reg, b);                     // fetch matrix B from registry
-
-    if (!A || !B) {                                          // if either pointer is NULL
-        printf("missing matrices\n");                        // print error
-        return;                                              // abort operation
-    }
-    char out_single[MAX_NAME];                           
-    snprintf(out_single, sizeof(out_single), "%d", g_next_id); // temp name matching next ID
-    uint64_t t0 = now_millis();                            
-    Matrix *C_single = op_mul_single(A, B, out_single);      
-    uint64_t t1 = now_millis();             
-    
-    //CHECK: multiplication succeeded 
-    if (!C_single) {                                     
-        printf("mul failed\n"); 
+    }
+    printf("B ID: ");
+    if ( scanf(" %d", &idB)!= 1) {
+        fprintf(stderr, "Invalid entry.\n");
         return;
     }
-    int id_single = assign_new_id(C_single);                
-    registry_add(&g_reg, C_single);                        
-    printf("\n(ID=%d, %dx%d)\n[SINGLE-PROCESS result] (OMP=%s)  time=%llums\n",
-           id_single,                                        
-           C_single->rows, C_single->cols,                  
-           omp_state_str(),                              
-           (unsigned long long)(t1 - t0));              
-
-    print_matrix_raw(C_single);                            
-    t0 = now_millis();                                     
-    Matrix *C_mp = op_mul_processes(g_pool, A, B, "_tmp");   
-    uint64_t t2 = now_millis();                          
-
-
-    //CHECK: multi-process success
-    if (C_mp) {                                           
-        printf("\n[MULTI-PROCESS result] (already saved) (OMP=%s) time=%llums\n",
-               omp_state_str(),                        
-               (unsigned long long)(t2 - t0));      
-        print_matrix_raw(C_mp);                             
-        matrix_free(C_mp);                                 
+    char a[MAX_NAME], b[MAX_NAME];
+    snprintf(a, sizeof(a), "%d", idA);
+    snprintf(b, sizeof(b), "%d", idB);
+    Matrix *A = registry_acquire(&g_reg, a);
+    Matrix *B = registry_acquire(&g_reg, b);
+    Matrix *C = NULL;
+    if (!A || !B) {
+        printf("missing matrices\n");
+        goto out;
     }
-    else {                                                  
-        printf("\n[MULTI-PROCESS] failed\n");                
+
+    uint64_t t0 = now_nanos();
+    C = op_mul_single(A, B, "");
+    uint64_t t1 = now_nanos();
+    if (!C) {
+        printf("mul failed\n");
+        goto out;
     }
+    int id = assign_new_id(C);
+    registry_pin(&g_reg, C);
+    registry_add(&g_reg, C);
+    maint_add(C, A, B);// record versions after registry_add gave C its final one
+
+    printf("\n(ID=%d, %dx%d)\n[MAINTAINED product of %d*%d] (OMP=%s)  time=%.3fms\n",
+           id, C->rows, C->cols, idA, idB, omp_state_str(), (double)(t1 - t0) * 1e-6);
+    backend_report(BK_SINGLE, BOP_MUL, A, B, 0, t1 - t0, 0);
+    output_matrix(C, C->name);
+    printf("Edits to %d or %d now update ID %d in place (%d maintained products)\n",
+           idA, idB, id, maint_count());
+out:
+    registry_release(&g_reg, A);
+    registry_release(&g_reg, B);
+    registry_release(&g_reg, C);
 }
 
 static void determinant() {
@@ -641,27 +756,50 @@ static void determinant() {
         return;                                       
     }
 
-    uint64_t t0 = now_millis();// timestamp: start single-process
-    double d_single = op_det_single(A);// compute determinant single-process
-    uint64_t t1 = now_millis();// timestamp: end single-process
+    RCacheKey ck;
+    rcache_key(&ck, RC_DET, A, NULL, 0.0, 0);
+    const RCacheValue *hit = rcache_lookup(&ck);
+    if (hit) {// unchanged since the last det, reuse it
+        printf("\n(ID=%d, %dx%d)\n[CACHED det] = %.6f  (cache hits=%llu)\n",
+               id, A->rows, A->cols, hit->scalar, rcache_hits());
+        return;
+    }
 
-    printf("\n(ID=%d, %dx%d)\n[SINGLE-PROCESS det] (OMP=%s) = %.6f  time=%llums\n",
+    double d_inc;
+    int n_upd;
+    if (det_state_lookup(A, &d_inc, &n_upd)) {// kept up to date by modify_matrix in O(n^2)
+        printf("\n(ID=%d, %dx%d)\n[INCREMENTAL det] = %.6f  (rank-1 updates since factorization=%d)\n",
+               id, A->rows, A->cols, d_inc, n_upd);
+        rcache_put(&ck, d_inc, 0, NULL, 0, NULL);
+        return;
+    }
+
+    int bk = backend_get(BOP_DET);
+    if (bk == BK_COMPARE) {
+        BackendRun runs[BK_CONCRETE];
+        int nruns = 0;
+        double d = backend_compare_det(g_pool, A, runs, &nruns);
+        printf("\n(ID=%d, %dx%d)\n", id, A->rows, A->cols);
+        print_compare(runs, nruns, 1);
+        rcache_put(&ck, d, 0, NULL, 0, NULL);
+        det_state_seed(A, d);// the first edit builds the inverse
+        return;
+    }
+    bk = backend_resolve(bk, BOP_DET, g_pool, A, NULL);
+    uint64_t t0 = now_nanos();// timestamp: start
+    // compute determinant on the chosen backend, kept so later edits update it in O(n^2)
+    double d = backend_det_factor(bk, g_pool, A);
+    uint64_t t1 = now_nanos();// timestamp: end
+    rcache_put(&ck, d, 0, NULL, 0, NULL);
+
+    printf("\n(ID=%d, %dx%d)\n[%s det] (OMP=%s) = %.6f  time=%.3fms\n",
            id,                                               
            A->rows, A->cols,                                
-           omp_state_str(),                               
-           d_single,                                   
-           (unsigned long long)(t1 - t0));         
-    t0 = now_millis();                                    
-    double d_mp = op_det_processes(g_pool, A);         
-    uint64_t t2 = now_millis();                 
-    printf("[MULTI-PROCESS det] (OMP=%s) = %.6f  time=%llums\n",
-#ifdef HAVE_OMP
-           g_omp_enabled ? "ON" : "OFF",                      // OMP state if available
-#else
-           "OFF",                                             // always OFF if no OMP support
-#endif
-           d_mp,                                              // returned multiprocess det
-           (unsigned long long)(t2 - t0));                    // elapsed multi-process time
+           backend_title(bk),
+           bk == BK_SINGLE ? "OFF" : bk == BK_OMP ? "ON" : omp_state_str(),
+           d,                                   
+           (double)(t1 - t0) * 1e-6);
+    backend_report(bk, BOP_DET, A, NULL, 0, t1 - t0, 0);
 }
 
 static void eigen() {
@@ -689,63 +827,104 @@ static void eigen() {
                A->rows, A->cols);
         return;
     }
-    double lambda1, lambda2;// eigenvalues for both modes
-    double *vec1 = NULL, *vec2 = NULL;// eigenvectors (heap allocated)
+    double lambda;// eigenvalue
+    double *vec = NULL;// eigenvector (heap allocated)
+
+    RCacheKey ck;
+    rcache_key(&ck, RC_EIGEN, A, NULL, 1e-6, 1000);// same tolerance and max iterations as below
+    const RCacheValue *hit = rcache_lookup(&ck);
+    if (hit) {// matrix unchanged, reuse the converged pair
+        printf("\n(ID=%d, %dx%d) \n[CACHED eigen]  lambda ~ %.8f (iters=%d)  (cache hits=%llu)\n",
+               id, A->rows, A->cols, hit->scalar, hit->iters, rcache_hits());
+        output_vector(hit->vec, hit->vec_len, eig_label(A));
+        return;
+    }
 
 
-    //SINGLE-PROCESS EIGEN
-    uint64_t t0 = now_millis();// timestamp start
-    int it1 = op_eigen_power(// dominant eigen via power method
-                    A,
-                    1e-6,// tolerance
-                    1000,// max iterations
-                    &lambda1,// output eigenvalue
-                    &vec1);// output eigenvector
-    uint64_t t1 = now_millis();// timestamp end
+    //start from the eigenvector of an earlier solve on this matrix (or a slightly edited version of it)
+    double *x0 = NULL;
+    if (eig_warm_get(A)) {
+        x0 = mat_alloc((size_t)A->rows);
+        memcpy(x0, eig_warm_get(A), (size_t)A->rows * sizeof(double));
+    }
 
-    if (it1 < 0) {// negative = failure
-        printf("single-process eigen failed\n");
-        return;
+    int bk = backend_get(BOP_EIGEN);
+    BackendRun runs[BK_CONCRETE];
+    int nruns = 0;
+    if (bk != BK_COMPARE)
+        bk = backend_resolve(bk, BOP_EIGEN, g_pool, A, NULL);
+    uint64_t t0 = now_nanos();// timestamp start
+    int it;
+    for (;;) {
+        if (bk == BK_COMPARE)
+            it = backend_compare_eigen(g_pool, A, 1e-6, 1000, x0, &lambda, &vec, runs, &nruns);
+        else
+            it = backend_eigen(bk, g_pool, A,// dominant eigen via power method
+                               1e-6,// tolerance
+                               1000,// max iterations
+                               x0,// start vector (NULL = all ones)
+                               &lambda,// output eigenvalue
+                               &vec);// output eigenvector
+        if (it >= 0 || !x0)
+            break;
+        mat_free(x0);// warm vector was useless (e.g. in the null space), start over cold
+        x0 = NULL;
     }
+    uint64_t t1 = now_nanos();// timestamp end
+    int warm = (x0 != NULL);
+    mat_free(x0);
 
-    printf("\n(ID=%d, %dx%d) \n[SINGLE-PROCESS eigen] (OMP=%s)  lambda ~ %.8f (iters=%d)  time=%llums\n",
-           id, A->rows, A->cols, omp_state_str(),
-           lambda1, it1, (unsigned long long)(t1 - t0));
+    if (it < 0) {// negative = failure
+        printf("eigen failed\n");
+        return;
+    }
 
-    printf("eigenvector:\n");// print eigenvector
-    for (int i = 0; i < A->rows; i++)
-        printf("%g\n", vec1[i]);// each component
-    free(vec1);// free allocated vector
+    if (bk == BK_COMPARE) {
+        printf("\n(ID=%d, %dx%d)%s\n", id, A->rows, A->cols, warm ? " (warm start)" : "");
+        print_compare(runs, nruns, 1);
+    } else {
+        printf("\n(ID=%d, %dx%d) \n[%s eigen] (OMP=%s)  lambda ~ %.8f (iters=%d%s)  time=%.3fms\n",
+               id, A->rows, A->cols, backend_title(bk),
+               bk == BK_SINGLE ? "OFF" : bk == BK_OMP ? "ON" : omp_state_str(),
+               lambda, it, warm ? ", warm start" : "", (double)(t1 - t0) * 1e-6);
+        backend_report(bk, BOP_EIGEN, A, NULL, it, t1 - t0, 0);
+    }
+    output_vector(vec, A->rows, eig_label(A));// print eigenvector (per the output policy)
+    rcache_put(&ck, lambda, it, vec, A->rows, NULL);// cache keeps its own copy
+    eig_warm_store(A, vec);// start vector for the next solve after edits
+    mat_free(vec);// free allocated vector
+}
 
-    //MULTI-PROCESS EIGEN
-    t0 = now_millis();// timestamp start
-    int it2 = op_eigen_processes(// multiprocess eigen solver
-                    g_pool,// worker pool
-                    A,
-                    1e-6,// tolerance
-                    1000,// max iterations
-                    &lambda2,// output eigenvalue
-                    &vec2);// output eigenvector
-    uint64_t t2 = now_millis();// timestamp end
+// Pick the backend for one op or for all of them
+static void choose_backend() {
 
-    if (it2 < 0) {// if failed
-        printf("[MULTI-PROCESS eigen] failed\n");
+    char name[16], which[16];
+    printf("Op (all, add, sub, mul, det, eigen): ");
+    if ( scanf(" %15s", which)!= 1) {
+        fprintf(stderr, "Invalid entry.\n");
+        return;
     }
-    else {
-        printf("\n[MULTI-PROCESS eigen] ( OMP=%s)  lambda ~ %.8f (iters=%d)  time=%llums\n",
-#ifdef HAVE_OMP
-               g_omp_enabled ? "ON" : "OFF",// print OMP state if available
-#else
-               "OFF",// otherwise OFF
-#endif
-               lambda2, it2, (unsigned long long)(t2 - t0));
-
-        printf("eigenvector:\n");// print vector
-        for (int i = 0; i < A->rows; i++)
-            printf("%g\n", vec2[i]);
-        free(vec2);// free allocated vector
+    int op = -1;
+    for (int i = 0; i < BOP_COUNT; i++)
+        if (strcmp(which, backend_op_name(i)) == 0) op = i;
+    if (op < 0 && strcmp(which, "all") != 0) {
+        printf("unknown op\n");
+        return;
     }
+    printf("Backend (single, omp, pool, auto, compare) [now %s]: ", backend_name(backend_get(op < 0 ? BOP_MUL : op)));
+    if ( scanf(" %15s", name)!= 1) {
+        fprintf(stderr, "Invalid entry.\n");
+        return;
+    }
+    int bk = backend_parse(name);
+    if (bk < 0) {
+        printf("unknown backend\n");
+        return;
+    }
+    backend_set(op, bk);
+    printf("%s runs on: %s\n", op < 0 ? "every op" : backend_op_name(op), backend_name(bk));
 }
+
 //Toggle the global flag controlling whether OpenMP-based computations are used in single-process operations.
 //If OpenMP is not compiled in, enabling it shows a message.
 
@@ -785,6 +964,11 @@ static const char *op_label_by_code(int code) {
         case 15: return "Exit";
         case 16: return "Enable OpenMP";
         case 17: return "Disable OpenMP";
+        case 18: return "Multiply 2 matrices and maintain the product under edits";
+        case 19: return "Save a snapshot of the registry (restart with --restore)";
+        case 20: return "Multiply 2 .mbin files out of core (bigger than RAM)";
+        case 21: return "Choose how results are shown (none/summary/head/full/file)";
+        case 22: return "Choose the backend of an op (single/omp/pool/auto/compare)";
         default: return "Unknown";
     }
 }
@@ -817,9 +1001,21 @@ int load_config(const char *path, AppConfig *cfg) {
     memset(cfg, 0, sizeof(*cfg));// clear structure
     strcpy(cfg->matrix_dir, "data/mat");// default matrix directory
     cfg->workers = 4;// default worker threads/processes
-    for (int i = 0; i < 17; i++) {                             
+    cfg->hugepages = MAT_HUGEPAGES_THP;// transparent huge pages for big buffers
+    cfg->alloc_cache_mb = 256;// keep up to 256MB of freed buffers for reuse
+    cfg->cache_entries = 32;// memoized results
+    cfg->cache_mb = 256;
+    cfg->lazy_load = 1;// startup reads shapes only, data on first use
+    cfg->ooc_mem_mb = 256;// out-of-core multiply buffers
+    cfg->aio_uring = 1;// io_uring for folder loads and saves when the kernel has it
+    cfg->output_mode = OUT_FULL;// op results are printed in full
+    cfg->output_head = 4;
+    for (int i = 0; i < BOP_COUNT; i++)
+        cfg->backend[i] = BK_AUTO;// one computation per op, priced by the machine model
+    snprintf(cfg->output_dir, sizeof(cfg->output_dir), "output");
+    for (int i = 0; i < MENU_OPS; i++) {                             
         cfg->menu_order[i] = i + 1;// default menu order
-        cfg->menu_count = 17;// default menu count
+        cfg->menu_count = MENU_OPS;// default menu count
     }
 
     FILE *f = fopen(path, "r");// open config file
@@ -832,14 +1028,14 @@ int load_config(const char *path, AppConfig *cfg) {
         char key[64], val[448];// buffers for key/value
         if (sscanf(line, "%63[^=]=%447[^\n]", key, val) == 2) { // parse key=value
             if (strcmp(key, "matrix_dir") == 0) {// custom matrix directory
-                printf(cfg->matrix_dir, sizeof(cfg->matrix_dir), "%s", val);
+                snprintf(cfg->matrix_dir, sizeof(cfg->matrix_dir), "%.255s", val);
             } 
             else if (strcmp(key, "menu_order") == 0) {// custom menu order
                 cfg->menu_count = 0;// reset count
                 char *p = val;
                 while (*p) {// parse comma/space separated numbers
                     int x = (int)strtol(p, &p, 10);           // convert to integer
-                    if (x >= 1 && x <= 17)                     // valid menu code
+                    if (x >= 1 && x <= MENU_OPS)               // valid menu code
                         cfg->menu_order[cfg->menu_count++] = x;
                     if (*p == ',' || *p == ' ') p++;           // skip separators
                     else if (*p) p++;// skip other chars
@@ -848,30 +1044,586 @@ int load_config(const char *path, AppConfig *cfg) {
             else if (strcmp(key, "workers") == 0) {// custom worker count
                 cfg->workers = atoi(val);// convert to int
             }
+            else if (strcmp(key, "mem_budget_mb") == 0) {// registry memory budget
+                cfg->mem_budget_mb = atol(val);
+            }
+            else if (strcmp(key, "hugepages") == 0) {// huge page backing for big buffers
+                cfg->hugepages = atoi(val);
+            }
+            else if (strcmp(key, "alloc_cache_mb") == 0) {// buffer cache size
+                cfg->alloc_cache_mb = atol(val);
+            }
+            else if (strcmp(key, "cache_entries") == 0) {// result cache size
+                cfg->cache_entries = atoi(val);
+            }
+            else if (strcmp(key, "cache_mb") == 0) {// result cache byte limit
+                cfg->cache_mb = atol(val);
+            }
+            else if (strcmp(key, "bin_verify") == 0) {// checksum mapped binary files
+                cfg->bin_verify = atoi(val);
+            }
+            else if (strcmp(key, "io_threads") == 0) {// threads loading a folder
+                cfg->io_threads = atoi(val);
+            }
+            else if (strcmp(key, "lazy_load") == 0) {// read only shapes at startup
+                cfg->lazy_load = atoi(val);
+            }
+            else if (strcmp(key, "prefetch") == 0) {// read lazy matrices in the background
+                cfg->prefetch = atoi(val);
+            }
+            else if (strcmp(key, "save_async") == 0) {// save all on a background thread
+                cfg->save_async = atoi(val);
+            }
+            else if (strcmp(key, "ooc_mem_mb") == 0) {// buffers of the out-of-core multiply
+                cfg->ooc_mem_mb = atol(val);
+            }
+            else if (strcmp(key, "aio_uring") == 0) {// io_uring or the thread fallback
+                cfg->aio_uring = atoi(val);
+            }
+            else if (strcmp(key, "npy_f32") == 0) {// .npy files are written as float32
+                cfg->npy_f32 = atoi(val);
+            }
+            else if (strcmp(key, "gemm_block") == 0) {// tile edge of the blocked multiply kernel
+                cfg->gemm_block = atoi(val);
+            }
+            else if (strcmp(key, "output") == 0) {// how op results are shown
+                int m = output_parse_mode(val);
+                if (m >= 0) cfg->output_mode = m;
+            }
+            else if (strcmp(key, "output_head") == 0) {// rows/cols shown in head mode
+                cfg->output_head = atoi(val);
+            }
+            else if (strcmp(key, "output_dir") == 0) {// folder of output=file
+                snprintf(cfg->output_dir, sizeof(cfg->output_dir), "%.255s", val);
+            }
+            else if (strcmp(key, "backend") == 0) {// backend of every op
+                int b = backend_parse(val);
+                for (int i = 0; b >= 0 && i < BOP_COUNT; i++)
+                    cfg->backend[i] = b;
+            }
+            else if (strncmp(key, "backend_", 8) == 0) {// backend_add, backend_mul, ...: one op
+                int b = backend_parse(val);
+                for (int i = 0; b >= 0 && i < BOP_COUNT; i++)
+                    if (strcmp(key + 8, backend_op_name(i)) == 0)
+                        cfg->backend[i] = b;
+            }
+            else if (strcmp(key, "cores") == 0) {// CPUs the machine model assumes
+                cfg->model.cores = atoi(val);
+            }
+            else if (strcmp(key, "model_gflops") == 0) {// machine model, 0 = measure at startup
+                cfg->model.flops = atof(val) * 1e9;
+            }
+            else if (strcmp(key, "model_mem_gbs") == 0) {
+                cfg->model.bw = atof(val) * 1e9;
+            }
+            else if (strcmp(key, "model_mem_all_gbs") == 0) {
+                cfg->model.bw_all = atof(val) * 1e9;
+            }
+            else if (strcmp(key, "model_omp_us") == 0) {
+                cfg->model.omp_fork = atof(val) * 1e-6;
+            }
+            else if (strcmp(key, "model_job_us") == 0) {
+                cfg->model.ipc_job = atof(val) * 1e-6;
+            }
+            else if (strcmp(key, "model_pipe_gbs") == 0) {
+                cfg->model.ipc_bw = atof(val) * 1e9;
+            }
+            else if (strcmp(key, "model_fork_us") == 0) {
+                cfg->model.proc_fork = atof(val) * 1e-6;
+            }
+            else if (strcmp(key, "omp_threads") == 0) {// fixed OpenMP team size, 0 = from the model
+                cfg->omp_threads = atoi(val);
+            }
+            else if (strcmp(key, "omp_max_threads") == 0) {// team size cap, --autotune measures it
+                cfg->omp_max_threads = atoi(val);
+            }
+            else if (strcmp(key, "pool_chunk") == 0) {// elements per pool job, 0 = from the model
+                cfg->pool_chunk = atoi(val);
+            }
+            else if (strcmp(key, "auto_log") == 0) {// print the machine model and every auto pick
+                cfg->auto_log = atoi(val);
+            }
+            else if (strcmp(key, "spill_file") == 0) {// spill file for evicted matrices
+                snprintf(cfg->spill_file, sizeof(cfg->spill_file), "%.255s", val);
+            }
         }
     }
 
     fclose(f);// close file
     return 0;// success
 }
-// Initialize matrix registry and worker pool.
-// Load matrices from default/configured folder.
-// Display interactive menu for the user to perform matrix operations.
-// Handle single- and multi-process arithmetic, determinant, eigen computations.
-//Manage OpenMP enable/disable dynamically.
-void run_menu(AppConfig *cfg) {
-
-    registry_init(&g_reg);// initialize global matrix registry
-    load_directory(cfg->matrix_dir, &g_reg);// load matrices from directory
+// Fills the registry at startup: from the snapshot image given with --restore
+// (IDs and the ID counter are kept), otherwise from matrix_dir with fresh IDs.
+static void load_startup_matrices(const AppConfig *cfg) {
+
+    if (cfg->restore[0] != '\0') {
+        uint64_t next_id = 0;
+        if (load_snapshot(cfg->restore, &g_reg, cfg->lazy_load, &next_id) >= 0) {
+            g_next_id = next_id > 0 ? (int)next_id : g_reg.count + 1;
+            printf("Restored %d matrices from %s\n", g_reg.count, cfg->restore);
+            return;
+        }
+        printf("Cannot restore %s, loading %s\n", cfg->restore, cfg->matrix_dir);
+    }
+    if (cfg->lazy_load)
+        load_directory_lazy(cfg->matrix_dir, &g_reg);// index matrices, parse them on first use
+    else
+        load_directory(cfg->matrix_dir, &g_reg);// load matrices from directory
     if (g_reg.count > 0) {// if matrices were loaded
         for (int i = 0; i < g_reg.count; i++) {// iterate through loaded matrices
-            Matrix *m = g_reg.items[i];                
+            Matrix *m = registry_peek(&g_reg, i);
             if (!m) continue;// skip null entries
             rename_to_id(m, i + 1);// assign sequential ID to each matrix
         }
         g_next_id = g_reg.count + 1;// set next available ID
     }
-    g_pool = pool_create(cfg->workers);// create worker pool with configured number of processes
+}
+
+// Sets up everything the menu and the script mode share: buffer cache,
+// registry, globals from the config, startup matrices and the worker pool.
+static void app_start(const AppConfig *cfg) {
+
+    mat_alloc_config(cfg->hugepages, (size_t)cfg->alloc_cache_mb * 1024 * 1024);// buffer cache setup, before anything is allocated
+    registry_init(&g_reg);// initialize global matrix registry
+    if (cfg->mem_budget_mb > 0) {// limit RAM used by matrices, spill the rest to disk
+        registry_set_budget(&g_reg, (size_t)cfg->mem_budget_mb * 1024 * 1024, cfg->spill_file);
+    }
+    g_bin_verify = cfg->bin_verify;// checksum .mbin files even when they are mapped
+    g_io_threads = cfg->io_threads;// parser threads for folder loads
+    g_save_async = cfg->save_async;// save all returns at once, a thread writes
+    g_aio_uring = cfg->aio_uring;// 0 keeps file I/O off io_uring
+    g_npy_f32 = cfg->npy_f32;// precision of saved .npy files
+    if (cfg->gemm_block > 0)
+        g_gemm_block = cfg->gemm_block;// tiles of the blocked multiply (--autotune picks it)
+    output_set(cfg->output_mode, cfg->output_head, cfg->output_dir);// where op results go
+    for (int i = 0; i < BOP_COUNT; i++)
+        backend_set(i, cfg->backend[i]);// which implementation runs each op
+    if (cfg->ooc_mem_mb > 0)
+        g_ooc_mem = (size_t)cfg->ooc_mem_mb * 1024 * 1024;// out-of-core multiply buffers
+    rcache_init(cfg->cache_entries, (size_t)cfg->cache_mb * 1024 * 1024);// memoized det/eigen/mul results
+    g_cost_threads = cfg->omp_threads;// overrides of the machine model
+    g_cost_max_threads = cfg->omp_max_threads;
+    g_cost_chunk = cfg->pool_chunk;
+    g_cost_log = cfg->auto_log;
+    cost_calibrate(&cfg->model);// measure what the config leaves at 0, before the workers fork
+    g_pool = pool_create(cfg->workers);// create worker pool with configured number of processes, before the
+                                       // parallel folder load starts OpenMP threads the workers could not use
+    cost_calibrate_pool(g_pool);// OpenMP teams and the pipes of the new pool
+    load_startup_matrices(cfg);// snapshot image, or the matrix folder
+    if (cfg->lazy_load && cfg->prefetch) {// read the rest while the menu is up (after the fork of the pool)
+        if (cfg->mem_budget_mb > 0)
+            printf("prefetch is off when mem_budget_mb is set\n");
+        else
+            registry_prefetch_start(&g_reg);
+    }
+}
+
+// Tears down what app_start set up
+static void app_stop(void) {
+    pool_destroy(g_pool);// destroy worker pool on exit
+    if (g_reg.mem_budget > 0) registry_print_stats(&g_reg);// final spill/hit counters
+    mat_alloc_print_stats();// and the buffer cache's
+    rcache_print_stats();// and the result cache's
+    save_all_wait(&g_reg);// let a background save finish
+    rcache_free();// drop memoized results
+    maint_free();// stop tracking maintained products
+    registry_free(&g_reg);// free all matrices and clear registry
+}
+
+// Script mode: the same operations without prompts, one command per line.
+// Every command prints one result line starting with "ok <command>" followed
+// by key=value pairs, or "error line=<n> msg=\"...\"". Other output (load
+// statistics, the rows of `show`) never starts with those words.
+//
+//   load <file|folder>         add|sub|mul <A> <B> [-> <C>]
+//   det <A>    eig <A>         show <A>    del <A>    list
+//   save <A> <file>            save <folder|file.mpak>
+//   snapshot <file.mpak>       omp on|off
+//   backend <name> [op]
+//
+// "-> C" stores the result under ID C (replacing it), otherwise it gets the next ID.
+// A trailing "@single", "@omp", "@pool", "@auto" or "@compare" picks the backend of one op.
+
+#define SCRIPT_MAX_ARGS 8
+
+static int script_error(int line, const char *msg) {
+    printf("error line=%d msg=\"%s\"\n", line, msg);
+    return -1;
+}
+
+// Parses a positive ID
+static int script_id(const char *tok, int *id) {
+    char *end;
+    long v = strtol(tok, &end, 10);
+    if (*tok == '\0' || *end != '\0' || v <= 0 || v > INT32_MAX) {
+        return -1;
+    }
+    *id = (int)v;
+    return 0;
+}
+
+// Matrix named by an ID token; pin = 1 acquires it (registry_release when done)
+static Matrix *script_fetch(const char *tok, int pin) {
+    int id;
+    if (script_id(tok, &id) != 0) {
+        return NULL;
+    }
+    char key[MAX_NAME];
+    snprintf(key, sizeof(key), "%d", id);
+    return pin ? registry_acquire(&g_reg, key) : registry_get(&g_reg, key);
+}
+
+static Matrix *script_matrix(const char *tok) {
+    return script_fetch(tok, 0);
+}
+
+// Registers a result under `dest` (replacing what was there) or the next ID.
+static int store_result(Matrix *C, int dest) {
+    if (dest <= 0) {
+        int id = assign_new_id(C);
+        registry_add(&g_reg, C);
+        return id;
+    }
+    char key[MAX_NAME];
+    snprintf(key, sizeof(key), "%d", dest);
+    if (registry_find(&g_reg, key) != NULL) {// don't read a spilled or lazy matrix just to drop it
+        maint_forget(key);// products that use it can't be maintained anymore
+        registry_remove(&g_reg, key);
+    }
+    rename_to_id(C, dest);
+    if (dest >= g_next_id) g_next_id = dest + 1;// never hand out this ID again
+    registry_add(&g_reg, C);
+    return dest;
+}
+
+// Appends " <backend>_ms=.. <backend>_diff=.." for each backend of a compare run
+// (and <backend>_vec_diff=.. for eigen)
+static void script_print_runs(const BackendRun *runs, int n) {
+    for (int i = 0; i < n; i++) {
+        const char *name = backend_name(runs[i].backend);
+        if (!runs[i].ok) {
+            printf(" %s=failed", name);
+            continue;
+        }
+        printf(" %s_ms=%.3f %s_diff=%.3g", name, runs[i].ms, name, runs[i].diff);
+        if (runs[i].has_vec) printf(" %s_vec_diff=%.3g", name, runs[i].vec_diff);
+    }
+    printf("\n");
+}
+
+// add, sub, mul: C = A op B on backend bk (BK_COMPARE runs them all)
+static int script_binary(int line, char **argv, int argc, int bk) {
+    int dest = 0;
+    if (argc == 5 && strcmp(argv[3], "->") == 0) {
+        if (script_id(argv[4], &dest) != 0) return script_error(line, "bad result ID");
+    } else if (argc != 3) {
+        return script_error(line, "usage: add|sub|mul A B [-> C] [@backend]");
+    }
+    Matrix *A = script_fetch(argv[1], 1);// pinned: B's fetch or storing C must not spill A,
+    Matrix *B = script_fetch(argv[2], 1);// and C may replace one of them (-> A)
+    if (!A || !B) {
+        registry_release(&g_reg, A);
+        registry_release(&g_reg, B);
+        return script_error(line, "missing matrices");
+    }
+    int op = strcmp(argv[0], "add") == 0 ? BOP_ADD : strcmp(argv[0], "sub") == 0 ? BOP_SUB : BOP_MUL;
+
+    uint64_t t0 = now_nanos();
+    Matrix *C = NULL;
+    int cached = 0;
+    BackendRun runs[BK_CONCRETE];
+    int nruns = 0;
+    RCacheKey ck;
+    const RCacheValue *hit = NULL;
+    if (op == BOP_MUL) {
+        rcache_key(&ck, RC_MUL, A, B, 0.0, 0);
+        hit = rcache_lookup(&ck);
+    }
+    if (hit) {
+        C = matrix_create("", hit->mat->rows, hit->mat->cols);
+        memcpy(C->data, hit->mat->data, matrix_bytes(C));
+        cached = 1;
+    } else if (bk == BK_COMPARE) {
+        C = backend_compare_binary(op, g_pool, A, B, runs, &nruns);
+    } else {
+        bk = backend_resolve(bk, op, g_pool, A, B);
+        C = backend_binary(bk, op, g_pool, A, B);
+    }
+    if (C && op == BOP_MUL && !cached) {
+        rcache_put(&ck, 0.0, 0, NULL, 0, C);
+    }
+    uint64_t t1 = now_nanos();
+    int rc = 0;
+    if (!C) {
+        rc = script_error(line, "the dimensions are invalid");
+    } else {
+        registry_pin(&g_reg, C);
+        int id = store_result(C, dest);
+        printf("ok %s id=%d rows=%d cols=%d ms=%.3f backend=%s", argv[0], id, C->rows, C->cols,
+               (double)(t1 - t0) * 1e-6, cached ? "cache" : backend_name(bk));
+        if (!cached && bk != BK_COMPARE) backend_report(bk, op, A, B, 0, t1 - t0, 1);
+        script_print_runs(runs, nruns);
+    }
+    registry_release(&g_reg, A);
+    registry_release(&g_reg, B);
+    registry_release(&g_reg, C);
+    return rc;
+}
+
+static int script_det(int line, char **argv, int argc, int bk) {
+    Matrix *A = argc == 2 ? script_matrix(argv[1]) : NULL;
+    if (!A) return script_error(line, argc == 2 ? "not found" : "usage: det A [@backend]");
+    if (A->rows != A->cols) return script_error(line, "determinant requires a square matrix");
+
+    uint64_t t0 = now_nanos(), op_ns = 0;// op_ns: the backend call alone, for the rates
+    const char *how = "computed";
+    double d;
+    int n_upd;
+    BackendRun runs[BK_CONCRETE];
+    int nruns = 0;
+    RCacheKey ck;
+    rcache_key(&ck, RC_DET, A, NULL, 0.0, 0);
+    const RCacheValue *hit = rcache_lookup(&ck);
+    if (hit) {
+        d = hit->scalar;
+        how = "cached";
+    } else if (det_state_lookup(A, &d, &n_upd)) {// kept up to date by edits
+        rcache_put(&ck, d, 0, NULL, 0, NULL);
+        how = "incremental";
+    } else {
+        if (bk == BK_COMPARE) {
+            d = backend_compare_det(g_pool, A, runs, &nruns);
+            det_state_seed(A, d);
+        } else {
+            bk = backend_resolve(bk, BOP_DET, g_pool, A, NULL);
+            uint64_t t = now_nanos();
+            d = backend_det_factor(bk, g_pool, A);
+            op_ns = now_nanos() - t;
+        }
+        rcache_put(&ck, d, 0, NULL, 0, NULL);
+    }
+    uint64_t t1 = now_nanos();
+    printf("ok det id=%s value=%.17g ms=%.3f how=%s backend=%s", A->name, d,
+           (double)(t1 - t0) * 1e-6, how, backend_name(bk));
+    if (op_ns > 0) backend_report(bk, BOP_DET, A, NULL, 0, op_ns, 1);
+    script_print_runs(runs, nruns);
+    return 0;
+}
+
+static int script_eig(int line, char **argv, int argc, int bk) {
+    Matrix *A = argc == 2 ? script_matrix(argv[1]) : NULL;
+    if (!A) return script_error(line, argc == 2 ? "not found" : "usage: eig A [@backend]");
+    if (A->rows != A->cols) return script_error(line, "eigen requires a square matrix");
+
+    uint64_t t0 = now_nanos();
+    RCacheKey ck;
+    rcache_key(&ck, RC_EIGEN, A, NULL, 1e-6, 1000);// same tolerance and max iterations as the menu
+    const RCacheValue *hit = rcache_lookup(&ck);
+    if (hit) {
+        printf("ok eig id=%s lambda=%.17g iters=%d ms=%.3f how=cached\n", A->name, hit->scalar,
+               hit->iters, (double)(now_nanos() - t0) * 1e-6);
+        return 0;
+    }
+    double lambda, *vec = NULL;
+    const double *warm = eig_warm_get(A);
+    double *x0 = NULL;
+    if (warm) {
+        x0 = mat_alloc((size_t)A->rows);
+        memcpy(x0, warm, (size_t)A->rows * sizeof(double));
+    }
+    BackendRun runs[BK_CONCRETE];
+    int nruns = 0;
+    if (bk != BK_COMPARE) bk = backend_resolve(bk, BOP_EIGEN, g_pool, A, NULL);
+    int it;
+    for (;;) {
+        if (bk == BK_COMPARE)
+            it = backend_compare_eigen(g_pool, A, 1e-6, 1000, x0, &lambda, &vec, runs, &nruns);
+        else
+            it = backend_eigen(bk, g_pool, A, 1e-6, 1000, x0, &lambda, &vec);
+        if (it >= 0 || !x0) break;
+        mat_free(x0);// warm vector was useless, start over cold
+        x0 = NULL;
+    }
+    int warmed = x0 != NULL;
+    mat_free(x0);
+    if (it < 0) return script_error(line, "eigen failed");
+    rcache_put(&ck, lambda, it, vec, A->rows, NULL);
+    eig_warm_store(A, vec);
+    mat_free(vec);
+    uint64_t t1 = now_nanos();
+    printf("ok eig id=%s lambda=%.17g iters=%d ms=%.3f how=%s backend=%s", A->name, lambda, it,
+           (double)(t1 - t0) * 1e-6, warmed ? "warm" : "computed", backend_name(bk));
+    if (bk != BK_COMPARE) backend_report(bk, BOP_EIGEN, A, NULL, it, t1 - t0, 1);
+    script_print_runs(runs, nruns);
+    return 0;
+}
+
+// load <file|folder>: new matrices get the next IDs
+static int script_load(int line, char **argv, int argc) {
+    if (argc != 2) return script_error(line, "usage: load file|folder");
+    struct stat st;
+    if (is_container_path(argv[1]) || (stat(argv[1], &st) == 0 && S_ISDIR(st.st_mode))) {
+        int prev = g_reg.count;
+        if (load_directory(argv[1], &g_reg) < 0) return script_error(line, "cannot load folder");
+        int first = g_next_id;
+        for (int i = prev; i < g_reg.count; i++) {
+            Matrix *m = registry_peek(&g_reg, i);
+            if (m) assign_new_id(m);
+        }
+        printf("ok load count=%d first=%d last=%d\n", g_reg.count - prev, first, g_next_id - 1);
+        return 0;
+    }
+    Matrix *m = NULL;
+    if (read_matrix_file(argv[1], "", &m) != 0 || m == NULL) return script_error(line, "cannot load file");
+    int id = assign_new_id(m);
+    registry_add(&g_reg, m);
+    printf("ok load count=1 first=%d last=%d rows=%d cols=%d\n", id, id, m->rows, m->cols);
+    return 0;
+}
+
+static int script_save(int line, char **argv, int argc) {
+    if (argc == 3) {// one matrix to a file
+        Matrix *m = script_matrix(argv[1]);
+        if (!m) return script_error(line, "not found");
+        if (write_matrix_file(argv[2], m) < 0) return script_error(line, "cannot write");
+        printf("ok save id=%s path=%s\n", m->name, argv[2]);
+        return 0;
+    }
+    if (argc != 2) return script_error(line, "usage: save A file | save folder");
+    if (!is_container_path(argv[1]))
+        mkdir(argv[1], 0777);  // Ensure folder exists (ignore failure)
+    int n = save_all_to_dir(argv[1], &g_reg, 0);// the script goes on only once it is on disk
+    if (n < 0) return script_error(line, "cannot save");
+    printf("ok save written=%d unchanged=%d path=%s\n", n, g_reg.count - n, argv[1]);
+    return 0;
+}
+
+// Runs one line. Returns 0, or -1 after printing the error.
+static int script_line(int line, char *text) {
+    char *argv[SCRIPT_MAX_ARGS];
+    int argc = 0;
+    for (char *p = text; *p; ) {// split on blanks, stop at a comment
+        while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n') *p++ = '\0';
+        if (*p == '\0' || *p == '#') break;
+        if (argc == SCRIPT_MAX_ARGS) return script_error(line, "too many arguments");
+        argv[argc++] = p;
+        while (*p && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n') p++;
+    }
+    if (argc == 0) return 0;
+    const char *cmd = argv[0];
+    int bk = -1;// "@backend" at the end overrides the session backend for this command
+    if (argc > 1 && argv[argc - 1][0] == '@') {
+        bk = backend_parse(argv[argc - 1] + 1);
+        if (bk < 0) return script_error(line, "unknown backend");
+        argc--;
+    }
+
+    if (strcmp(cmd, "add") == 0 || strcmp(cmd, "sub") == 0 || strcmp(cmd, "mul") == 0) {
+        int op = cmd[0] == 'a' ? BOP_ADD : cmd[0] == 's' ? BOP_SUB : BOP_MUL;
+        return script_binary(line, argv, argc, bk >= 0 ? bk : backend_get(op));
+    }
+    if (strcmp(cmd, "det") == 0) return script_det(line, argv, argc, bk >= 0 ? bk : backend_get(BOP_DET));
+    if (strcmp(cmd, "eig") == 0) return script_eig(line, argv, argc, bk >= 0 ? bk : backend_get(BOP_EIGEN));
+    if (strcmp(cmd, "backend") == 0 && (argc == 2 || argc == 3)) {// backend <name> [op]
+        int b = backend_parse(argv[1]), op = -1;
+        for (int i = 0; argc == 3 && i < BOP_COUNT; i++)
+            if (strcmp(argv[2], backend_op_name(i)) == 0) op = i;
+        if (b < 0 || (argc == 3 && op < 0)) return script_error(line, "usage: backend single|omp|pool|auto|compare [add|sub|mul|det|eigen]");
+        backend_set(op, b);
+        printf("ok backend %s=%s\n", op < 0 ? "all" : backend_op_name(op), backend_name(b));
+        return 0;
+    }
+    if (strcmp(cmd, "load") == 0) return script_load(line, argv, argc);
+    if (strcmp(cmd, "save") == 0) return script_save(line, argv, argc);
+    if (strcmp(cmd, "show") == 0) {
+        Matrix *m = argc == 2 ? script_matrix(argv[1]) : NULL;
+        if (!m) return script_error(line, "not found");
+        printf("ok show id=%s rows=%d cols=%d\n", m->name, m->rows, m->cols);
+        print_matrix_raw(m);
+        return 0;
+    }
+    if (strcmp(cmd, "del") == 0) {
+        Matrix *m = argc == 2 ? script_matrix(argv[1]) : NULL;
+        if (!m) return script_error(line, "not found");
+        char key[MAX_NAME];
+        snprintf(key, sizeof(key), "%s", m->name);
+        maint_forget(key);
+        registry_remove(&g_reg, key);
+        printf("ok del id=%s\n", key);
+        return 0;
+    }
+    if (strcmp(cmd, "list") == 0) {
+        printf("ok list count=%d\n", g_reg.count);
+        for (int i = 0; i < g_reg.count; i++) {
+            const Matrix *m = registry_peek(&g_reg, i);// shapes only, nothing is read back
+            if (m) printf("  id=%s rows=%d cols=%d\n", m->name, m->rows, m->cols);
+        }
+        return 0;
+    }
+    if (strcmp(cmd, "snapshot") == 0) {
+        if (argc != 2) return script_error(line, "usage: snapshot file.mpak");
+        if (save_snapshot(argv[1], &g_reg, (uint64_t)g_next_id) < 0) return script_error(line, "cannot write snapshot");
+        printf("ok snapshot count=%d path=%s\n", g_reg.count, argv[1]);
+        return 0;
+    }
+    if (strcmp(cmd, "omp") == 0 && argc == 2) {
+#ifdef HAVE_OMP
+        if (strcmp(argv[1], "on") == 0 || strcmp(argv[1], "off") == 0) {
+            g_omp_enabled = strcmp(argv[1], "on") == 0;
+            printf("ok omp state=%s\n", omp_state_str());
+            return 0;
+        }
+#else
+        if (strcmp(argv[1], "off") == 0) {
+            printf("ok omp state=OFF\n");
+            return 0;
+        }
+#endif
+        return script_error(line, "usage: omp on|off (OpenMP must be compiled in)");
+    }
+    return script_error(line, "unknown command");
+}
+
+// Runs a script file ("-" reads stdin). Returns the number of failed commands.
+int run_script(AppConfig *cfg, const char *path) {
+
+    FILE *f = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+    if (f == NULL) {
+        perror(path);
+        return 1;
+    }
+    app_start(cfg);
+    char text[1024];
+    int line = 0, failed = 0;
+    uint64_t t0 = now_millis();
+    while (fgets(text, sizeof(text), f) != NULL) {
+        line++;
+        size_t n = strlen(text);
+        if (n == sizeof(text) - 1 && text[n - 1] != '\n') {// rest of an overlong line
+            int c;
+            while ((c = fgetc(f)) != EOF && c != '\n') {
+            }
+            failed++;
+            script_error(line, "line too long");
+            continue;
+        }
+        if (script_line(line, text) != 0) failed++;
+    }
+    printf("ok done lines=%d failed=%d ms=%llu\n", line, failed, (unsigned long long)(now_millis() - t0));
+    fflush(stdout);
+    if (f != stdin) fclose(f);
+    app_stop();
+    return failed;
+}
+
+// Initialize matrix registry and worker pool.
+// Load matrices from default/configured folder.
+// Display interactive menu for the user to perform matrix operations.
+// Handle single- and multi-process arithmetic, determinant, eigen computations.
+//Manage OpenMP enable/disable dynamically.
+void run_menu(AppConfig *cfg) {
+
+    app_start(cfg);
     int running = 1;// menu loop control flag
     while (running) {// main menu loop
         print_menu_dynamic(cfg);// display menu dynamically
@@ -908,10 +1660,14 @@ void run_menu(AppConfig *cfg) {
             case 15: running = 0; break;               // exit menu
             case 16: enable_omp(); break;              // enable OpenMP
             case 17: disable_omp(); break;             // disable OpenMP
+            case 18: mul_maintained(); break;          // multiply and keep the product maintained
+            case 19: snapshot(); break;                // dump the registry to one image
+            case 20: mul_out_of_core(); break;         // stream a product of on-disk matrices
+            case 21: choose_output(); break;           // output policy for op results
+            case 22: choose_backend(); break;          // which implementation runs each op
             default: printf("unknown op\n");           // fallback for unexpected code
         }
     }
-    pool_destroy(g_pool);// destroy worker pool on exit
-    registry_free(&g_reg);// free all matrices and clear registry
+    app_stop();
 }
 
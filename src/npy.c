@@ -0,0 +1,294 @@
+#define _GNU_SOURCE  // pread
+
+#include "common.h"
+#include "npy.h"
+#include "mat_alloc.h"
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#define NPY_ALIGN      64            // header padded so the payload starts 64-byte aligned
+#define NPY_HEADER_MAX (1u << 20)    // longer headers are not matrices
+#define NPY_CONV_BLOCK 65536         // elements converted per write when saving float32
+
+int g_npy_f32 = 0;
+
+// What the header says about the payload
+typedef struct {
+    int elem;            // 8 float64, 4 float32
+    int swap;            // byte order differs from the host
+    int fortran;         // column-major payload
+    int rows, cols;
+    size_t data_off;     // payload offset in the file
+} NpyInfo;
+
+static int host_little(void) {
+    const uint16_t one = 1;
+    return *(const uint8_t*)&one == 1;
+}
+
+int is_npy_path(const char *path) {
+    size_t n = strlen(path), m = strlen(NPY_EXT);
+    return n >= m && strcmp(path + n - m, NPY_EXT) == 0;
+}
+
+int is_npy_data(const void *buf, size_t len) {
+    return len >= NPY_MAGIC_LEN && memcmp(buf, NPY_MAGIC, NPY_MAGIC_LEN) == 0;
+}
+
+// Size of the fixed prefix and offset of the payload, from the first 12 bytes.
+static int prefix_len(const unsigned char *b, size_t len, size_t *hdr_start, size_t *data_off) {
+    if (len < 10 || !is_npy_data(b, len)) {
+        return -1;
+    }
+    if (b[6] == 1) {
+        *hdr_start = 10;
+        *data_off = 10 + (size_t)(b[8] | b[9] << 8);
+    } else if ((b[6] == 2 || b[6] == 3) && len >= 12) {
+        *hdr_start = 12;
+        *data_off = 12 + ((size_t)b[8] | (size_t)b[9] << 8 | (size_t)b[10] << 16 | (size_t)b[11] << 24);
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+// Finds 'key' (either quote style) in the header dict and returns the text after its colon.
+static const char *find_value(const char *p, const char *end, const char *key) {
+    size_t kl = strlen(key);
+    for (; p + kl + 2 <= end; p++) {
+        if ((*p == '\'' || *p == '"') && memcmp(p + 1, key, kl) == 0 && p[kl + 1] == *p) {
+            p += kl + 2;
+            while (p < end && (*p == ' ' || *p == ':')) p++;
+            return p;
+        }
+    }
+    return NULL;
+}
+
+static int parse_header(const char *buf, size_t len, const char *path, NpyInfo *info) {
+    size_t hdr_start, data_off;
+    if (prefix_len((const unsigned char*)buf, len, &hdr_start, &data_off) != 0 || data_off > len) {
+        fprintf(stderr, "Unsupported .npy header in %s\n", path);
+        return -1;
+    }
+    const char *p, *end = buf + data_off;
+    memset(info, 0, sizeof(*info));
+    info->data_off = data_off;
+
+    // 'descr': '<f8' -- byte order, kind, size
+    p = find_value(buf + hdr_start, end, "descr");
+    if (p == NULL || end - p < 5 || (*p != '\'' && *p != '"')) {
+        fprintf(stderr, "Missing dtype in %s\n", path);
+        return -1;
+    }
+    char order = p[1], kind = p[2], size = p[3];
+    if (kind != 'f' || (size != '8' && size != '4') || p[4] != p[0] ||
+        (order != '<' && order != '>' && order != '=' && order != '|')) {
+        fprintf(stderr, "%s: only float64 and float32 arrays are supported\n", path);
+        return -1;
+    }
+    info->elem = size - '0';
+    info->swap = (order == '<' && !host_little()) || (order == '>' && host_little());
+
+    p = find_value(buf + hdr_start, end, "fortran_order");
+    info->fortran = p != NULL && end - p >= 4 && memcmp(p, "True", 4) == 0;
+
+    // 'shape': (rows, cols) or (n,)
+    p = find_value(buf + hdr_start, end, "shape");
+    if (p == NULL || *p != '(') {
+        fprintf(stderr, "Missing shape in %s\n", path);
+        return -1;
+    }
+    long dims[3];
+    int nd = 0;
+    for (p++; p < end && *p != ')'; ) {
+        if (*p == ' ' || *p == ',') {
+            p++;
+            continue;
+        }
+        char *e;
+        long v = strtol(p, &e, 10);
+        if (e == p || v <= 0 || v > INT32_MAX || nd == 3) {   // empty arrays are not matrices
+            nd = 3;
+            break;
+        }
+        dims[nd++] = v;
+        p = e;
+    }
+    if (nd == 1) {
+        info->rows = 1;
+        info->cols = (int)dims[0];
+    } else if (nd == 2) {
+        info->rows = (int)dims[0];
+        info->cols = (int)dims[1];
+    } else {
+        fprintf(stderr, "%s: expected a 1-D or 2-D array\n", path);
+        return -1;
+    }
+    return 0;
+}
+
+static int read_at(int fd, void *buf, size_t len, off_t off) {
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = pread(fd, (char*)buf + done, len - done, off + (off_t)done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        done += (size_t)n;
+    }
+    return 0;
+}
+
+// Element i of a raw payload as a double
+static double load_elem(const unsigned char *raw, size_t i, const NpyInfo *info) {
+    if (info->elem == 8) {
+        uint64_t u;
+        memcpy(&u, raw + i * 8, 8);
+        if (info->swap) u = __builtin_bswap64(u);
+        double d;
+        memcpy(&d, &u, 8);
+        return d;
+    }
+    uint32_t u;
+    memcpy(&u, raw + i * 4, 4);
+    if (info->swap) u = __builtin_bswap32(u);
+    float f;
+    memcpy(&f, &u, 4);
+    return f;
+}
+
+// Reads the whole header (as long as the preamble says it is) and parses it
+static int read_info(int fd, const char *path, NpyInfo *info) {
+    unsigned char pre[12];
+    size_t hdr_start, data_off;
+    ssize_t n = pread(fd, pre, sizeof(pre), 0);
+    if (n < 0 || prefix_len(pre, (size_t)n, &hdr_start, &data_off) != 0 || data_off > NPY_HEADER_MAX) {
+        fprintf(stderr, "Unsupported .npy header in %s\n", path);
+        return -1;
+    }
+    char *hdr = (char*)xmalloc(data_off);
+    int rc = read_at(fd, hdr, data_off, 0) == 0 ? parse_header(hdr, data_off, path, info) : -1;
+    free(hdr);
+    return rc;
+}
+
+// Bytes of header plus payload, checked against the file; 0 if it doesn't fit
+static size_t payload_end(int fd, const char *path, const NpyInfo *info) {
+    // each dimension fits an int, their product times the element size may not fit a size_t
+    size_t count = (size_t)info->rows * info->cols;
+    if (count > SIZE_MAX / (size_t)info->elem || info->data_off > SIZE_MAX - count * (size_t)info->elem) {
+        fprintf(stderr, "%s: array too large\n", path);
+        return 0;
+    }
+    size_t need = info->data_off + count * (size_t)info->elem;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < need) {
+        fprintf(stderr, "Truncated .npy file %s\n", path);
+        return 0;
+    }
+    return need;
+}
+
+int npy_shape(int fd, const char *path, int *rows, int *cols) {
+    NpyInfo info;
+    if (read_info(fd, path, &info) != 0 || payload_end(fd, path, &info) == 0) {
+        return -1;
+    }
+    *rows = info.rows;
+    *cols = info.cols;
+    return 0;
+}
+
+int npy_read(int fd, const char *path, const char *name, Matrix **out) {
+    NpyInfo info;
+    if (read_info(fd, path, &info) != 0) {
+        return -1;
+    }
+
+    size_t count = (size_t)info.rows * info.cols;
+    size_t need = payload_end(fd, path, &info);
+    if (need == 0) {
+        return -1;
+    }
+
+    // a vector is laid out the same in both orders
+    int row_major = !info.fortran || info.rows == 1 || info.cols == 1;
+    if (info.elem == 8 && !info.swap && row_major && info.data_off % sizeof(double) == 0 && count > 0) {
+        // zero-copy: private writable mapping, pages are copied on first write only
+        void *base = mmap(NULL, need, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        if (base != MAP_FAILED) {
+            double *data = (double*)((char*)base + info.data_off);
+            *out = matrix_create_mapped(name, info.rows, info.cols, data, base, need);
+            return 0;
+        }
+    }
+
+    Matrix *m = matrix_create(name, info.rows, info.cols);
+    if (info.elem == 8 && !info.swap && row_major) {   // mapping failed: read it in place
+        if (read_at(fd, m->data, count * sizeof(double), (off_t)info.data_off) != 0) {
+            perror("read");
+            matrix_free(m);
+            return -1;
+        }
+        *out = m;
+        return 0;
+    }
+    unsigned char *raw = (unsigned char*)xmalloc(count * (size_t)info.elem + 1);
+    if (read_at(fd, raw, count * (size_t)info.elem, (off_t)info.data_off) != 0) {
+        perror("read");
+        free(raw);
+        matrix_free(m);
+        return -1;
+    }
+    for (int i = 0; i < info.rows; i++) {
+        double *row = &m->data[(size_t)i * info.cols];
+        for (int j = 0; j < info.cols; j++) {
+            size_t src = row_major ? (size_t)i * info.cols + j : (size_t)j * info.rows + i;
+            row[j] = load_elem(raw, src, &info);
+        }
+    }
+    free(raw);
+    *out = m;
+    return 0;
+}
+
+int npy_write(const char *path, const Matrix *m) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    if (fd < 0) {
+        perror("open");
+        return -1;
+    }
+    // version 1.0: magic, 2 version bytes, 2 length bytes, then the dict
+    char hdr[256];
+    memcpy(hdr, NPY_MAGIC, NPY_MAGIC_LEN);
+    hdr[6] = 1;
+    hdr[7] = 0;
+    int hn = 10 + snprintf(hdr + 10, sizeof(hdr) - 10, "{'descr': '%c%s', 'fortran_order': False, 'shape': (%d, %d), }",
+                           host_little() ? '<' : '>', g_npy_f32 ? "f4" : "f8", m->rows, m->cols);
+    int total = (hn + 1 + NPY_ALIGN - 1) / NPY_ALIGN * NPY_ALIGN;   // + the closing newline
+    memset(hdr + hn, ' ', (size_t)(total - hn));
+    hdr[total - 1] = '\n';
+    hdr[8] = (char)((total - 10) & 0xff);
+    hdr[9] = (char)((total - 10) >> 8);
+
+    size_t count = (size_t)m->rows * m->cols;
+    int rc = write_all(fd, hdr, (size_t)total) == (ssize_t)total ? 0 : -1;
+    if (rc == 0 && !g_npy_f32) {
+        rc = write_all(fd, m->data, count * sizeof(double)) == (ssize_t)(count * sizeof(double)) ? 0 : -1;
+    } else if (rc == 0) {
+        float *buf = (float*)xmalloc(NPY_CONV_BLOCK * sizeof(float));
+        for (size_t i = 0; rc == 0 && i < count; i += NPY_CONV_BLOCK) {
+            size_t nb = count - i < NPY_CONV_BLOCK ? count - i : NPY_CONV_BLOCK;
+            for (size_t k = 0; k < nb; k++) buf[k] = (float)m->data[i + k];
+            rc = write_all(fd, buf, nb * sizeof(float)) == (ssize_t)(nb * sizeof(float)) ? 0 : -1;
+        }
+        free(buf);
+    }
+    if (rc != 0) {
+        perror("write");
+    }
+    if (close(fd) != 0) {
+        rc = -1;
+    }
+    return rc;
+}
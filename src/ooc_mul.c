@@ -0,0 +1,248 @@
+#define _GNU_SOURCE  // pread/pwrite, ftruncate
+
+#include "common.h"
+#include "ooc_mul.h"
+#include "ops.h"
+#include "file_io.h"
+#include "mat_alloc.h"
+#include "timer.h"
+#include <limits.h>
+#include <pthread.h>
+
+#define OOC_MIN_TILE 8
+
+// An open .mbin operand
+typedef struct {
+    int fd;
+    MatBinHeader h;
+} BinFile;
+
+// One step of the product: C tile (i0, j0) += A panel (i0, k0) * B panel (k0, j0)
+typedef struct {
+    int i0, j0, k0;
+    int tm, tn, tk;
+} Step;
+
+// Read request handed to the helper thread
+typedef struct {
+    const BinFile *a, *b;
+    Step st;
+    double *abuf, *bbuf;
+    int rc;
+    size_t bytes;
+} PanelLoad;
+
+static int open_bin(const char *path, BinFile *f) {
+    f->fd = open(path, O_RDONLY);
+    if (f->fd < 0) {
+        perror(path);
+        return -1;
+    }
+    if (pread(f->fd, &f->h, sizeof(f->h), 0) != (ssize_t)sizeof(f->h) ||
+        memcmp(f->h.magic, MATBIN_MAGIC, sizeof(f->h.magic)) != 0 ||
+        f->h.version != MATBIN_VERSION || f->h.dtype != MATBIN_F64 || f->h.ld < f->h.cols) {
+        fprintf(stderr, "%s is not a .mbin matrix\n", path);
+        close(f->fd);
+        return -1;
+    }
+    if (f->h.rows > INT_MAX || f->h.cols > INT_MAX) {   // tiles and steps are indexed with int
+        fprintf(stderr, "%s: matrix too large\n", path);
+        close(f->fd);
+        return -1;
+    }
+    return 0;
+}
+
+// Reads rows [r0, r0+nr) x cols [c0, c0+nc) of a .mbin file into dst (row stride nc).
+static int read_block(const BinFile *f, int r0, int c0, int nr, int nc, double *dst, size_t *bytes) {
+    size_t ld = (size_t)f->h.ld;
+    if ((size_t)nc == ld) {   // whole rows: one contiguous read
+        size_t len = (size_t)nr * nc * sizeof(double);
+        off_t off = (off_t)(sizeof(MatBinHeader) + (size_t)r0 * ld * sizeof(double));
+        if (pread(f->fd, dst, len, off) != (ssize_t)len) return -1;
+        *bytes += len;
+        return 0;
+    }
+    for (int r = 0; r < nr; r++) {
+        size_t len = (size_t)nc * sizeof(double);
+        off_t off = (off_t)(sizeof(MatBinHeader) + ((size_t)(r0 + r) * ld + (size_t)c0) * sizeof(double));
+        if (pread(f->fd, dst + (size_t)r * nc, len, off) != (ssize_t)len) return -1;
+        *bytes += len;
+    }
+    return 0;
+}
+
+static void *load_panels(void *arg) {
+    PanelLoad *ld = (PanelLoad*)arg;
+    const Step *s = &ld->st;
+    ld->bytes = 0;
+    ld->rc = read_block(ld->a, s->i0, s->k0, s->tm, s->tk, ld->abuf, &ld->bytes) == 0 &&
+             read_block(ld->b, s->k0, s->j0, s->tk, s->tn, ld->bbuf, &ld->bytes) == 0 ? 0 : -1;
+    return NULL;
+}
+
+// Step number s of the loop i (outer), j, k (inner), so each C tile gets all
+// its k panels in a row and can be written as soon as the last one is added.
+static Step step_at(long s, int M, int N, int K, int TM, int TN, int TK) {
+    int nk = (K + TK - 1) / TK, nj = (N + TN - 1) / TN;
+    Step st;
+    st.k0 = (int)(s % nk) * TK;
+    st.j0 = (int)((s / nk) % nj) * TN;
+    st.i0 = (int)(s / ((long)nk * nj)) * TM;
+    st.tm = M - st.i0 < TM ? M - st.i0 : TM;
+    st.tn = N - st.j0 < TN ? N - st.j0 : TN;
+    st.tk = K - st.k0 < TK ? K - st.k0 : TK;
+    return st;
+}
+
+// Picks square tiles T so that 2 A panels + 2 B panels + 1 C tile fit in mem_bytes.
+static int pick_tile(size_t mem_bytes) {
+    double t = sqrt((double)mem_bytes / (5.0 * sizeof(double)));
+    int T = (int)t / OOC_MIN_TILE * OOC_MIN_TILE;
+    return T < OOC_MIN_TILE ? OOC_MIN_TILE : T;
+}
+
+// Writes the finished C tile (tm x tn at i0, j0) into the output file.
+static int write_tile(int fd, int N, const Step *s, const double *c, size_t *bytes) {
+    for (int r = 0; r < s->tm; r++) {
+        size_t len = (size_t)s->tn * sizeof(double);
+        off_t off = (off_t)(sizeof(MatBinHeader) + ((size_t)(s->i0 + r) * N + (size_t)s->j0) * sizeof(double));
+        if (pwrite(fd, c + (size_t)r * s->tn, len, off) != (ssize_t)len) return -1;
+        *bytes += len;
+    }
+    return 0;
+}
+
+// Fills in the header of the output file, with the checksum computed by
+// streaming the payload back through the tile buffer.
+static int finish_output(int fd, int M, int N, double *buf, size_t buf_elems) {
+    MatBinHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, MATBIN_MAGIC, sizeof(h.magic));
+    h.version = MATBIN_VERSION;
+    h.dtype = MATBIN_F64;
+    h.rows = (uint64_t)M;
+    h.cols = (uint64_t)N;
+    h.ld = (uint64_t)N;
+
+    uint64_t sum = matrix_checksum(buf, 0);
+    size_t total = (size_t)M * N, done = 0;
+    while (done < total) {
+        size_t n = total - done < buf_elems ? total - done : buf_elems;
+        off_t off = (off_t)(sizeof(MatBinHeader) + done * sizeof(double));
+        if (pread(fd, buf, n * sizeof(double), off) != (ssize_t)(n * sizeof(double))) return -1;
+        sum = matrix_checksum_continue(sum, buf, n);
+        done += n;
+    }
+    h.checksum = sum;
+    return pwrite(fd, &h, sizeof(h), 0) == (ssize_t)sizeof(h) ? 0 : -1;
+}
+
+// C = A * B over .mbin files, with at most about mem_bytes of buffers.
+int ooc_mul_files(const char *a_path, const char *b_path, const char *c_path,
+                  size_t mem_bytes, OocStats *st) {
+    memset(st, 0, sizeof(*st));
+    uint64_t t0 = now_millis();
+    BinFile a, b;
+    if (open_bin(a_path, &a) != 0) return -1;
+    if (open_bin(b_path, &b) != 0) {
+        close(a.fd);
+        return -1;
+    }
+    int M = (int)a.h.rows, K = (int)a.h.cols, N = (int)b.h.cols;
+    if ((uint64_t)K != b.h.rows) {
+        fprintf(stderr, "The dimensions are invalid\n");
+        close(a.fd);
+        close(b.fd);
+        return -1;
+    }
+    int T = pick_tile(mem_bytes);
+    int TM = M < T ? (M ? M : 1) : T, TN = N < T ? (N ? N : 1) : T, TK = K < T ? (K ? K : 1) : T;
+
+    // written next to the target and renamed over it when complete, so a failed
+    // run never leaves a half written C (nor destroys an A or B passed as C)
+    char tmp[600];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", c_path);
+    int cfd = open(tmp, O_RDWR | O_CREAT | O_TRUNC, 0666);
+    if (cfd < 0) {
+        perror(tmp);
+        close(a.fd);
+        close(b.fd);
+        return -1;
+    }
+    int rc = ftruncate(cfd, (off_t)(sizeof(MatBinHeader) + (size_t)M * N * sizeof(double)));
+
+    size_t apanel = (size_t)TM * TK, bpanel = (size_t)TK * TN, ctile = (size_t)TM * TN;
+    double *abuf[2] = { mat_alloc(apanel), mat_alloc(apanel) };
+    double *bbuf[2] = { mat_alloc(bpanel), mat_alloc(bpanel) };
+    double *cbuf = mat_alloc(ctile);
+    st->tile_m = TM;
+    st->tile_n = TN;
+    st->tile_k = TK;
+    st->buffer_bytes = (2 * apanel + 2 * bpanel + ctile) * sizeof(double);
+
+    long steps = (M && N && K) ? (long)((M + TM - 1) / TM) * ((N + TN - 1) / TN) * ((K + TK - 1) / TK) : 0;
+    size_t rd = 0, wr = 0;
+    PanelLoad next;
+    next.a = &a;
+    next.b = &b;
+    if (rc == 0 && steps > 0) {   // first panels: nothing to overlap with yet
+        next.st = step_at(0, M, N, K, TM, TN, TK);
+        next.abuf = abuf[0];
+        next.bbuf = bbuf[0];
+        load_panels(&next);
+        rc = next.rc;
+        rd += next.bytes;
+    }
+    for (long s = 0; rc == 0 && s < steps; s++) {
+        int cur = (int)(s & 1);
+        Step now = step_at(s, M, N, K, TM, TN, TK);
+        pthread_t th;
+        int async = 0;
+        if (s + 1 < steps) {   // read the next panels while this step multiplies
+            next.st = step_at(s + 1, M, N, K, TM, TN, TK);
+            next.abuf = abuf[cur ^ 1];
+            next.bbuf = bbuf[cur ^ 1];
+            async = pthread_create(&th, NULL, load_panels, &next) == 0;
+            if (!async) load_panels(&next);
+        }
+        if (now.k0 == 0) {
+            memset(cbuf, 0, (size_t)now.tm * now.tn * sizeof(double));
+        }
+        gemm_block_acc(now.tm, now.tn, now.tk, abuf[cur], (size_t)now.tk,
+                       bbuf[cur], (size_t)now.tn, cbuf, (size_t)now.tn);
+        if (now.k0 + now.tk >= K && write_tile(cfd, N, &now, cbuf, &wr) != 0) {
+            rc = -1;
+        }
+        if (s + 1 < steps) {
+            uint64_t w0 = now_millis();
+            if (async) pthread_join(th, NULL);
+            st->wait_ms += now_millis() - w0;
+            rd += next.bytes;
+            if (next.rc != 0) rc = -1;
+        }
+    }
+    if (rc == 0) {
+        rc = finish_output(cfd, M, N, cbuf, ctile);
+    }
+    if (rc != 0) {
+        perror("out-of-core multiply");
+    }
+    mat_free(abuf[0]);
+    mat_free(abuf[1]);
+    mat_free(bbuf[0]);
+    mat_free(bbuf[1]);
+    mat_free(cbuf);
+    close(a.fd);
+    close(b.fd);
+    if (close(cfd) != 0) rc = -1;
+    if (rc == 0 && rename(tmp, c_path) != 0) {
+        perror(c_path);
+        rc = -1;
+    }
+    if (rc != 0) unlink(tmp);
+    st->read_mb = rd / 1048576.0;
+    st->write_mb = wr / 1048576.0;
+    st->total_ms = now_millis() - t0;
+    return rc == 0 ? 0 : -1;
+}
@@ -1,6 +1,8 @@
 #include "common.h"
 #include "ops.h"
 #include "timer.h"
+#include "cost.h"
+#include "mat_alloc.h"
 
 // Allocate a new matrix with the same dimensions as A and a given name
 static Matrix *alloc_like(const Matrix *A, const char *name) {
@@ -21,8 +23,9 @@ Matrix *op_add_single(const Matrix *A, const Matrix *B, const char *name) {
     Matrix *C = alloc_like(A, name);  // Allocate a result matrix C with same dimensions as A
     int N = A->rows * A->cols;  // Total number of elements
     
-    // Parallelize the addition if OpenMP is enabled and size > 256
-    #pragma omp parallel for if(g_omp_enabled && N > 256)
+    // Parallelize the addition if OpenMP is enabled and the cost model says a team pays off
+    int T = cost_threads(N, 24.0 * N);  // one add and three doubles of memory traffic per element
+    #pragma omp parallel for num_threads(T) if(T > 1)
     //start the loop to do the add operation
     for (int i = 0; i < N; ++i)
         C->data[i] = A->data[i] + B->data[i];  // Add corresponding elements from A and B and the save the result in C
@@ -41,8 +44,9 @@ Matrix *op_sub_single(const Matrix *A, const Matrix *B, const char *name) {
     Matrix *C = alloc_like(A, name);  // Allocate a result matrix C with same dimensions as A
     int N = A->rows * A->cols;  // Total number of elements
     
-    // Parallelize the subtraction if OpenMP is enabled and size > 256
-    #pragma omp parallel for if(g_omp_enabled && N > 256)
+    // Parallelize the subtraction if OpenMP is enabled and the cost model says a team pays off
+    int T = cost_threads(N, 24.0 * N);
+    #pragma omp parallel for num_threads(T) if(T > 1)
 
     //start the loop to do the subtract operation 
     for (int i = 0; i < N; ++i)
@@ -55,170 +59,96 @@ Matrix *op_sub_single(const Matrix *A, const Matrix *B, const char *name) {
 // add and subtract with multiprocessing (IPC Pool) 
 //These functions perform matrix operations using multiple worker processes 
 
-// Function: ADD two matrices using multiple worker processes
-Matrix *op_add_processes(Pool *p, const Matrix *A, const Matrix *B, const char *name) {
+// Sends the job for `count` elements from offset `off` (A's elements, then B's) to worker wi
+static void send_chunk(Pool *p, int wi, int cmd, int job_id, const Matrix *A, const Matrix *B,
+                       int off, int count, double *payload) {
+    uint64_t t = now_nanos();
+    memcpy(payload, &A->data[off], (size_t)count * sizeof(double));
+    memcpy(payload + count, &B->data[off], (size_t)count * sizeof(double));
+    JobHeader h = { 
+        .cmd = cmd,                           // add or subtract
+        .job_id = job_id,                     // Unique job ID
+        .i = off / A->cols, .j = off % A->cols, // Coordinates of the first element
+        .rows = A->rows, .cols = A->cols,     // Matrix dimensions
+        .n = count,                           // number of elements in this job
+        .payload_bytes = (int)(2 * (size_t)count * sizeof(double)) // Size of data
+    };
+    t = phase_lap(PH_MARSHAL, t);
+    pool_send(wi, p, &h, payload);
+    phase_lap(PH_DISPATCH, t);
+    g_phase.jobs++;
+    g_phase.ipc_bytes += (uint64_t)h.payload_bytes;
+}
+
+// Element-wise A op B on the workers, `chunk` consecutive elements per job
+// (chunk size from the cost model: big enough that the pipe round trip is a small part of a job)
+static Matrix *elementwise_processes(Pool *p, const Matrix *A, const Matrix *B, const char *name, int cmd) {
     // Check if the two matrix have the same dimensions
     if (A->rows != B->rows || A->cols != B->cols) {
         fprintf(stderr, "The Two matrix have not the same dimensions\n");
         return NULL;
     }
 
+    phase_begin();
+    uint64_t t = now_nanos();
+
     // Allocate result matrix C with same dimensions as A
     Matrix *C = alloc_like(A, name);
 
-    // Initialize variables
-    int R = A->rows;     // Number of rows
-    int Cc = A->cols;    // Number of columns
-    int total = R * Cc;  // Total number of elements
+    int total = A->rows * A->cols;  // Total number of elements
+    int chunk = cost_chunk(total, 1.0, 24.0, p->n); // elements per job
     int next = 0;        // Index of next element to send to a worker(processe)
     int done = 0;        // Number of elements completed
-    int job_id = 1;      // Unique id for each worker (processe)
+    int job_id = 1;      // Unique id for each job
+    double *payload = mat_alloc((size_t)chunk * 2); // reused, pool_send has written it before the next job
+    phase_lap(PH_SETUP, t);
 
-    // Dispatch jobs to workers until all elements are assigned
+    // Dispatch jobs to workers until all of them are busy
     while (next < total) {
         int wi = pool_find_idle(p); // Find an available worker
         if (wi < 0) 
             break;          // if there is no worker No available, stop dispatching
-
-        // Compute the coordinates of the element 
-        int i = next / Cc;          // Row index
-        int j = next % Cc;          // Column index
-
-        // store the two elements in payload ==> element from first mattrix and element from second matrix
-        double payload[2] = { matrix_get(A,i,j), matrix_get(B,i,j) };
-
-        // Create JobHeader structure with all necessary information for worker
-        JobHeader h = { 
-            .cmd = CMD_ADD_ELEM,             // choose the operation: add element
-            .job_id = job_id++,              // Unique job ID
-            .i = i, .j = j,                  // Element coordinates
-            .rows = R, .cols = Cc, .n = 1,  // Matrix dimensions & number of elements
-            .payload_bytes = (int)sizeof(payload) // Size of data
-        };
-
-        // Send the job and data (payload) to the worker process
-        pool_send(wi, p, &h, payload);
-
-        next++; // Move to the next element to dispatch
+        int count = total - next < chunk ? total - next : chunk;
+        send_chunk(p, wi, cmd, job_id++, A, B, next, count, payload);
+        next += count; // Move to the next elements to dispatch
     }
 
-    // Collect results from workers
+    // Collect results from workers, each one goes straight into C
     while (done < total) {
         int wi;                // Worker index that finished a job
+        t = now_nanos();
         pool_wait_any(p, &wi); // Wait for any worker to finish
 
-        double val;            // Variable to store the value
-        ResultHeader rh;       // Result header have element coordinates
-
-        // Receive result from worker via IPC
-        if (pool_recv(wi, p, &rh, &val, sizeof(val)) < 0) 
+        ResultHeader rh;       // Result header have the coordinates of the first element
+        int got = pool_recv(wi, p, &rh, payload, (size_t)chunk * 2 * sizeof(double));
+        if (got < 0) 
             break; // if it fail , break from loop
-
-        // Set received value in the result matrix C
-        matrix_set(C, rh.i, rh.j, val);
-
-        done++; // Increment completed counter
+        t = phase_lap(PH_COLLECT, t);
+        int off = rh.i * A->cols + rh.j;
+        memcpy(&C->data[off], payload, (size_t)got);
+        done += got / (int)sizeof(double);
+        phase_lap(PH_ASSEMBLE, t);
+        g_phase.ns[PH_COMPUTE] += (uint64_t)rh.compute_ns;
+        g_phase.ipc_bytes += (uint64_t)got;
 
         // Dispatch a new job to this worker if elements remain
         if (next < total) {
-            int i = next / Cc;          // Compute row index
-            int j = next % Cc;          // Compute column index
-            double payload[2] = { matrix_get(A,i,j), matrix_get(B,i,j) }; // get the data
-           
-            // set the header for the worker process
-            JobHeader h = { 
-                .cmd = CMD_ADD_ELEM, 
-                .job_id = job_id++, 
-                .i = i, .j = j,
-                .rows = R, .cols = Cc, .n = 1,
-                .payload_bytes = (int)sizeof(payload)
-            };
-
-            pool_send(wi, p, &h, payload); // Send new job
-            next++; // Move to next element
+            int count = total - next < chunk ? total - next : chunk;
+            send_chunk(p, wi, cmd, job_id++, A, B, next, count, payload);
+            next += count;
         }
     }
 
+    mat_free(payload);
     return C; // return the final result matrix
 }
 
+// Function: ADD two matrices using multiple worker processes
+Matrix *op_add_processes(Pool *p, const Matrix *A, const Matrix *B, const char *name) {
+    return elementwise_processes(p, A, B, name, CMD_ADD_ELEM);
+}
+
 // Function: Subtract two matrices using multiple worker processes
 Matrix *op_sub_processes(Pool *p, const Matrix *A, const Matrix *B, const char *name) {
-    // Check if the two matrix have the same dimensions
-    if (A->rows != B->rows || A->cols != B->cols) {
-        fprintf(stderr, "The Two matrix have not the same dimensions \n");
-        return NULL;
-    }
-
-    // Allocate matrix for the final result 
-    Matrix *C = alloc_like(A, name);
-
-    // Initialize variables
-    int R = A->rows;     // Number of rows
-    int Cc = A->cols;    // Number of columns
-    int total = R * Cc;  // Total number of elements
-    int next = 0;        // Index of next element to send to a worker(processe)
-    int done = 0;        // Number of elements completed
-    int job_id = 1;      // Unique id for each worker (processe)
-
-    // Dispatch subtraction jobs to workers
-    while (next < total) {
-        int wi = pool_find_idle(p); // Find a worker
-        if (wi < 0) break;          // No available worker, stop dispatching
-
-        int i = next / Cc;          // Row index
-        int j = next % Cc;          // Column index
-        double payload[2] = { matrix_get(A,i,j), matrix_get(B,i,j) }; // get the data from the first and second matrices
-
-        JobHeader h = { 
-            .cmd = CMD_SUB_ELEM,     // choose the operation: subtract element
-            .job_id = job_id++,      // Job ID
-            .i = i, .j = j,          // Coordinates
-            .rows = R, .cols = Cc, .n = 1,
-            .payload_bytes = (int)sizeof(payload)
-        };
-
-        pool_send(wi, p, &h, payload); // Send job to worker
-        next++; // Move to next element
-    }
-
-    // Collect subtraction results from workers
-    while (done < total) {
-        int wi;
-        pool_wait_any(p, &wi); // Wait for any worker to finish
-
-        double val;       // store the sub value from worker
-        ResultHeader rh;  // Result header containing coordinates of the value 
-
-        // Receive result
-        if (pool_recv(wi, p, &rh, &val, sizeof(val)) < 0) 
-            break; // if fail so break 
-
-        // Store the value to the result matrix
-        matrix_set(C, rh.i, rh.j, val); 
-        done++;
-
-        // Send next job if more elements remain
-        if (next < total) {
-
-            // compute the coordinates
-            int i = next / Cc; 
-            int j = next % Cc;
-
-            double payload[2] = { matrix_get(A,i,j), matrix_get(B,i,j) };
-
-            JobHeader h = { 
-                .cmd = CMD_SUB_ELEM, 
-                .job_id = job_id++, 
-                .i = i, .j = j,
-                .rows = R, .cols = Cc, .n = 1,
-                .payload_bytes = (int)sizeof(payload)
-            };
-
-            pool_send(wi, p, &h, payload);
-            next++;
-        }
-    }
-
-    return C; // return final subtraction result matrix
-}
\ No newline at end of file
+    return elementwise_processes(p, A, B, name, CMD_SUB_ELEM);
+}
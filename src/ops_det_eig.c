@@ -1,5 +1,8 @@
 #include "common.h"
 #include "ops.h"
+#include "mat_alloc.h"
+#include "cost.h"
+#include "timer.h"
 #include <unistd.h>
 #include <sys/wait.h>
 #include <math.h>
@@ -26,7 +29,7 @@ static double *copy_matrix_dense(const Matrix *A) {
     int n = A->rows, m = A->cols;
 
     //allocate memory for the new array
-    double *M = (double *)xmalloc((size_t)n * (size_t)m * sizeof(double));
+    double *M = mat_alloc((size_t)n * (size_t)m);
     
     //fill the array with the matrix values that we pass to this function
     //basically flatten the 2d matrix into a single long 1d array
@@ -36,26 +39,6 @@ static double *copy_matrix_dense(const Matrix *A) {
     return M;
 }
 
-//decide how many workers -threads/processes- to use
-static int choose_workers(int nrows) {
-    //get number of CPU cores that available
-    long cores = sysconf(_SC_NPROCESSORS_ONLN);
-    //use system cores if available else use 4 -default-
-    int w;
-    if (cores > 0) {
-        w = (int)cores;
-    } else {
-        w = 4;
-    }
-    
-    //this is to make sure that we dont assign more workers than rows
-    if (w > nrows) w = nrows;
-    //to make sure that at least one worker
-    if (w < 1) w = 1;
-
-    return w;
-}
-
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 // SINGLE-PROCESS (determinant) using gaussian elimination -lu method-
@@ -87,7 +70,7 @@ double op_det_single(const Matrix *A) {
 
         //if pivot is small(which make floating point errors) so the det is 0
         if (maxv < 1e-12) {
-             free(M); 
+             mat_free(M); 
              return 0.0;
              }
         
@@ -107,11 +90,14 @@ double op_det_single(const Matrix *A) {
         const double pivot = M[(size_t)k*(size_t)n + (size_t)k];//this is to get the value of pivot
         double *prow = &M[(size_t)k*(size_t)n + (size_t)(k+1)];//this is a pointer to next columns in pivot row
 
+        //threads worth it for the rows left (2 flops and 2 doubles of traffic per updated cell), 1 when omp is off
+        double cells = (double)(n-k-1) * (double)(n-k);
+        int T = cost_threads(2.0 * cells, 16.0 * cells);
 
 #ifdef HAVE_OMP
-        //if omp ia available and enabled we run parallel processing
-        if (g_omp_enabled) {
-#pragma omp parallel for schedule(static)
+        //if omp ia available and enabled and the step is big enough we run parallel processing
+        if (T > 1) {
+#pragma omp parallel for num_threads(T) schedule(static)
             for (int i=k+1;i<n;i++) {
                 double *row = &M[(size_t)i*(size_t)n + (size_t)k];
                 double aik = row[0] / pivot;//ratio of pivot
@@ -138,36 +124,41 @@ double op_det_single(const Matrix *A) {
     double det = (double)sign;
     for (int i=0;i<n;i++) det *= M[(size_t)i*(size_t)n + (size_t)i];
    
-    free(M);//free memory
+    mat_free(M);//free memory
     return det;//return the determinant
 }
 
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 //SINGLE-PROCESS: (dominant eigen) power iteration
-int op_eigen_power(const Matrix *A, double tol, int maxit,
+int op_eigen_power(const Matrix *A, double tol, int maxit, const double *x0,
                    double *lambda_out, double **vec_out) {
     //check if matrix exists, is square, and inputs are valid
     if (!A || A->rows != A->cols || tol <= 0.0 || maxit <= 0) return -1;
     int n = A->rows;
     
     //allocate memory for 3 vectors
-    double *x  = (double *)xmalloc((size_t)n*sizeof(double));//current vector
-    double *y  = (double *)xmalloc((size_t)n*sizeof(double));//result vector A*x
-    double *xn = (double *)xmalloc((size_t)n*sizeof(double));//normalized vector
+    double *x  = mat_alloc((size_t)n);//current vector
+    double *y  = mat_alloc((size_t)n);//result vector A*x
+    double *xn = mat_alloc((size_t)n);//normalized vector
     
-    // start with x = [1, 1, 1, ...]
-    for (int i=0;i<n;i++) x[i] = 1.0;
+    // start with x = [1, 1, 1, ...], or the warm start vector if we have one
+    if (x0) memcpy(x, x0, (size_t)n*sizeof(double));
+    else for (int i=0;i<n;i++) x[i] = 1.0;
 
     int it;//iteration counter
     double lambda = 0.0;//dominant eigenvalue
 
+    //threads for y = A*x and for the two sums over n values, from the cost model (1 when omp is off)
+    int T = cost_threads(2.0 * n * (double)n, 8.0 * n * (double)n);
+    int Tv = cost_threads(2.0 * n, 16.0 * n);
+
     //repeat power iteration process
     for (it=1; it<=maxit; ++it) {
      //compute y= A*x 
 #ifdef HAVE_OMP
-        if (g_omp_enabled) {
-#pragma omp parallel for schedule(static)
+        if (T > 1) {
+#pragma omp parallel for num_threads(T) schedule(static)
             for (int i=0;i<n;i++) {
                 double s = 0.0;
                 //multiply each row of A with vector x
@@ -188,8 +179,8 @@ int op_eigen_power(const Matrix *A, double tol, int maxit,
         //find the length of vector y
         double norm2 = 0.0;
 #ifdef HAVE_OMP
-        if (g_omp_enabled) {
-#pragma omp parallel for reduction(+:norm2) schedule(static)
+        if (Tv > 1) {
+#pragma omp parallel for num_threads(Tv) reduction(+:norm2) schedule(static)
             for (int i=0;i<n;i++) norm2 += y[i]*y[i];//sum of squares
         } else
 #endif
@@ -200,7 +191,7 @@ int op_eigen_power(const Matrix *A, double tol, int maxit,
 
         //if norm is almost 0 then it means that the matrix have issues
         if (norm < 1e-20) { 
-            free(x); free(y); free(xn);
+            mat_free(x); mat_free(y); mat_free(xn);
             return -1; }
         //normalize vector xn=y/norm
         for (int i=0;i<n;i++) xn[i] = y[i] / norm;
@@ -209,8 +200,8 @@ int op_eigen_power(const Matrix *A, double tol, int maxit,
         //find lambda
         double rnum = 0.0;
 #ifdef HAVE_OMP
-        if (g_omp_enabled) {
-#pragma omp parallel for reduction(+:rnum) schedule(static)
+        if (Tv > 1) {
+#pragma omp parallel for num_threads(Tv) reduction(+:rnum) schedule(static)
             for (int i=0;i<n;i++) rnum += xn[i]*y[i];
         } else
 #endif
@@ -237,7 +228,7 @@ int op_eigen_power(const Matrix *A, double tol, int maxit,
     *lambda_out = lambda;
     *vec_out = xn;
     
-    free(x); free(y);
+    mat_free(x); mat_free(y);
     return it;//return num of iterations 
 }
 
@@ -251,8 +242,11 @@ double op_det_processes(Pool *p, const Matrix *A) {
     if (!A || A->rows != A->cols) return NAN;
 
     int n = A->rows;
+    phase_begin();//per-phase times for the report (timer.h)
+    uint64_t t = now_nanos();
     double *M = copy_matrix_dense(A);//make a 1d copy of matrix
     int sign = 1;// keep track of sign changes from row swaps
+    t = phase_lap(PH_SETUP, t);
 
     //go through each column to do elimination
     for (int k = 0; k < n; ++k) {
@@ -267,7 +261,7 @@ double op_det_processes(Pool *p, const Matrix *A) {
                 piv = i; }
         }
         //if pivot is almost 0 return the determinat =0
-        if (maxv < 1e-12) { free(M); return 0.0; }
+        if (maxv < 1e-12) { mat_free(M); return 0.0; }
 
         //swap row if pivot row is different
         if (piv != k) {
@@ -278,16 +272,19 @@ double op_det_processes(Pool *p, const Matrix *A) {
             }
             sign = -sign;//swapping flips determinant sign
         }
+        t = phase_lap(PH_COMPUTE, t);//pivot search and swap happen here
         //if this is the last row stop
         if (k == n-1) break;
 
         //remeaning rows after pivot
         int rows_rem = n - (k+1);
-        //choose how many worker to use
-        int W = choose_workers(rows_rem);
+        //choose how many worker to use: the cost model weighs the forks and the rows
+        //going through the pipes (there and back) against doing the step here
+        double cells = (double)rows_rem * (double)(n - k);
+        int W = cost_procs(2.0 * cells, 16.0 * cells, 2, rows_rem < 64 ? rows_rem : 64);
 
-        //if small matrix or only one process(worker) we do normal elimination
-        if (rows_rem <= 8 || W == 1) {
+        //only one row left below the pivot: nothing to split, we do normal elimination
+        if (W == 1) {
             const double pivot = M[(size_t)k*(size_t)n + (size_t)k];
             double *prow = &M[(size_t)k*(size_t)n + (size_t)(k+1)];
             for (int i=k+1;i<n;i++) {
@@ -298,6 +295,7 @@ double op_det_processes(Pool *p, const Matrix *A) {
                 }
                 M[(size_t)i*(size_t)n + (size_t)k] = 0.0;//set eliminated cell to 0
             }
+            t = phase_lap(PH_COMPUTE, t);
             continue;
         }
 
@@ -321,28 +319,22 @@ double op_det_processes(Pool *p, const Matrix *A) {
             if (i1 > n) i1 = n;
 
             //create pipes for data exchange
-            if (pipe(p2c[w]) < 0 || pipe(c2p[w]) < 0) { perror("pipe"); free(M); return NAN; }
+            if (pipe(p2c[w]) < 0 || pipe(c2p[w]) < 0) { perror("pipe"); mat_free(M); return NAN; }
             
             //create a new process
             pid_t pid = fork();
-            if (pid < 0) { perror("fork"); free(M); return NAN; }
+            if (pid < 0) { perror("fork"); mat_free(M); return NAN; }
 
 
             //child process code
             if (pid == 0) {
                 close(p2c[w][1]); close(c2p[w][0]);//close write and read end 
 
-                //set number of threads for this process 
+                //one thread per process: the rows are already split over W processes, and a child
+                //forked after this process started OpenMP threads hangs in a team of its own
 #ifdef HAVE_OMP
-                if (g_omp_enabled) {
-                    int cores = omp_get_num_procs();
-                    int threads = cores / W; if (threads < 1) threads = 1;
-                    omp_set_dynamic(0);
-                    omp_set_num_threads(threads);
-                } else {
-                    omp_set_dynamic(0);
-                    omp_set_num_threads(1);
-                }
+                omp_set_dynamic(0);
+                omp_set_num_threads(1);
 #endif
                 
                 int hdr[4];
@@ -357,7 +349,7 @@ double op_det_processes(Pool *p, const Matrix *A) {
                 //read pivot row segment
                 int seg = H_n - H_k - 1;
                 if (seg < 0) seg = 0;
-                double *H_prow = (double *)xmalloc((size_t)seg*sizeof(double));
+                double *H_prow = mat_alloc((size_t)seg);
                 if (seg > 0) {
                     if (read_all(p2c[w][0], H_prow, (size_t)seg*sizeof(double)) != (ssize_t)((size_t)seg*sizeof(double))) _exit(113);
                 }
@@ -365,10 +357,11 @@ double op_det_processes(Pool *p, const Matrix *A) {
                 //read assigned rows for this child
                 size_t rowlen = (size_t)(H_n - H_k);
                 size_t bufcount = (size_t)(H_i1 - H_i0) * rowlen;
-                double *buf = (double *)xmalloc(bufcount * sizeof(double));
+                double *buf = mat_alloc(bufcount);
                 if (read_all(p2c[w][0], buf, bufcount*sizeof(double)) != (ssize_t)(bufcount*sizeof(double))) _exit(114);
 
                 //perform gussian elimination on this child part 
+                uint64_t H_t0 = now_nanos();
 #pragma omp parallel for if(g_omp_enabled) schedule(static)
                 for (int r=0;r<(H_i1 - H_i0);r++) {
                     double *row = &buf[(size_t)r*rowlen];
@@ -378,9 +371,11 @@ double op_det_processes(Pool *p, const Matrix *A) {
                     for (int j=1;j<=(int)seg;j++) row[j] -= aik * H_prow[j-1];
                 }
 
-                //send back the modified rows to parent
+                //send back the modified rows to parent, then how long the elimination took
+                int64_t H_ns = (int64_t)(now_nanos() - H_t0);
                 if (write_all(c2p[w][1], buf, bufcount*sizeof(double)) != (ssize_t)(bufcount*sizeof(double))) _exit(115);
-                free(buf); free(H_prow);
+                if (write_all(c2p[w][1], &H_ns, sizeof(H_ns)) != (ssize_t)sizeof(H_ns)) _exit(116);
+                mat_free(buf); mat_free(H_prow);
                 _exit(0);//end child
             }
 
@@ -388,29 +383,35 @@ double op_det_processes(Pool *p, const Matrix *A) {
             kids[active++] = pid;//store child id
 
             close(p2c[w][0]); close(c2p[w][1]);//parent closes read and write end
+            t = phase_lap(PH_SETUP, t);//pipes and fork
 
             //send work header and pivot info to the child
             int hdr[4] = { i0, i1, k, n };
-            if (write_all(p2c[w][1], hdr, sizeof(hdr)) != (ssize_t)sizeof(hdr)) { perror("write hdr"); free(M); return NAN; }
-            if (write_all(p2c[w][1], &pivot, sizeof(double)) != (ssize_t)sizeof(double)) { perror("write pivot"); free(M); return NAN; }
+            if (write_all(p2c[w][1], hdr, sizeof(hdr)) != (ssize_t)sizeof(hdr)) { perror("write hdr"); mat_free(M); return NAN; }
+            if (write_all(p2c[w][1], &pivot, sizeof(double)) != (ssize_t)sizeof(double)) { perror("write pivot"); mat_free(M); return NAN; }
 
             //send pivot row segment
             int seg = n - k - 1;
             if (seg < 0) seg = 0;
             if (seg > 0) {
-                if (write_all(p2c[w][1], prow, (size_t)seg*sizeof(double)) != (ssize_t)((size_t)seg*sizeof(double))) { perror("write prow"); free(M); return NAN; }
+                if (write_all(p2c[w][1], prow, (size_t)seg*sizeof(double)) != (ssize_t)((size_t)seg*sizeof(double))) { perror("write prow"); mat_free(M); return NAN; }
             }
 
             //send the rows chunk to the child 
             size_t rowlen = (size_t)(n - k);
             size_t bufcount = (size_t)(i1 - i0) * rowlen;
-            double *buf = (double *)xmalloc(bufcount*sizeof(double));
+            t = phase_lap(PH_DISPATCH, t);
+            double *buf = mat_alloc(bufcount);
             for (int ii=i0; ii<i1; ++ii) {
                 memcpy(&buf[(size_t)(ii-i0)*rowlen], &M[(size_t)ii*(size_t)n + (size_t)k], rowlen*sizeof(double));
             }
-            if (write_all(p2c[w][1], buf, bufcount*sizeof(double)) != (ssize_t)(bufcount*sizeof(double))) { perror("write rows"); free(buf); free(M); return NAN; }
-            free(buf);
+            t = phase_lap(PH_MARSHAL, t);
+            if (write_all(p2c[w][1], buf, bufcount*sizeof(double)) != (ssize_t)(bufcount*sizeof(double))) { perror("write rows"); mat_free(buf); mat_free(M); return NAN; }
+            mat_free(buf);
             close(p2c[w][1]);//close write after sending data
+            t = phase_lap(PH_DISPATCH, t);
+            g_phase.jobs++;
+            g_phase.ipc_bytes += sizeof(hdr) + sizeof(double) * (1 + (size_t)seg + bufcount);
         }
 
         //parent reads results back from children
@@ -423,35 +424,43 @@ double op_det_processes(Pool *p, const Matrix *A) {
 
             size_t rowlen = (size_t)(n - k);
             size_t bufcount = (size_t)(i1 - i0) * rowlen;
-            double *buf = (double *)xmalloc(bufcount*sizeof(double));
-            if (read_all(c2p[w][0], buf, bufcount*sizeof(double)) != (ssize_t)(bufcount*sizeof(double))) { perror("read rows"); free(buf); free(M); return NAN; }
+            double *buf = mat_alloc(bufcount);
+            int64_t ns = 0;
+            if (read_all(c2p[w][0], buf, bufcount*sizeof(double)) != (ssize_t)(bufcount*sizeof(double))
+                || read_all(c2p[w][0], &ns, sizeof(ns)) != (ssize_t)sizeof(ns)) { perror("read rows"); mat_free(buf); mat_free(M); return NAN; }
+            t = phase_lap(PH_COLLECT, t);
+            g_phase.ns[PH_COMPUTE] += (uint64_t)ns;
+            g_phase.ipc_bytes += bufcount*sizeof(double);
 
             //copy the updated rows back into main matrix 
             for (int ii=i0; ii<i1; ++ii) {
                 memcpy(&M[(size_t)ii*(size_t)n + (size_t)k], &buf[(size_t)(ii-i0)*rowlen], rowlen*sizeof(double));
             }
-            free(buf);
+            mat_free(buf);
             close(c2p[w][0]);
+            t = phase_lap(PH_ASSEMBLE, t);
         }
 
         //wait for all child processes to finish 
         for (int w=0; w<active; ++w) {
             int status; (void)waitpid(kids[w], &status, 0);
         }
+        t = phase_lap(PH_COLLECT, t);
     }
 
     //compute determinant by multiplying diagonal elemants
     double det = (double)sign;
     for (int i=0;i<n;i++) det *= M[(size_t)i*(size_t)n + (size_t)i];
     
-    free(M);
+    mat_free(M);
+    phase_lap(PH_ASSEMBLE, t);
     return det;
 }
 
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
 //MULTI-PROCESS: dominant eigen (per-iteration row chunks)
-int op_eigen_processes(Pool *p, const Matrix *A, double tol, int maxit,
+int op_eigen_processes(Pool *p, const Matrix *A, double tol, int maxit, const double *x0,
                        double *lambda_out, double **vec_out) {
     
     (void)p;//this is to avoid compiler warning pool not used here
@@ -459,18 +468,22 @@ int op_eigen_processes(Pool *p, const Matrix *A, double tol, int maxit,
     if (!A || A->rows != A->cols || tol <= 0.0 || maxit <= 0) return -1;
 
     int n = A->rows;
+    phase_begin();//per-phase times for the report (timer.h)
+    uint64_t t = now_nanos();
     //allocate memory for vectors
-    double *x  = (double *)xmalloc((size_t)n*sizeof(double));//normalized vector
-    double *y  = (double *)xmalloc((size_t)n*sizeof(double));//result vector A*x
-    double *xn = (double *)xmalloc((size_t)n*sizeof(double));//normalized vector
+    double *x  = mat_alloc((size_t)n);//normalized vector
+    double *y  = mat_alloc((size_t)n);//result vector A*x
+    double *xn = mat_alloc((size_t)n);//normalized vector
     
-    //start with x = [1, 1, 1, ...]
-    for (int i=0;i<n;i++) x[i] = 1.0;
+    //start with x = [1, 1, 1, ...], or the warm start vector if we have one
+    if (x0) memcpy(x, x0, (size_t)n*sizeof(double));
+    else for (int i=0;i<n;i++) x[i] = 1.0;
 
-    //choose number of worker processes
-    int W = choose_workers(n);
+    //choose number of worker processes: forks per iteration against the rows of A*x each one does,
+    //the children see A and x through fork and only send their part of y back
+    int W = cost_procs(2.0 * n * (double)n, 8.0 * n, 2, n < 64 ? n : 64);
     if (W < 1) W = 1;
-    if (W > 64) W = 64;
+    t = phase_lap(PH_SETUP, t);
 
     int it;//iteration counter
     double lambda = 0.0;//eigenvalue estimate
@@ -482,36 +495,40 @@ int op_eigen_processes(Pool *p, const Matrix *A, double tol, int maxit,
         int chunk = (n + W - 1) / W;//how many rows each process handles
         int active = 0;
 
+        //a 1x1 matrix: this process does y = A*x itself
+        if (W == 1) {
+            for (int i=0;i<n;i++) {
+                double s = 0.0;
+                for (int j=0;j<n;j++) s += matrix_get(A,i,j)*x[j];
+                y[i] = s;
+            }
+            t = phase_lap(PH_COMPUTE, t);
+        }
+
         //this is to create worker processes for matrix vector multiplication
-        for (int w=0; w<W; ++w) {
+        for (int w=0; W > 1 && w<W; ++w) {
             int i0 = w*chunk;
             int i1 = i0 + chunk;
             if (i0 >= n) break;
             if (i1 > n) i1 = n;
 
             int pipefd[2];
-            if (pipe(pipefd) < 0) { perror("pipe"); free(x); free(y); free(xn); return -1; }
+            if (pipe(pipefd) < 0) { perror("pipe"); mat_free(x); mat_free(y); mat_free(xn); return -1; }
             pid_t pid = fork();
-            if (pid < 0) { perror("fork"); free(x); free(y); free(xn); return -1; }
+            if (pid < 0) { perror("fork"); mat_free(x); mat_free(y); mat_free(xn); return -1; }
             
             //child process
             if (pid == 0) {
                 close(pipefd[0]);//child closes read end only 
 
+                //one thread per process: the rows of y are already split over W processes, and a child
+                //forked after this process started OpenMP threads hangs in a team of its own
 #ifdef HAVE_OMP
-                
-                //set up threads if omp is on
-                if (g_omp_enabled) {
-                    int cores = omp_get_num_procs();
-                    int threads = cores / W; if (threads < 1) threads = 1;
-                    omp_set_dynamic(0);
-                    omp_set_num_threads(threads);
-                } else {
-                    omp_set_dynamic(0);
-                    omp_set_num_threads(1);
-                }
+                omp_set_dynamic(0);
+                omp_set_num_threads(1);
 #endif
                 //perform part ot y =A*x
+                uint64_t t0 = now_nanos();
 #pragma omp parallel for if(g_omp_enabled) schedule(static)
                 for (int i=i0;i<i1;i++) {
                     double s = 0.0;
@@ -519,8 +536,10 @@ int op_eigen_processes(Pool *p, const Matrix *A, double tol, int maxit,
                     y[i] = s; 
                 }
 
-                //sed this part ot y back to parent 
+                //sed this part ot y back to parent, then how long it took
+                int64_t ns = (int64_t)(now_nanos() - t0);
                 if (write_all(pipefd[1], &y[i0], (size_t)(i1 - i0)*sizeof(double)) != (ssize_t)((size_t)(i1-i0)*sizeof(double))) _exit(121);
+                if (write_all(pipefd[1], &ns, sizeof(ns)) != (ssize_t)sizeof(ns)) _exit(122);
                 close(pipefd[1]);
                 _exit(0);
             }
@@ -532,6 +551,8 @@ int op_eigen_processes(Pool *p, const Matrix *A, double tol, int maxit,
             c2p[active][1] = pipefd[1];
             active++;
             close(pipefd[1]);//parent does not write 
+            t = phase_lap(PH_SETUP, t);//pipe and fork, the children see A and x without a payload
+            g_phase.jobs++;
         }
 
         //parent collects from all children the partial results
@@ -540,20 +561,25 @@ int op_eigen_processes(Pool *p, const Matrix *A, double tol, int maxit,
             int i1 = i0 + chunk;
             if (i0 >= n) break;
             if (i1 > n) i1 = n;
-            if (read_all(c2p[w][0], &y[i0], (size_t)(i1-i0)*sizeof(double)) != (ssize_t)((size_t)(i1-i0)*sizeof(double))) { perror("read y"); free(x); free(y); free(xn); return -1; }
+            int64_t ns = 0;
+            if (read_all(c2p[w][0], &y[i0], (size_t)(i1-i0)*sizeof(double)) != (ssize_t)((size_t)(i1-i0)*sizeof(double))
+                || read_all(c2p[w][0], &ns, sizeof(ns)) != (ssize_t)sizeof(ns)) { perror("read y"); mat_free(x); mat_free(y); mat_free(xn); return -1; }
             close(c2p[w][0]);//close after reading
+            g_phase.ns[PH_COMPUTE] += (uint64_t)ns;
+            g_phase.ipc_bytes += (size_t)(i1-i0)*sizeof(double);
         }
         //wait all child processes to finish
         for (int w=0; w<active; ++w) {
             int status; (void)waitpid(kids[w], &status, 0);
         }
+        t = phase_lap(PH_COLLECT, t);//the parts of y are read straight into place
 
         //calculate norm length of y
         double norm2 = 0.0;
         for (int i=0;i<n;i++) norm2 += y[i]*y[i];
         double norm = sqrt(norm2);
         //if norm is almost 0 then it means that the matrix have issues
-        if (norm < 1e-20) { free(x); free(y); free(xn); return -1; }
+        if (norm < 1e-20) { mat_free(x); mat_free(y); mat_free(xn); return -1; }
 
         //normalize vector
         for (int i=0;i<n;i++) xn[i] = y[i] / norm;
@@ -572,6 +598,7 @@ int op_eigen_processes(Pool *p, const Matrix *A, double tol, int maxit,
 
         //update x for the next iteration
         memcpy(x, xn, (size_t)n*sizeof(double));
+        t = phase_lap(PH_ASSEMBLE, t);//norm, normalized vector, lambda and the convergence test
         //if difference is small enough we stop iterating
         if (diff < tol) break;
     }
@@ -580,6 +607,38 @@ int op_eigen_processes(Pool *p, const Matrix *A, double tol, int maxit,
     *lambda_out = lambda;
     *vec_out = xn;
     
-    free(x); free(y);
+    mat_free(x); mat_free(y);
     return it;
 }
+
+
+///////////////////////////////////////////////////////////////////////////////////////////////////
+//WARM START: keep the converged eigenvector on the matrix
+
+//store a copy of vec as the start vector for the next solve on A
+void eig_warm_store(Matrix *A, const double *vec) {
+    int n = A->rows;
+    if (!A->eig_vec) A->eig_vec = mat_alloc((size_t)n);
+    memcpy(A->eig_vec, vec, (size_t)n*sizeof(double));
+
+    //remember the matrix size (norm) so edits can be measured against it
+    double s = 0.0;
+    for (size_t k=0; k<(size_t)n*(size_t)n; k++) s += A->data[k]*A->data[k];
+    A->eig_norm = sqrt(s);
+    A->eig_drift = 0.0;
+}
+
+//start vector for A, NULL if none was stored or it was invalidated
+const double *eig_warm_get(const Matrix *A) {
+    return A->eig_vec;
+}
+
+//account for an edit, drop the vector once the matrix moved too far from it
+void eig_warm_note_edit(Matrix *A, double delta_norm) {
+    if (!A->eig_vec) return;
+    A->eig_drift += delta_norm;//triangle inequality: upper bound of the total change
+    if (A->eig_drift > EIG_WARM_MAX_DRIFT * A->eig_norm) {
+        mat_free(A->eig_vec);
+        A->eig_vec = NULL;
+    }
+}
@@ -1,6 +1,8 @@
 #include "common.h"   
 #include "ops.h"      
 #include "timer.h"    
+#include "mat_alloc.h"
+#include "cost.h"
 
 // Function: multiply two matrices using single processes (or openmp if enabled)
 Matrix *op_mul_single(const Matrix *A, const Matrix *B, const char *name) {
@@ -10,22 +12,79 @@ Matrix *op_mul_single(const Matrix *A, const Matrix *B, const char *name) {
         return NULL;  // Return NULL if dimensions are invalid
     }
 
-    // Allocate result matrix C with dimensions (A.rows x B.cols)
+    // Allocate result matrix C with dimensions (A.rows x B.cols), zero filled
     Matrix *C = matrix_create(name, A->rows, B->cols);
 
-    
-    // OpenMP: parallelize loops if enabled and matrix not too small, collapse(2) merges nested loops for better load balancing
-    #pragma omp parallel for if(g_omp_enabled && (A->rows * B->cols > 8)) collapse(2)
-    for (int i = 0; i < A->rows; i++) { // rows if the first matrix
-        for (int j = 0; j < B->cols; j++) { // cols of the second matrix 
-            double s = 0.0;  // store the dot product of row i of A and column j of B
-            for (int k = 0; k < A->cols; k++)
-                s += matrix_get(A, i, k) * matrix_get(B, k, j);  // Multiply corresponding elements and sum
-            matrix_set(C, i, j, s);  // Store computed value in result matrix
+    // C += A*B with the blocked kernel below (g_gemm_block tiles, OpenMP team from the
+    // cost model); each C[i][j] still sums A[i][k]*B[k][j] in k order, like the pool does
+    gemm_block_acc(A->rows, B->cols, A->cols, A->data, (size_t)A->cols, B->data, (size_t)B->cols,
+                   C->data, (size_t)C->cols);
+
+    return C;  // Return the result matrix
+}
+
+int g_gemm_block = GEMM_BLOCK;
+
+// Blocked C += A*B: g_gemm_block x g_gemm_block tiles of A, B and C stay in cache
+// while they are reused, and the inner loop runs along rows of B and C.
+void gemm_block_acc(int m, int n, int k, const double *A, size_t lda,
+                    const double *B, size_t ldb, double *C, size_t ldc) {
+    // each thread owns whole row blocks of C, so no two threads write the same element
+    int T = cost_threads(2.0 * m * n * k, 8.0 * ((double)m * k + (double)k * n + (double)m * n));
+    int bs = g_gemm_block;
+    #pragma omp parallel for num_threads(T) if(T > 1) schedule(static)
+    for (int i0 = 0; i0 < m; i0 += bs) {
+        int i1 = i0 + bs < m ? i0 + bs : m;
+        for (int k0 = 0; k0 < k; k0 += bs) {
+            int k1 = k0 + bs < k ? k0 + bs : k;
+            for (int j0 = 0; j0 < n; j0 += bs) {
+                int j1 = j0 + bs < n ? j0 + bs : n;
+                for (int i = i0; i < i1; i++) {
+                    double *c = C + (size_t)i * ldc;
+                    for (int kk = k0; kk < k1; kk++) {
+                        double a = A[(size_t)i * lda + kk];
+                        const double *b = B + (size_t)kk * ldb;
+                        for (int j = j0; j < j1; j++)
+                            c[j] += a * b[j];
+                    }
+                }
+            }
         }
     }
+}
 
-    return C;  // Return the result matrix
+// Sends the cells (i, j .. j+span-1) to worker wi: row i of A, then span columns of B
+static void send_cells(Pool *p, int wi, int job_id, const Matrix *A, const Matrix *B,
+                       int i, int j, int span, double *payload) {
+    int K = A->cols;
+    uint64_t t = now_nanos();
+
+    // Copy row i of A into payload
+    memcpy(payload, &A->data[(size_t)i * K], (size_t)K * sizeof(double));
+
+    // Extract the columns of B straight after it, one after the other
+    for (int c = 0; c < span; c++)
+        for (int r = 0; r < K; r++)
+            payload[(size_t)(c + 1) * K + r] = matrix_get(B, r, j + c);
+
+    // Create job header with information for the worker
+    JobHeader h = { 
+        .cmd = CMD_MUL_CELL,        // Choose the operation type: multiplication of a run of cells in one row
+        .job_id = job_id,           // Unique identifier for this job
+        .i = i,                     // Row index of the cells to compute
+        .j = j,                     // Column index of the first cell
+        .rows = 1,                  // one row of the result
+        .cols = span,               // number of cells (columns) in this job
+        .n = K,                     // Number of elements in the row/column (length of dot product)
+        .payload_bytes = (int)((size_t)(span + 1) * K * sizeof(double)) // Size of data being sent (row + columns)
+    };
+
+    // Send job and data to worker process
+    t = phase_lap(PH_MARSHAL, t);
+    pool_send(wi, p, &h, payload);
+    phase_lap(PH_DISPATCH, t);
+    g_phase.jobs++;
+    g_phase.ipc_bytes += (uint64_t)h.payload_bytes;
 }
 
 // Matrix multiplication using a pool of processes (multiprocessing)
@@ -36,6 +95,9 @@ Matrix *op_mul_processes(Pool *p, const Matrix *A, const Matrix *B, const char *
         return NULL;
     }
 
+    phase_begin();
+    uint64_t t = now_nanos();
+
     // Allocate result matrix C
     Matrix *C = matrix_create(name, A->rows, B->cols);
 
@@ -43,8 +105,17 @@ Matrix *op_mul_processes(Pool *p, const Matrix *A, const Matrix *B, const char *
     int K = A->cols;   // Number of columns in A (also rows in B)
     int Cc = B->cols;  // Number of columns in B
 
-    // Allocate temporary array to store a column of B for fast access
-    double *Bcol = (double*)xmalloc((size_t)K * sizeof(double));
+    // cells per job from the cost model (a job never crosses the end of a row);
+    // each cell costs a column of B through the pipe and a dot product of length K
+    int chunk = cost_chunk((double)R * Cc, 2.0 * K, 8.0 * (K + 1), p->n);
+    if (chunk > Cc) chunk = Cc;
+    if (chunk < 1) chunk = 1;
+
+    // One payload buffer (row of A + columns of B) reused for every job,
+    // pool_send has written it to the pipe before we build the next one
+    double *payload = mat_alloc((size_t)K * (chunk + 1));
+    double *vals = mat_alloc((size_t)chunk);
+    phase_lap(PH_SETUP, t);
 
     int total = R * Cc;  // Total number of elements in result matrix
     int next = 0;         // Next element to assign as a job to the process
@@ -57,86 +128,47 @@ Matrix *op_mul_processes(Pool *p, const Matrix *A, const Matrix *B, const char *
         if (wi < 0) 
             break;           // Exit if no available workers
 
-        // Compute row and column indices for the current element
+        // Compute row and column indices for the first cell, and how many cells fit in this row
         int i = next / Cc;
         int j = next % Cc;
+        int span = Cc - j < chunk ? Cc - j : chunk;
 
-        // Allocate the data for this job: row from A + column from B
-        double *payload = (double*)xmalloc((size_t)K * 2 * sizeof(double));
-
-        // Copy row i of A into payload
-        memcpy(payload, &A->data[(size_t)i * A->cols], (size_t)K * sizeof(double));
-
-        // Extract column j of B and copy into payload
-        for (int r = 0; r < K; r++)
-            Bcol[r] = matrix_get(B, r, j);
-        memcpy(payload + K, Bcol, (size_t)K * sizeof(double));
-
-        // Create job header with information for the worker
-            JobHeader h = { 
-                .cmd = CMD_MUL_CELL,        // Choose the operation type: multiplication of a single cell
-                .job_id = job_id++,          // Unique identifier for this job
-                .i = i,                      // Row index of the element to compute
-                .j = j,                      // Column index of the element to compute
-                .rows = R,                   // Total number of rows in the result matrix
-                .cols = Cc,                  // Total number of columns in the result matrix
-                .n = K,                      // Number of elements in the row/column (length of dot product)
-                .payload_bytes = (int)(2 * K * sizeof(double)) // Size of data being sent (row + column)
-            };
-
-        // Send job and data to worker process
-        pool_send(wi, p, &h, payload);
-
-        free(payload);  // Free temporary payload memory
-        next++;         // Move to next element
+        send_cells(p, wi, job_id++, A, B, i, j, span, payload);
+        next += span;         // Move to next cells
     }
 
-    double val;  // To store received result
-
     // Receive results from workers and continue sending new jobs
     while (done < total) {
         int wi;              // Worker index
+        t = now_nanos();
         pool_wait_any(p, &wi);  // Wait for any worker to finish
         ResultHeader rh;         // Result header
 
         // Receive result from worker
-        if (pool_recv(wi, p, &rh, &val, sizeof(val)) < 0)
+        int got = pool_recv(wi, p, &rh, vals, (size_t)chunk * sizeof(double));
+        if (got < 0)
              break;//break loop if failed
+        t = phase_lap(PH_COLLECT, t);
 
-        // Store computed value in result matrix
-        matrix_set(C, rh.i, rh.j, val);
-        done++;  // Increment completed elements
+        // Store computed values in result matrix
+        memcpy(&C->data[(size_t)rh.i * Cc + rh.j], vals, (size_t)got);
+        done += got / (int)sizeof(double);  // Increment completed elements
+        phase_lap(PH_ASSEMBLE, t);
+        g_phase.ns[PH_COMPUTE] += (uint64_t)rh.compute_ns;
+        g_phase.ipc_bytes += (uint64_t)got;
 
         // If there are remaining jobs, send the next one to this worker
         if (next < total) {
             int i = next / Cc;
             int j = next % Cc;
+            int span = Cc - j < chunk ? Cc - j : chunk;
 
-            double *payload = (double*)xmalloc((size_t)K * 2 * sizeof(double));
-            memcpy(payload, &A->data[(size_t)i * A->cols], (size_t)K * sizeof(double));
-            for (int r = 0; r < K; r++)
-                Bcol[r] = matrix_get(B, r, j);
-            memcpy(payload + K, Bcol, (size_t)K * sizeof(double));
-
-            // Create job header with information for the worker
-            JobHeader h = { 
-                .cmd = CMD_MUL_CELL,        // Choose the operation type: multiplication of a single cell
-                .job_id = job_id++,          // Unique identifier for this job
-                .i = i,                      // Row index of the element to compute
-                .j = j,                      // Column index of the element to compute
-                .rows = R,                   // Total number of rows in the result matrix
-                .cols = Cc,                  // Total number of columns in the result matrix
-                .n = K,                      // Number of elements in the row/column (length of dot product)
-                .payload_bytes = (int)(2 * K * sizeof(double)) // Size of data being sent (row + column)
-            };
-
-            pool_send(wi, p, &h, payload);  // Send new job to worker
-            free(payload);
-            next++;
+            send_cells(p, wi, job_id++, A, B, i, j, span, payload);  // Send new job to worker
+            next += span;
         }
     }
 
-    free(Bcol);  // Free temporary column array
+    mat_free(payload);  // Give the buffers back to the cache
+    mat_free(vals);
     return C;    // Return the final result matrix
 }
-
@@ -0,0 +1,155 @@
+#include "common.h"
+#include "output.h"
+#include "file_io.h"
+#include <sys/stat.h>
+
+#define OUT_BUF_BYTES (1u << 16)   // formatted text is written in chunks of this size
+#define OUT_NUM_CHARS 32           // room for one "%g" value and its separator
+
+static int  g_mode = OUT_FULL;
+static int  g_head = 4;            // rows/columns shown at each end in head mode
+static char g_dir[256] = "output";
+
+static const char *g_names[] = { "none", "summary", "head", "full", "file" };
+
+int output_parse_mode(const char *s) {
+    for (int i = 0; i < (int)(sizeof(g_names) / sizeof(g_names[0])); i++) {
+        if (strcmp(s, g_names[i]) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+const char *output_mode_name(int mode) {
+    return mode >= 0 && mode <= OUT_FILE ? g_names[mode] : "?";
+}
+
+void output_set(int mode, int head, const char *dir) {
+    if (mode >= 0 && mode <= OUT_FILE) g_mode = mode;
+    if (head > 0) g_head = head;
+    if (dir && *dir) snprintf(g_dir, sizeof(g_dir), "%s", dir);
+}
+
+int output_mode(void) {
+    return g_mode;
+}
+
+// Text buffered in memory and handed to stdout in big writes
+typedef struct {
+    char buf[OUT_BUF_BYTES];
+    size_t len;
+} OutBuf;
+
+static void ob_flush(OutBuf *o) {
+    fwrite(o->buf, 1, o->len, stdout);
+    o->len = 0;
+}
+
+static void ob_str(OutBuf *o, const char *s) {
+    size_t n = strlen(s);
+    if (o->len + n > sizeof(o->buf)) ob_flush(o);
+    memcpy(o->buf + o->len, s, n);
+    o->len += n;
+}
+
+static void ob_num(OutBuf *o, double v, char sep) {
+    if (o->len + OUT_NUM_CHARS > sizeof(o->buf)) ob_flush(o);
+    o->len += (size_t)snprintf(o->buf + o->len, OUT_NUM_CHARS, "%g%c", v, sep);
+}
+
+// One row; with `skip` only the first and last g_head columns and "..." between.
+static void ob_row(OutBuf *o, const double *row, int cols, int skip) {
+    for (int j = 0; j < cols; j++) {
+        if (skip && j == g_head) {
+            ob_str(o, "... ");
+            j = cols - g_head;
+        }
+        ob_num(o, row[j], j < cols - 1 ? ' ' : '\n');
+    }
+    if (cols == 0) ob_str(o, "\n");
+}
+
+static void print_summary(const double *d, int rows, int cols) {
+    size_t n = (size_t)rows * cols;
+    double sq = 0.0, mx = 0.0, sum = 0.0;
+    for (size_t i = 0; i < n; i++) {
+        sq += d[i] * d[i];
+        sum += d[i];
+        if (fabs(d[i]) > mx) mx = fabs(d[i]);
+    }
+    printf("%dx%d  frobenius=%.10g  max|x|=%.10g  sum=%.10g  checksum=%016llx\n",
+           rows, cols, sqrt(sq), mx, sum, (unsigned long long)matrix_checksum(d, n));
+}
+
+// Writes the values to <dir>/<label>.txt and says where they went.
+static void print_to_file(const double *d, int rows, int cols, const char *label) {
+    mkdir(g_dir, 0777);   // ignore failure, write_matrix_file reports it
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s.txt", g_dir, label);
+    if (write_matrix_data(path, label, rows, cols, d) == 0)
+        printf("%dx%d written to %s\n", rows, cols, path);
+    else
+        printf("Failed to write %s\n", path);
+}
+
+void output_matrix(const Matrix *m, const char *label) {
+    switch (g_mode) {
+        case OUT_NONE:
+            return;
+        case OUT_SUMMARY:
+            print_summary(m->data, m->rows, m->cols);
+            return;
+        case OUT_FILE:
+            print_to_file(m->data, m->rows, m->cols, label);
+            return;
+        default:
+            break;
+    }
+    int head = g_mode == OUT_HEAD;
+    int skip_rows = head && m->rows > 2 * g_head;
+    int skip_cols = head && m->cols > 2 * g_head;
+    OutBuf *o = (OutBuf*)xmalloc(sizeof(OutBuf));
+    o->len = 0;
+    for (int i = 0; i < m->rows; i++) {
+        if (skip_rows && i == g_head) {
+            ob_str(o, "...\n");
+            i = m->rows - g_head;
+        }
+        ob_row(o, &m->data[(size_t)i * m->cols], m->cols, skip_cols);
+    }
+    ob_flush(o);
+    free(o);
+    fflush(stdout);
+}
+
+void output_vector(const double *v, int n, const char *label) {
+    switch (g_mode) {
+        case OUT_NONE:
+            return;
+        case OUT_SUMMARY:
+            printf("eigenvector: ");
+            print_summary(v, n, 1);
+            return;
+        case OUT_FILE:
+            printf("eigenvector: ");
+            print_to_file(v, n, 1, label);
+            return;
+        default:
+            break;
+    }
+    printf("eigenvector:\n");
+    int skip = g_mode == OUT_HEAD && n > 2 * g_head;
+    OutBuf *o = (OutBuf*)xmalloc(sizeof(OutBuf));
+    o->len = 0;
+    for (int i = 0; i < n; i++) {
+        if (skip && i == g_head) {
+            ob_str(o, "...\n");
+            i = n - g_head;
+        }
+        ob_num(o, v[i], '\n');
+    }
+    ob_flush(o);
+    free(o);
+    fflush(stdout);
+}
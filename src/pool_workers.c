@@ -1,6 +1,8 @@
 #include "common.h"
 #include "pool.h"
 #include "timer.h"
+#include "mat_alloc.h"
+#include "cost.h"
 #include <omp.h>
 static void worker_loop(int read_fd, int write_fd);
 static ssize_t read_exact(int fd, void *buf, size_t n) { return read_all(fd, buf, n); }
@@ -92,7 +94,9 @@ int pool_send(int wi, Pool *p, const JobHeader *h, const void *payload)
     if (w->busy) {              // if this child if busy we will return the error or -1 and make the errno ponit on the busy
          errno = EBUSY; return -1;
          }
-    if (write_exact(w->to_child, h, sizeof(*h)) != sizeof(*h)) return -1;
+    JobHeader hs = *h;          // the worker follows the OpenMP switch of the menu as it is now
+    hs.omp = g_omp_enabled;
+    if (write_exact(w->to_child, &hs, sizeof(hs)) != sizeof(hs)) return -1;
                                 // if the worker is not busy so we need to send him a jop by the pipe, so we set the jop header and point it using the to child pipe        
     if (h->payload_bytes > 0)
      {
@@ -164,41 +168,57 @@ int pool_recv(int wi, Pool *p, ResultHeader *rh, void *payload_buf, size_t bufca
 
 
 static void handle_add(const JobHeader *h, int rfd, int wfd) {
-    (void)rfd;                            // function for add we will get the jop inforamtion type, location ,size and the number of it in the read and write
-    double x[2];                          // set a array of tow varible 
-    read_all(rfd, x, sizeof(x));          // read the inforamion fully with the read all function that we make it in the common.h
-    double c = x[0] + x[1];               // so the result of this matrix know having tow number from the parent send
-    ResultHeader rh = { .cmd = h->cmd, .job_id = h->job_id, .i=h->i, .j=h->j, .rows=h->rows, .cols=h->cols, .payload_bytes=(int)sizeof(double) };
+    int n = h->n;                         // function for add we will get the jop inforamtion type, location ,size and the number of it in the read and write
+    double *x = mat_alloc((size_t)n * 2); // n elements of the first matrix then the n matching elements of the second
+    read_all(rfd, x, (size_t)n * 2 * sizeof(double));  // read the inforamion fully with the read all function that we make it in the common.h
+    uint64_t t0 = now_nanos();
+    for (int k=0;k<n;k++) x[k] += x[n+k]; // so the result of this chunk know having the numbers from the parent send
+    ResultHeader rh = { .cmd = h->cmd, .job_id = h->job_id, .i=h->i, .j=h->j, .rows=h->rows, .cols=h->cols, .payload_bytes=(int)((size_t)n * sizeof(double)),
+                        .compute_ns = (int64_t)(now_nanos() - t0) };
     write_all(wfd, &rh, sizeof(rh));      // we will set the head of the result that the proccses will handle it then with all the information of the jop 
-    write_all(wfd, &c, sizeof(double));   // then send the result to the perant by the pipe
+    write_all(wfd, x, (size_t)n * sizeof(double));   // then send the result to the perant by the pipe
+    mat_free(x);
 }                                         // so we will recive an information , then we will make the procses, then we will send the resullt back
 
 
 static void handle_sub(const JobHeader *h, int rfd, int wfd) {
-    double x[2];                          // function for a sub the same as the add function
-    read_all(rfd, x, sizeof(x));
-    double c = x[0] - x[1];
-    ResultHeader rh = { .cmd = h->cmd, .job_id = h->job_id, .i=h->i, .j=h->j, .rows=h->rows, .cols=h->cols, .payload_bytes=(int)sizeof(double) };
+    int n = h->n;                         // function for a sub the same as the add function
+    double *x = mat_alloc((size_t)n * 2);
+    read_all(rfd, x, (size_t)n * 2 * sizeof(double));
+    uint64_t t0 = now_nanos();
+    for (int k=0;k<n;k++) x[k] -= x[n+k];
+    ResultHeader rh = { .cmd = h->cmd, .job_id = h->job_id, .i=h->i, .j=h->j, .rows=h->rows, .cols=h->cols, .payload_bytes=(int)((size_t)n * sizeof(double)),
+                        .compute_ns = (int64_t)(now_nanos() - t0) };
     write_all(wfd, &rh, sizeof(rh));
 
-    write_all(wfd, &c, sizeof(double));
+    write_all(wfd, x, (size_t)n * sizeof(double));
+    mat_free(x);
 }
 
 
 static void handle_mul_cell(const JobHeader *h, int rfd, int wfd) {
     int n = h->n;                         // function for multiblation the same as before 
-    double *row = (double*)malloc((size_t)n * sizeof(double));
-    double *col = (double*)malloc((size_t)n * sizeof(double));
+    int span = h->cols;                   // cells (i, j .. j+span-1): one row of A and span columns of B
+    double *row = mat_alloc((size_t)n);
+    double *col = mat_alloc((size_t)n * span);
+    double *out = mat_alloc((size_t)span);
 
     read_all(rfd, row, (size_t)n * sizeof(double));
-    read_all(rfd, col, (size_t)n * sizeof(double));
-    double s = 0.0;
-#pragma omp parallel for if(g_omp_enabled)  // here we have the openmp enable or disable depened on the varible we will set in the menu
-    for (int k=0;k<n;k++) s += row[k] * col[k];
-    ResultHeader rh = { .cmd = h->cmd, .job_id = h->job_id, .i=h->i, .j=h->j, .rows=1, .cols=1, .payload_bytes=(int)sizeof(double) };
+    read_all(rfd, col, (size_t)n * span * sizeof(double));
+    uint64_t t0 = now_nanos();
+    int T = cost_threads(2.0 * n * span, 8.0 * n * span);
+#pragma omp parallel for num_threads(T) if(T > 1)  // here we have the openmp enable or disable depened on the varible we will set in the menu, and the cost model says if a team is worth it
+    for (int c=0;c<span;c++) {
+        double s = 0.0;
+        const double *cc = &col[(size_t)c * n];
+        for (int k=0;k<n;k++) s += row[k] * cc[k];
+        out[c] = s;
+    }
+    ResultHeader rh = { .cmd = h->cmd, .job_id = h->job_id, .i=h->i, .j=h->j, .rows=1, .cols=span, .payload_bytes=(int)((size_t)span * sizeof(double)),
+                        .compute_ns = (int64_t)(now_nanos() - t0) };
     write_all(wfd, &rh, sizeof(rh));
-    write_all(wfd, &s, sizeof(double));
-    free(row); free(col);
+    write_all(wfd, out, (size_t)span * sizeof(double));
+    mat_free(row); mat_free(col); mat_free(out);
 }
 
 
@@ -207,8 +227,8 @@ static void handle_det_row_elim(const JobHeader *h, int rfd, int wfd) {
                                   // function for determinant row elimination , we used the gaussian elimination , each worker will edit one row only, depened on the pivot row
     int k = h->j;                 // so that the k is the pivot column index and the n is the colomn , we create a space for a memory for both of them, , then we will read the rows form the parent by using the read all function       
                                   // thw orker will read tow ros from the pipe rfd the prow and the row the currant one ,the parent will send him as a payload
-    double *prow = (double*)malloc((size_t)n * sizeof(double));
-    double *row  = (double*)malloc((size_t)n * sizeof(double));
+    double *prow = mat_alloc((size_t)n);
+    double *row  = mat_alloc((size_t)n);
     read_all(rfd, prow, (size_t)n * sizeof(double));
     
     read_all(rfd, row,  (size_t)n * sizeof(double));
@@ -221,7 +241,7 @@ static void handle_det_row_elim(const JobHeader *h, int rfd, int wfd) {
     ResultHeader rh = { .cmd = h->cmd, .job_id=h->job_id, .i=h->i, .j=h->j, .rows=1, .cols=n, .payload_bytes=(int)(n*sizeof(double)) };
     write_all(wfd, &rh, sizeof(rh));
     write_all(wfd, row, (size_t)n * sizeof(double));
-    free(prow); free(row);
+    mat_free(prow); mat_free(row);
 }
 
 
@@ -229,9 +249,9 @@ static void handle_det_row_elim(const JobHeader *h, int rfd, int wfd) {
 static void handle_eig_row_dot(const JobHeader *h, int rfd, int wfd) {
     int n = h->n;                // function for calculate the eigenvalues , so the worker will calculate the dot product between a rows and the vector 
                                  // so we will get the size of the matrix then get for them a memory as we discripe before
-    double *row = (double*)malloc((size_t)n * sizeof(double));
+    double *row = mat_alloc((size_t)n);
                                  // we will read a single row from the parent and a vector also from the parent they will should both of them have the same size 
-    double *vec = (double*)malloc((size_t)n * sizeof(double));
+    double *vec = mat_alloc((size_t)n);
     read_all(rfd, row, (size_t)n * sizeof(double));
                                  // then we will do a dot product between the row and the vector with the eqation (vec[k]*row[k])sum (from k =0 to n-1) = s  and the result is the one double number
     read_all(rfd, vec, (size_t)n * sizeof(double));
@@ -242,7 +262,7 @@ static void handle_eig_row_dot(const JobHeader *h, int rfd, int wfd) {
                                   // put the resuld on the header to prepare it to send it by a pipe to the parent , then send it with a write all function , we will send the header and the result s to the parent , then clear the memory
     write_all(wfd, &rh, sizeof(rh));
     write_all(wfd, &s, sizeof(double));
-    free(row); free(vec);
+    mat_free(row); mat_free(vec);
 }
 
 
@@ -257,6 +277,7 @@ static void worker_loop(int read_fd, int write_fd) {
         ssize_t r = read_exact(read_fd, &h, sizeof(h));
         if (r == 0) break;          // we will get in the infint loop and before that we will we will set an signal and told him to ignore any intrupt from it
         if (r != sizeof(h)) break;  // so in the first we will get the diffine the header , then we will read from the pipe that the parend is send to us what is the type of the work CMD and read everything aslo
+        g_omp_enabled = h.omp;      // OpenMP on or off as the parent has it for this job
         switch (h.cmd) {            
             case CMD_ADD_ELEM:      handle_add(&h, read_fd, write_fd); break;
             case CMD_SUB_ELEM:      handle_sub(&h, read_fd, write_fd); break;
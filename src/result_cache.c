@@ -0,0 +1,144 @@
+#include "common.h"
+#include "result_cache.h"
+#include "mat_alloc.h"
+
+typedef struct {
+    int used;
+    RCacheKey key;
+    RCacheValue val;
+    size_t bytes;        // bytes of vec + mat data held by this entry
+    uint64_t last_use;
+} Entry;
+
+static Entry *g_entries = NULL;
+static int g_cap = 0;
+static size_t g_max_bytes = 0, g_bytes = 0;
+static uint64_t g_clock = 0;
+static unsigned long long g_hits = 0, g_misses = 0;
+
+// Creates the cache. max_entries = 0 disables caching.
+void rcache_init(int max_entries, size_t max_bytes) {
+    rcache_free();
+    if (max_entries <= 0) return;
+    g_entries = (Entry*)xmalloc((size_t)max_entries * sizeof(Entry));
+    memset(g_entries, 0, (size_t)max_entries * sizeof(Entry));
+    g_cap = max_entries;
+    g_max_bytes = max_bytes;
+}
+
+// Drops the data held by one entry.
+static void drop(Entry *e) {
+    if (!e->used) return;
+    mat_free(e->val.vec);
+    matrix_free(e->val.mat);
+    g_bytes -= e->bytes;
+    memset(e, 0, sizeof(*e));
+}
+
+// Frees every entry and the table itself.
+void rcache_free(void) {
+    for (int i = 0; i < g_cap; i++) drop(&g_entries[i]);
+    free(g_entries);
+    g_entries = NULL;
+    g_cap = 0;
+    g_bytes = 0;
+}
+
+// Fills a key from the operands (B may be NULL) and parameters.
+void rcache_key(RCacheKey *k, int op, const Matrix *A, const Matrix *B, double param, int iparam) {
+    memset(k, 0, sizeof(*k));
+    k->op = op;
+    snprintf(k->a, sizeof(k->a), "%s", A->name);
+    k->va = A->version;
+    if (B != NULL) {
+        snprintf(k->b, sizeof(k->b), "%s", B->name);
+        k->vb = B->version;
+    }
+    k->param = param;
+    k->iparam = iparam;
+}
+
+static int key_eq(const RCacheKey *x, const RCacheKey *y) {
+    return x->op == y->op && x->va == y->va && x->vb == y->vb &&
+           x->param == y->param && x->iparam == y->iparam &&
+           strcmp(x->a, y->a) == 0 && strcmp(x->b, y->b) == 0;
+}
+
+// Returns the cached value for a key or NULL.
+const RCacheValue *rcache_lookup(const RCacheKey *k) {
+    for (int i = 0; i < g_cap; i++) {
+        if (g_entries[i].used && key_eq(&g_entries[i].key, k)) {
+            g_entries[i].last_use = ++g_clock;
+            g_hits++;
+            return &g_entries[i].val;
+        }
+    }
+    g_misses++;
+    return NULL;
+}
+
+// Returns the least recently used entry (or a free one).
+static Entry *lru_slot(void) {
+    Entry *victim = &g_entries[0];
+    for (int i = 0; i < g_cap; i++) {
+        if (!g_entries[i].used) return &g_entries[i];
+        if (g_entries[i].last_use < victim->last_use) victim = &g_entries[i];
+    }
+    return victim;
+}
+
+// Evicts LRU entries until the byte limit leaves room for `need` more bytes.
+static void make_room(size_t need) {
+    while (g_max_bytes > 0 && g_bytes + need > g_max_bytes) {
+        Entry *victim = NULL;
+        for (int i = 0; i < g_cap; i++) {
+            if (g_entries[i].used && g_entries[i].bytes > 0 &&
+                (victim == NULL || g_entries[i].last_use < victim->last_use)) {
+                victim = &g_entries[i];
+            }
+        }
+        if (victim == NULL) return;
+        drop(victim);
+    }
+}
+
+// Stores a result. Results bigger than the whole byte budget are not cached.
+void rcache_put(const RCacheKey *k, double scalar, int iters, const double *vec, int vec_len, const Matrix *mat) {
+    if (g_cap == 0) return;
+    size_t bytes = (vec ? (size_t)vec_len * sizeof(double) : 0) + (mat ? matrix_bytes(mat) : 0);
+    if (g_max_bytes > 0 && bytes > g_max_bytes) return;
+
+    make_room(bytes);
+    Entry *e = lru_slot();
+    drop(e);
+
+    e->used = 1;
+    e->key = *k;
+    e->val.scalar = scalar;
+    e->val.iters = iters;
+    if (vec != NULL) {
+        e->val.vec = mat_alloc((size_t)vec_len);
+        memcpy(e->val.vec, vec, (size_t)vec_len * sizeof(double));
+        e->val.vec_len = vec_len;
+    }
+    if (mat != NULL) {
+        e->val.mat = matrix_create(mat->name, mat->rows, mat->cols);
+        memcpy(e->val.mat->data, mat->data, matrix_bytes(mat));
+    }
+    e->bytes = bytes;
+    e->last_use = ++g_clock;
+    g_bytes += bytes;
+}
+
+unsigned long long rcache_hits(void) {
+    return g_hits;
+}
+
+// Prints the cache counters.
+void rcache_print_stats(void) {
+    if (g_cap == 0) return;   // cache off (cache_entries=0)
+    int used = 0;
+    for (int i = 0; i < g_cap; i++) used += g_entries[i].used;
+    printf("result cache: %d/%d entries, %.1f MB, hits=%llu misses=%llu\n",
+           used, g_cap, (double)g_bytes / (1024.0 * 1024.0), g_hits, g_misses);
+}
@@ -2,6 +2,8 @@
 
 #include <time.h>
 #include <stdint.h>
+#include <string.h>
+#include "timer.h"
 
 // Returns the current time in milliseconds as a 64-bit unsigned integer. since an arbitrary point (monotonic clock).
 // Uses CLOCK_MONOTONIC to ensure the time is not affected by system clock changes.
@@ -13,3 +15,22 @@ uint64_t now_millis(void) {
     // Convert seconds to milliseconds, add nanoseconds converted to milliseconds
     return (uint64_t)ts.tv_sec * 1000ull+ (uint64_t)ts.tv_nsec / 1000000ull;
 }
+
+// Same monotonic clock at full resolution: nanoseconds since an arbitrary point.
+uint64_t now_nanos(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+PhaseTimes g_phase;
+
+static const char *g_phase_names[PH_COUNT] = { "setup", "marshal", "dispatch", "compute", "collect", "assemble" };
+
+void phase_begin(void) {
+    memset(&g_phase, 0, sizeof(g_phase));
+}
+
+const char *phase_name(int ph) {
+    return ph >= 0 && ph < PH_COUNT ? g_phase_names[ph] : "?";
+}